@@ -0,0 +1,252 @@
+/**
+ * @file att-trace.c
+ * @brief in memory ring of raw ATT PDUs, dumped as a btsnoop file
+ *
+ * Recording a PDU is a monotonic clock read and a copy of at most snaplen
+ * bytes into a slot allocated up front, the oldest slot is overwritten
+ * once the ring is full. Nothing is formatted until the ring is dumped.
+ *
+ * The dump is a btsnoop file with the HCI UART (H4) datalink, each PDU is
+ * wrapped in an ACL data packet of the given connection handle and an
+ * L2CAP basic frame on the ATT channel, as btmon or Wireshark expect it.
+ * The monotonic timestamps are shifted to wall clock time at dump time.
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "att-trace.h"
+
+#define BTSNOOP_MAGIC			"btsnoop\0"
+#define BTSNOOP_VERSION			1
+#define BTSNOOP_TYPE_HCI_UART	1002
+
+#define BTSNOOP_FLAG_RECEIVED	0x01
+
+/* microseconds from 0000-01-01 to 1970-01-01 */
+#define BTSNOOP_EPOCH_DELTA		0x00dcddb30f2f8000ULL
+
+#define H4_ACL_PKT				0x02
+#define ACL_START				0x2000
+#define ATT_CID					0x0004
+
+/* H4 type, ACL header and L2CAP header ahead of the PDU */
+#define TRACE_HDR_SIZE			9
+
+struct btsnoop_hdr {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t type;
+} __attribute__((packed));
+
+struct btsnoop_pkt {
+    uint32_t size;
+    uint32_t len;
+    uint32_t flags;
+    uint32_t drops;
+    uint64_t ts;
+} __attribute__((packed));
+
+struct att_trace_entry {
+    struct timespec time;
+    uint16_t len;                   /**< PDU length */
+    uint16_t caplen;                /**< bytes kept, at most snaplen */
+    bool received;
+};
+
+struct att_trace {
+    unsigned int size;
+    uint16_t snaplen;
+    /// PDUs recorded so far, the next slot is count % size
+    uint64_t count;
+    struct att_trace_entry * entries;
+    uint8_t * data;
+};
+
+/**
+ * allocate a ring, the memory is taken once here
+ *
+ * @param entries	PDUs kept
+ * @param snaplen	bytes kept per PDU, longer ones are truncated
+ * @return ring or NULL
+ */
+struct att_trace * att_trace_new(unsigned int entries, uint16_t snaplen) {
+    struct att_trace * trace;
+
+    if (!entries || !snaplen)
+        return NULL;
+
+    trace = new0(struct att_trace, 1);
+    if (!trace)
+        return NULL;
+
+    trace->size = entries;
+    trace->snaplen = snaplen;
+    trace->entries = calloc(entries, sizeof(*trace->entries));
+    trace->data = malloc((size_t) entries * snaplen);
+    if (!trace->entries || !trace->data) {
+        att_trace_free(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+void att_trace_free(struct att_trace * trace) {
+    if (!trace)
+        return;
+
+    free(trace->entries);
+    free(trace->data);
+    free(trace);
+}
+
+/**
+ * keep a PDU, the oldest one goes when the ring is full
+ *
+ * @param trace		ring, NULL records nothing
+ * @param received	true for a PDU from the remote, false for a sent one
+ * @param pdu		ATT PDU, opcode first
+ * @param len		PDU length
+ */
+void att_trace_record(struct att_trace * trace, bool received,
+                      const void * pdu, uint16_t len) {
+    struct att_trace_entry * entry;
+    unsigned int slot;
+
+    if (!trace)
+        return;
+
+    slot = trace->count++ % trace->size;
+    entry = &trace->entries[slot];
+
+    clock_gettime(CLOCK_MONOTONIC, &entry->time);
+    entry->len = len;
+    entry->caplen = len < trace->snaplen ? len : trace->snaplen;
+    entry->received = received;
+    memcpy(trace->data + (size_t) slot * trace->snaplen, pdu, entry->caplen);
+}
+
+void att_trace_clear(struct att_trace * trace) {
+    if (trace)
+        trace->count = 0;
+}
+
+/**
+ * @param trace	ring
+ * @return PDUs currently held
+ */
+unsigned int att_trace_count(struct att_trace * trace) {
+    if (!trace)
+        return 0;
+
+    return trace->count < trace->size ? trace->count : trace->size;
+}
+
+static int write_pkt(FILE * fp, const struct att_trace * trace,
+                     unsigned int slot, uint16_t handle, int64_t offset_us) {
+    const struct att_trace_entry * entry = &trace->entries[slot];
+    struct btsnoop_pkt pkt;
+    uint8_t hdr[TRACE_HDR_SIZE];
+    int64_t us;
+
+    us = (int64_t) entry->time.tv_sec * 1000000 +
+         entry->time.tv_nsec / 1000 + offset_us;
+
+    pkt.size = htobe32(TRACE_HDR_SIZE + entry->len);
+    pkt.len = htobe32(TRACE_HDR_SIZE + entry->caplen);
+    pkt.flags = htobe32(entry->received ? BTSNOOP_FLAG_RECEIVED : 0);
+    pkt.drops = 0;
+    pkt.ts = htobe64((uint64_t) us + BTSNOOP_EPOCH_DELTA);
+
+    hdr[0] = H4_ACL_PKT;
+    put_le16((handle & 0x0fff) | ACL_START, hdr + 1);
+    put_le16(4 + entry->len, hdr + 3);
+    put_le16(entry->len, hdr + 5);
+    put_le16(ATT_CID, hdr + 7);
+
+    if (fwrite(&pkt, sizeof(pkt), 1, fp) != 1 ||
+        fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+        return -EIO;
+
+    if (entry->caplen &&
+        fwrite(trace->data + (size_t) slot * trace->snaplen, entry->caplen,
+               1, fp) != 1)
+        return -EIO;
+
+    return 0;
+}
+
+/**
+ * write the ring oldest PDU first, the file is replaced atomically
+ *
+ * @param trace		ring
+ * @param handle	ACL connection handle put in the packets
+ * @param path		btsnoop file
+ * @return PDUs written or -errno
+ */
+int att_trace_dump(struct att_trace * trace, uint16_t handle,
+                   const char * path) {
+    struct btsnoop_hdr hdr;
+    struct timespec mono, real;
+    int64_t offset_us;
+    unsigned int n, first, i;
+    char tmp[PATH_MAX];
+    FILE * fp;
+    int err = 0;
+
+    if (!trace || !path)
+        return -EINVAL;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+        return -ENAMETOOLONG;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    offset_us = ((int64_t) real.tv_sec - mono.tv_sec) * 1000000 +
+                (real.tv_nsec - mono.tv_nsec) / 1000;
+
+    fp = fopen(tmp, "we");
+    if (!fp)
+        return -errno;
+
+    memcpy(hdr.magic, BTSNOOP_MAGIC, sizeof(hdr.magic));
+    hdr.version = htobe32(BTSNOOP_VERSION);
+    hdr.type = htobe32(BTSNOOP_TYPE_HCI_UART);
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        err = -EIO;
+
+    n = att_trace_count(trace);
+    first = trace->count > trace->size ? trace->count % trace->size : 0;
+
+    for (i = 0; i < n && !err; i++)
+        err = write_pkt(fp, trace, (first + i) % trace->size, handle,
+                        offset_us);
+
+    if (fclose(fp) && !err)
+        err = -errno;
+
+    if (!err && rename(tmp, path) < 0)
+        err = -errno;
+
+    if (err) {
+        unlink(tmp);
+        return err;
+    }
+
+    return n;
+}
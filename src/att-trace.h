@@ -0,0 +1,25 @@
+/**
+ * @file att-trace.h
+ * @brief in memory ring of raw ATT PDUs, dumped as a btsnoop file
+ * @see att-trace.c
+ */
+#ifndef SRC_ATT_TRACE_H
+#define SRC_ATT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct att_trace;
+
+struct att_trace * att_trace_new(unsigned int entries, uint16_t snaplen);
+void att_trace_free(struct att_trace * trace);
+
+void att_trace_record(struct att_trace * trace, bool received,
+                      const void * pdu, uint16_t len);
+void att_trace_clear(struct att_trace * trace);
+unsigned int att_trace_count(struct att_trace * trace);
+
+int att_trace_dump(struct att_trace * trace, uint16_t handle,
+                   const char * path);
+
+#endif //SRC_ATT_TRACE_H
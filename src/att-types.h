@@ -36,6 +36,17 @@
 #define BT_ATT_MAX_LE_MTU	517
 #define BT_ATT_MAX_VALUE_LEN	512
 
+/* ATT bearers: the LE fixed channel, EATT enhanced credit based channels */
+#define BT_ATT_LE		0x01
+#define BT_ATT_EATT		0x02
+#define BT_ATT_EATT_PSM		0x0027
+#define BT_ATT_EATT_MIN_MTU	64
+
+/* Client and Server Supported Features bits */
+#define BT_GATT_CHRC_CLI_FEAT_ROBUST_CACHING	0x01
+#define BT_GATT_CHRC_CLI_FEAT_EATT		0x02
+#define BT_GATT_CHRC_SERVER_FEAT_EATT		0x01
+
 /* ATT protocol opcodes */
 #define BT_ATT_OP_ERROR_RSP			0x01
 #define BT_ATT_OP_MTU_REQ			0x02
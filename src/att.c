@@ -39,6 +39,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #include "io.h"
 #include "queue.h"
@@ -48,6 +51,8 @@
 #include "uuid.h"
 #include "att.h"
 #include "crypto.h"
+#include "att-trace.h"
+#include "latency.h"
 
 #define ATT_MIN_PDU_LEN			1  /* At least 1 byte for the opcode. */
 #define ATT_OP_CMD_MASK			0x40
@@ -57,42 +62,101 @@
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
 
+/* Free send op slots kept per bt_att */
+#define ATT_OP_POOL_MAX			16
+
+/* Receive buffers per bt_att, a pinned buffer is skipped until released */
+#define ATT_RX_RING_SIZE		8
+
+/* Size of the opcode indexed tables */
+#define ATT_OPCODE_COUNT		256
+
+/* PDUs sent per EPOLLOUT wakeup at most */
+#define ATT_WRITE_BATCH_MAX		16
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 struct att_send_op;
 
 /**
- * ATT structure (protocol context)
+ * ATT bearer, the LE fixed channel or an EATT enhanced credit based channel
  */
-struct bt_att {
-    /// reference counter incremented by bt_att_ref, decremented by bt_att_unref
-    int ref_count;
+struct bt_att_chan {
+    /// owner, not referenced
+    struct bt_att * att;
+    /// BT_ATT_LE or BT_ATT_EATT
+    uint8_t type;
     /// socket
     int fd;
+    /// file status flags of the socket as the caller handed it over
+    int fd_flags;
     /// io structure for low level i/o (read and write)
     struct io * io;
     /// true if an l2cap socket
     bool io_on_l2cap;
     /// i/o seurity level: Only used for non-L2CAP
     int io_sec_level;
-    /// Queued ATT protocol requests
-    struct queue * req_queue;
+    /// largest PDU of the bearer, the att mtu on the fixed channel
+    uint16_t mtu;
     /// Pending request state
     struct att_send_op * pending_req;
-    /// Queued ATT protocol indications
-    struct queue * ind_queue;
     /// Pending indication state
     struct att_send_op * pending_ind;
-    /// Queue of PDUs ready to send
-    struct queue * write_queue;
     /// true if already engaged in write operation
     bool writer_active;
+    /// There's a pending incoming request
+    bool in_req;
+};
+
+/**
+ * ATT structure (protocol context)
+ */
+struct bt_att {
+    /// reference counter incremented by bt_att_ref, decremented by bt_att_unref
+    int ref_count;
+    /// fixed channel, its io is NULL once disconnected
+    struct bt_att_chan * fixed;
+    /// every bearer, the fixed channel first then the EATT ones
+    struct queue * chans;
+    /// bearer of the PDU being dispatched, NULL outside of handle_pdu
+    struct bt_att_chan * rx_chan;
+    /// sockets of the bearers are closed with them
+    bool close_on_unref;
+    /// Queued ATT protocol requests, shared by the bearers
+    struct queue * req_queue;
+    /// Queued ATT protocol indications
+    struct queue * ind_queue;
+    /// Queue of PDUs ready to send
+    struct queue * write_queue;
     /// List of registered callbacks
     struct queue * notify_list;
+    /// the same callbacks chained by opcode, BT_ATT_ALL_REQUESTS at 0x00,
+    /// chains are allocated on first use
+    struct queue * notify_table[ATT_OPCODE_COUNT];
     /// List of disconnect handlers
     struct queue * disconn_list;
-    /// There's a pending incoming request
-    bool in_req;
-    /// buffer pointer
-    uint8_t * buf;
+    /// List of end of read batch handlers
+    struct queue * batch_list;
+    /// PDUs read per EPOLLIN wakeup at most, 1 means no draining
+    unsigned int read_budget;
+    /// EPOLLIN wakeups and PDUs read
+    uint64_t read_wakeups;
+    uint64_t read_pdus;
+    /// write batches, PDUs and syscalls, largest batch
+    uint64_t write_batches;
+    uint64_t write_pdus;
+    uint64_t write_syscalls;
+    unsigned int write_batch_max;
+    /// receive buffers, reused once no consumer pins them
+    struct bt_att_buf * rx_ring[ATT_RX_RING_SIZE];
+    /// next rx_ring slot to try
+    unsigned int rx_next;
+    /// buffer of the PDU being dispatched, NULL outside of handle_pdu
+    struct bt_att_buf * rx_buf;
+    /// raw PDU trace, owned by the caller, NULL when not tracing
+    struct att_trace * trace;
+    /// round trip and queue wait per opcode, allocated on first send
+    struct att_latency * latency[ATT_OPCODE_COUNT];
     /// actual number of bytes for pdu ATT exchange
     uint16_t mtu;
     /// IDs for "send" ops
@@ -117,70 +181,78 @@ struct bt_att {
     bool ext_signed;
     ///	local key structure pointer
     struct sign_info * local_sign;
+    /// free send op slots, linked by next, PDU area sized to mtu
+    struct att_send_op * op_pool;
+    /// number of slots in op_pool
+    unsigned int op_pool_count;
+    /// send ops served from op_pool
+    uint64_t op_pool_hits;
+    /// send ops that needed an allocation
+    uint64_t op_pool_misses;
     /// remote key structure pointer
     struct sign_info * remote_sign;
 };
 
+/* microseconds, rtt from the write of a request or indication to its
+ * response or confirmation, wait from bt_att_send to the write */
+struct att_latency {
+    struct latency_hist rtt;
+    struct latency_hist wait;
+};
+
 struct sign_info {
     uint8_t key[16];
+    /// key schedule of key, expanded once when the key is set
+    struct bt_crypto_key cmac;
     bt_att_counter_func_t counter;
     void * user_data;
 };
 
+/* zero is unknown so that unlisted opcodes of the table below default to it */
 enum att_op_type {
+    ATT_OP_TYPE_UNKNOWN,
     ATT_OP_TYPE_REQ,
     ATT_OP_TYPE_RSP,
     ATT_OP_TYPE_CMD,
     ATT_OP_TYPE_IND,
     ATT_OP_TYPE_NOT,
     ATT_OP_TYPE_CONF,
-    ATT_OP_TYPE_UNKNOWN,
 };
 
-static const struct {
-    uint8_t opcode;
-    enum att_op_type type;
-} att_opcode_type_table[] = {
-    { BT_ATT_OP_ERROR_RSP,			ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_MTU_REQ,			ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_MTU_RSP,			ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_FIND_INFO_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_FIND_INFO_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_FIND_BY_TYPE_VAL_REQ,	ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_FIND_BY_TYPE_VAL_RSP,	ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_READ_BY_TYPE_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_READ_BY_TYPE_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_READ_REQ,			ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_READ_RSP,			ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_READ_BLOB_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_READ_BLOB_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_READ_MULT_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_READ_MULT_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_READ_BY_GRP_TYPE_REQ,	ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_READ_BY_GRP_TYPE_RSP,	ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_WRITE_REQ,			ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_WRITE_RSP,			ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_WRITE_CMD,			ATT_OP_TYPE_CMD },
-    { BT_ATT_OP_SIGNED_WRITE_CMD,		ATT_OP_TYPE_CMD },
-    { BT_ATT_OP_PREP_WRITE_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_PREP_WRITE_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_EXEC_WRITE_REQ,		ATT_OP_TYPE_REQ },
-    { BT_ATT_OP_EXEC_WRITE_RSP,		ATT_OP_TYPE_RSP },
-    { BT_ATT_OP_HANDLE_VAL_NOT,		ATT_OP_TYPE_NOT },
-    { BT_ATT_OP_HANDLE_VAL_IND,		ATT_OP_TYPE_IND },
-    { BT_ATT_OP_HANDLE_VAL_CONF,		ATT_OP_TYPE_CONF },
-    { }
+/* indexed by opcode, every PDU goes through it */
+static const uint8_t att_opcode_type_table[ATT_OPCODE_COUNT] = {
+    [BT_ATT_OP_ERROR_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_MTU_REQ]				= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_MTU_RSP]				= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_FIND_INFO_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_FIND_INFO_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_FIND_BY_TYPE_VAL_REQ]		= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_FIND_BY_TYPE_VAL_RSP]		= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_READ_BY_TYPE_REQ]		= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_READ_BY_TYPE_RSP]		= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_READ_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_READ_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_READ_BLOB_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_READ_BLOB_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_READ_MULT_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_READ_MULT_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_READ_BY_GRP_TYPE_REQ]		= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_READ_BY_GRP_TYPE_RSP]		= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_WRITE_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_WRITE_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_WRITE_CMD]			= ATT_OP_TYPE_CMD,
+    [BT_ATT_OP_SIGNED_WRITE_CMD]		= ATT_OP_TYPE_CMD,
+    [BT_ATT_OP_PREP_WRITE_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_PREP_WRITE_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_EXEC_WRITE_REQ]			= ATT_OP_TYPE_REQ,
+    [BT_ATT_OP_EXEC_WRITE_RSP]			= ATT_OP_TYPE_RSP,
+    [BT_ATT_OP_HANDLE_VAL_NOT]			= ATT_OP_TYPE_NOT,
+    [BT_ATT_OP_HANDLE_VAL_IND]			= ATT_OP_TYPE_IND,
+    [BT_ATT_OP_HANDLE_VAL_CONF]			= ATT_OP_TYPE_CONF,
 };
 
 static enum att_op_type get_op_type(uint8_t opcode) {
-    int i;
-
-    for (i = 0; att_opcode_type_table[i].opcode; i++) {
-        if (att_opcode_type_table[i].opcode == opcode)
-            return att_opcode_type_table[i].type;
-    }
-
-    return ATT_OP_TYPE_UNKNOWN;
+    return att_opcode_type_table[opcode];
 }
 
 static const struct {
@@ -222,26 +294,128 @@ struct att_send_op {
     bt_att_response_func_t callback;
     bt_att_destroy_func_t destroy;
     void * user_data;
+    /* CLOCK_MONOTONIC us, set by bt_att_send and by the write */
+    uint64_t queued_us;
+    uint64_t sent_us;
+    /* bearer the op is pinned to, NULL for any */
+    struct bt_att_chan * chan;
+    /* slot bookkeeping, pdu points to pdu_buf */
+    struct bt_att * att;
+    struct att_send_op * next;
+    uint16_t pdu_size;
+    uint8_t pdu_buf[];
 };
 
+static uint64_t att_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t att_us32(uint64_t us) {
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+}
+
+/**
+ * @brief round trip of a request or indication, its answer just came
+ *
+ * @param att	att structure
+ * @param op	answered op
+ */
+static void att_latency_rtt(struct bt_att * att, struct att_send_op * op) {
+    struct att_latency * lat = att->latency[op->opcode & 0xff];
+
+    if (lat && op->sent_us)
+        latency_hist_add(&lat->rtt, att_us32(att_time_us() - op->sent_us));
+}
+
+/**
+ * @brief get a send op slot with room for a PDU of pdu_len bytes
+ * reuse a free slot of the att pool or allocate one sized to the mtu
+ *
+ * @param att		att structure
+ * @param pdu_len	PDU length, at most the mtu
+ * @return zeroed op with pdu set or NULL
+ */
+static struct att_send_op * alloc_att_send_op(struct bt_att * att,
+        uint16_t pdu_len) {
+    struct att_send_op * op = att->op_pool;
+    uint16_t pdu_size;
+
+    if (op && op->pdu_size >= pdu_len) {
+        att->op_pool = op->next;
+        att->op_pool_count--;
+        att->op_pool_hits++;
+        pdu_size = op->pdu_size;
+    } else {
+        pdu_size = att->mtu;
+        op = malloc(sizeof(*op) + pdu_size);
+        if (!op)
+            return NULL;
+
+        att->op_pool_misses++;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->att = att;
+    op->pdu_size = pdu_size;
+    op->pdu = op->pdu_buf;
+
+    return op;
+}
+
+/**
+ * @brief give a send op slot back to the pool of its att
+ * the destroy callback is not called
+ *
+ * @param op	att_send_op pointer
+ */
+static void release_att_send_op(struct att_send_op * op) {
+    struct bt_att * att = op->att;
+
+    /* slots of a previous, smaller mtu are not kept */
+    if (att->op_pool_count >= ATT_OP_POOL_MAX || op->pdu_size != att->mtu) {
+        free(op);
+        return;
+    }
+
+    op->next = att->op_pool;
+    att->op_pool = op;
+    att->op_pool_count++;
+}
+
+static void flush_att_send_op_pool(struct bt_att * att) {
+    struct att_send_op * op;
+
+    while ((op = att->op_pool)) {
+        att->op_pool = op->next;
+        free(op);
+    }
+
+    att->op_pool_count = 0;
+}
+
 /**
  * @brief destroy att send operation
- * calls the destroy callback with user_data as an argument
- * free pdu data
+ * return the slot to the pool, then call the destroy callback with
+ * user_data as an argument, the callback may drop the last att reference
  *
  * @param data	att_send_op pointer
  */
 static void destroy_att_send_op(void * data) {
     struct att_send_op * op = data;
+    bt_att_destroy_func_t destroy = op->destroy;
+    void * user_data = op->user_data;
 
     if (op->timeout_id)
         timeout_remove(op->timeout_id);
 
-    if (op->destroy)
-        op->destroy(op->user_data);
+    release_att_send_op(op);
 
-    free(op->pdu);
-    free(op);
+    if (destroy)
+        destroy(user_data);
 }
 
 static void cancel_att_send_op(struct att_send_op * op) {
@@ -301,25 +475,61 @@ static bool match_disconn_id(const void * a, const void * b) {
     return disconn->id == id;
 }
 
-static bool encode_pdu(struct bt_att * att, struct att_send_op * op,
-                       const void * pdu, uint16_t length) {
-    uint16_t pdu_len = 1;
-    struct sign_info * sign = att->local_sign;
-    uint32_t sign_cnt;
+struct att_batch {
+    unsigned int id;
+    bt_att_batch_func_t callback;
+    bt_att_destroy_func_t destroy;
+    void * user_data;
+};
+
+static void destroy_att_batch(void * data) {
+    struct att_batch * batch = data;
+
+    if (batch->destroy)
+        batch->destroy(batch->user_data);
+
+    free(batch);
+}
 
-    if (sign && (op->opcode & ATT_OP_SIGNED_MASK))
+static bool match_batch_id(const void * a, const void * b) {
+    const struct att_batch * batch = a;
+    unsigned int id = PTR_TO_UINT(b);
+
+    return batch->id == id;
+}
+
+static void batch_handler(void * data, void * user_data) {
+    struct att_batch * batch = data;
+
+    batch->callback(PTR_TO_UINT(user_data), batch->user_data);
+}
+
+static uint16_t encoded_pdu_len(struct bt_att * att, uint8_t opcode,
+                                uint16_t length) {
+    uint16_t pdu_len = 1 + length;
+
+    if (att->local_sign && (opcode & ATT_OP_SIGNED_MASK))
         pdu_len += BT_ATT_SIGNATURE_LEN;
 
-    if (length && pdu)
-        pdu_len += length;
+    return pdu_len;
+}
 
-    if (pdu_len > att->mtu)
-        return false;
+/**
+ * @brief encode the PDU into the op slot, sign it if needed
+ *
+ * @param att		att structure
+ * @param op		op from alloc_att_send_op, room for pdu_len bytes
+ * @param pdu		parameters
+ * @param length	parameters length
+ * @param pdu_len	encoded_pdu_len result
+ * @return true on success
+ */
+static bool encode_pdu(struct bt_att * att, struct att_send_op * op,
+                       const void * pdu, uint16_t length, uint16_t pdu_len) {
+    struct sign_info * sign = att->local_sign;
+    uint32_t sign_cnt;
 
     op->len = pdu_len;
-    op->pdu = malloc(op->len);
-    if (!op->pdu)
-        return false;
 
     ((uint8_t *) op->pdu)[0] = op->opcode;
     if (pdu_len > 1)
@@ -331,15 +541,15 @@ static bool encode_pdu(struct bt_att * att, struct att_send_op * op,
     if (!sign->counter(&sign_cnt, sign->user_data))
         goto fail;
 
-    if ((bt_crypto_sign_att(att->crypto, sign->key, op->pdu, 1 + length,
-                            sign_cnt, &((uint8_t *) op->pdu)[1 + length])))
+    if ((bt_crypto_sign_att_key(att->crypto, &sign->cmac, op->pdu,
+                                1 + length, sign_cnt,
+                                &((uint8_t *) op->pdu)[1 + length])))
         return true;
 
     util_debug(att->debug_callback, att->debug_data,
                "ATT unable to generate signature");
 
 fail:
-    free(op->pdu);
     return false;
 }
 
@@ -352,6 +562,7 @@ static struct att_send_op * create_att_send_op(struct bt_att * att,
         bt_att_destroy_func_t destroy) {
     struct att_send_op * op;
     enum att_op_type op_type;
+    uint16_t pdu_len;
 
     if (length && !pdu)
         return NULL;
@@ -373,7 +584,11 @@ static struct att_send_op * create_att_send_op(struct bt_att * att,
     if (!callback && (op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_IND))
         return NULL;
 
-    op = new0(struct att_send_op, 1);
+    pdu_len = encoded_pdu_len(att, opcode, length);
+    if (pdu_len > att->mtu)
+        return NULL;
+
+    op = alloc_att_send_op(att, pdu_len);
     if (!op)
         return NULL;
 
@@ -382,28 +597,51 @@ static struct att_send_op * create_att_send_op(struct bt_att * att,
     op->callback = callback;
     op->destroy = destroy;
     op->user_data = user_data;
+    op->queued_us = att_time_us();
 
-    if (!encode_pdu(att, op, pdu, length)) {
-        free(op);
+    if (!encode_pdu(att, op, pdu, length, pdu_len)) {
+        release_att_send_op(op);
         return NULL;
     }
 
     return op;
 }
 
-static struct att_send_op * pick_next_send_op(struct bt_att * att) {
+/**
+ * @brief can the bearer carry the op: ops pinned to a bearer only go out on
+ * it, the others on any bearer at least as large as the att mtu, the size
+ * gatt-client reads and writes long values with
+ */
+static bool match_op_chan(const void * a, const void * b) {
+    const struct att_send_op * op = a;
+    const struct bt_att_chan * chan = b;
+
+    if (op->chan)
+        return op->chan == chan;
+
+    return chan->mtu >= chan->att->mtu;
+}
+
+static bool match_op_pinned(const void * a, const void * b) {
+    const struct att_send_op * op = a;
+
+    return op->chan == b;
+}
+
+static struct att_send_op * pick_next_send_op(struct bt_att_chan * chan) {
+    struct bt_att * att = chan->att;
     struct att_send_op * op;
 
     /* See if any operations are already in the write queue */
-    op = queue_pop_head(att->write_queue);
+    op = queue_remove_if(att->write_queue, match_op_chan, chan);
     if (op)
         return op;
 
-    /* If there is no pending request, pick an operation from the
-     * request queue.
+    /* If there is no pending request on the bearer, pick an operation from
+     * the request queue.
      */
-    if (!att->pending_req) {
-        op = queue_pop_head(att->req_queue);
+    if (!chan->pending_req) {
+        op = queue_remove_if(att->req_queue, match_op_chan, chan);
         if (op)
             return op;
     }
@@ -411,8 +649,8 @@ static struct att_send_op * pick_next_send_op(struct bt_att * att) {
     /* There is either a request pending or no requests queued. If there is
      * no pending indication, pick an operation from the indication queue.
      */
-    if (!att->pending_ind) {
-        op = queue_pop_head(att->ind_queue);
+    if (!chan->pending_ind) {
+        op = queue_remove_if(att->ind_queue, match_op_chan, chan);
         if (op)
             return op;
     }
@@ -420,22 +658,71 @@ static struct att_send_op * pick_next_send_op(struct bt_att * att) {
     return NULL;
 }
 
+/**
+ * @brief bearer an op has to go out on, NULL for any
+ * the MTU exchange and the queued writes belong to the fixed channel,
+ * commands and notifications stay there to keep their order, responses and
+ * confirmations go back on the bearer of the request or indication
+ *
+ * @param att	att structure
+ * @param op	op being queued
+ * @return bearer or NULL
+ */
+static struct bt_att_chan * att_send_op_chan(struct bt_att * att,
+        struct att_send_op * op) {
+    const struct queue_entry * entry;
+
+    switch (op->type) {
+    case ATT_OP_TYPE_REQ:
+        if (op->opcode == BT_ATT_OP_MTU_REQ ||
+                op->opcode == BT_ATT_OP_PREP_WRITE_REQ ||
+                op->opcode == BT_ATT_OP_EXEC_WRITE_REQ)
+            return att->fixed;
+
+        return NULL;
+    case ATT_OP_TYPE_IND:
+        return NULL;
+    case ATT_OP_TYPE_RSP:
+        if (att->rx_chan)
+            return att->rx_chan;
+
+        /* a response deferred past the request callback */
+        for (entry = queue_get_entries(att->chans); entry;
+                entry = entry->next) {
+            struct bt_att_chan * chan = entry->data;
+
+            if (chan->in_req)
+                return chan;
+        }
+
+        return att->fixed;
+    case ATT_OP_TYPE_CONF:
+        return att->rx_chan ? att->rx_chan : att->fixed;
+    case ATT_OP_TYPE_CMD:
+    case ATT_OP_TYPE_NOT:
+    case ATT_OP_TYPE_UNKNOWN:
+    default:
+        return att->fixed;
+    }
+}
+
 struct timeout_data {
-    struct bt_att * att;
+    struct bt_att_chan * chan;
     unsigned int id;
 };
 
 static bool timeout_cb(void * user_data) {
     struct timeout_data * timeout = user_data;
-    struct bt_att * att = timeout->att;
+    struct bt_att_chan * chan = timeout->chan;
+    struct bt_att * att = chan->att;
     struct att_send_op * op = NULL;
 
-    if (att->pending_req && att->pending_req->id == timeout->id) {
-        op = att->pending_req;
-        att->pending_req = NULL;
-    } else if (att->pending_ind && att->pending_ind->id == timeout->id) {
-        op = att->pending_ind;
-        att->pending_ind = NULL;
+    if (chan->pending_req && chan->pending_req->id == timeout->id) {
+        op = chan->pending_req;
+        chan->pending_req = NULL;
+    } else if (chan->pending_ind && chan->pending_ind->id == timeout->id) {
+        op = chan->pending_ind;
+        chan->pending_ind = NULL;
     }
 
     if (!op)
@@ -451,68 +738,93 @@ static bool timeout_cb(void * user_data) {
     destroy_att_send_op(op);
 
     /*
-     * Directly terminate the connection as required by the ATT protocol.
+     * Directly terminate the bearer as required by the ATT protocol.
      * This should trigger an io disconnect event which will clean up the
      * io and notify the upper layer.
      */
-    io_shutdown(att->io);
+    io_shutdown(chan->io);
 
     return false;
 }
 
 static void write_watch_destroy(void * user_data) {
-    struct bt_att * att = user_data;
+    struct bt_att_chan * chan = user_data;
 
-    att->writer_active = false;
+    chan->writer_active = false;
 }
 
-static bool can_write_data(struct io * io, void * user_data) {
-    struct bt_att * att = user_data;
-    struct att_send_op * op;
-    struct timeout_data * timeout;
-    ssize_t ret;
-    struct iovec iov;
-
-    op = pick_next_send_op(att);
-    if (!op)
-        return false;
-
-    iov.iov_base = op->pdu;
-    iov.iov_len = op->len;
+/**
+ * @brief put back an op pick_next_send_op returned, at the head of its queue
+ *
+ * @param att	att structure
+ * @param op	unsent op
+ */
+static void requeue_att_send_op(struct bt_att * att, struct att_send_op * op) {
+    struct queue * queue;
 
-    ret = io_send(io, &iov, 1);
-    if (ret < 0) {
-        util_debug(att->debug_callback, att->debug_data,
-                   "write failed: %s", strerror(-ret));
-        if (op->callback)
-            op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-                         op->user_data);
+    switch (op->type) {
+    case ATT_OP_TYPE_REQ:
+        queue = att->req_queue;
+        break;
+    case ATT_OP_TYPE_IND:
+        queue = att->ind_queue;
+        break;
+    case ATT_OP_TYPE_CMD:
+    case ATT_OP_TYPE_NOT:
+    case ATT_OP_TYPE_UNKNOWN:
+    case ATT_OP_TYPE_RSP:
+    case ATT_OP_TYPE_CONF:
+    default:
+        queue = att->write_queue;
+        break;
+    }
 
+    if (!queue_push_head(queue, op))
         destroy_att_send_op(op);
-        return true;
-    }
+}
+
+/**
+ * @brief an op went out, arm the timeout of a request or indication, free
+ * anything else
+ *
+ * @param chan	bearer it went out on
+ * @param op	sent op
+ * @param len	bytes written
+ */
+static void att_send_op_sent(struct bt_att_chan * chan,
+                             struct att_send_op * op, ssize_t len) {
+    struct bt_att * att = chan->att;
+    struct timeout_data * timeout;
+    struct att_latency * lat;
 
     util_debug(att->debug_callback, att->debug_data,
                "ATT op 0x%02x", op->opcode);
 
-    util_hexdump('<', op->pdu, ret, att->debug_callback, att->debug_data);
+    util_hexdump('<', op->pdu, len, att->debug_callback, att->debug_data);
+
+    att_trace_record(att->trace, false, op->pdu, len);
+
+    lat = att->latency[op->opcode & 0xff];
+    if (!lat)
+        lat = att->latency[op->opcode & 0xff] = new0(struct att_latency, 1);
 
-    /* Based on the operation type, set either the pending request or the
+    op->sent_us = att_time_us();
+    if (lat)
+        latency_hist_add(&lat->wait, att_us32(op->sent_us - op->queued_us));
+
+    /* Based on the operation type, it is either the pending request or the
      * pending indication. If it came from the write queue, then there is
      * no need to keep it around.
      */
     switch (op->type) {
     case ATT_OP_TYPE_REQ:
-        att->pending_req = op;
-        break;
     case ATT_OP_TYPE_IND:
-        att->pending_ind = op;
         break;
     case ATT_OP_TYPE_RSP :
         /* Set in_req to false to indicate that no request is pending */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-        att->in_req = false;
+        chan->in_req = false;
         __attribute__((fallthrough));
 #pragma GCC diagnostic pop
     /* Fall through to the next case */
@@ -522,40 +834,202 @@ static bool can_write_data(struct io * io, void * user_data) {
     case ATT_OP_TYPE_UNKNOWN:
     default:
         destroy_att_send_op(op);
-        return true;
+        return;
     }
 
     timeout = new0(struct timeout_data, 1);
     if (!timeout)
-        return true;
+        return;
 
-    timeout->att = att;
+    timeout->chan = chan;
     timeout->id = op->id;
     op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
                                  timeout, free);
+}
+
+/**
+ * @brief an op picked for sending stays unsent, it is no longer pending
+ *
+ * @param chan	bearer it was picked for
+ * @param op	unsent op
+ */
+static void att_send_op_unsent(struct bt_att_chan * chan,
+                               struct att_send_op * op) {
+    if (chan->pending_req == op)
+        chan->pending_req = NULL;
+
+    if (chan->pending_ind == op)
+        chan->pending_ind = NULL;
+}
+
+/**
+ * @brief send the gathered PDUs, one datagram each
+ *
+ * @param chan	bearer
+ * @param ops	ops to send
+ * @param count	number of ops
+ * @param len	filled with the bytes written per op
+ * @return number of ops sent or -errno if none was
+ */
+static int send_att_ops(struct bt_att_chan * chan, struct att_send_op ** ops,
+                        unsigned int count, ssize_t * len) {
+    struct mmsghdr msgs[ATT_WRITE_BATCH_MAX];
+    struct iovec iov[ATT_WRITE_BATCH_MAX];
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = ops[i]->pdu;
+        iov[i].iov_len = ops[i]->len;
+    }
+
+    chan->att->write_syscalls++;
+
+    if (count == 1) {
+        len[0] = io_send(chan->io, iov, 1);
+        return len[0] < 0 ? (int) len[0] : 1;
+    }
+
+    /* SOCK_SEQPACKET keeps each message a PDU */
+    memset(msgs, 0, count * sizeof(*msgs));
+    for (i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        ret = sendmmsg(chan->fd, msgs, count, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return -errno;
+
+    for (i = 0; i < (unsigned int) ret; i++)
+        len[i] = msgs[i].msg_len;
+
+    return ret;
+}
+
+/**
+ * @brief write handler of a bearer, gather every op ready to go on it, the
+ * write queue and the next request and indication if none is pending on
+ * the bearer, and send them in one syscall on an L2CAP bearer
+ *
+ * @param io		io of the bearer
+ * @param user_data	bearer
+ * @return false when there is nothing left to write
+ */
+static bool can_write_data(__attribute__((unused)) struct io * io,
+                           void * user_data) {
+    struct bt_att_chan * chan = user_data;
+    struct bt_att * att = chan->att;
+    struct att_send_op * ops[ATT_WRITE_BATCH_MAX];
+    ssize_t len[ATT_WRITE_BATCH_MAX];
+    unsigned int count = 0, max, i;
+    struct att_send_op * op;
+    int ret;
+
+    max = chan->io_on_l2cap ? ATT_WRITE_BATCH_MAX : 1;
+
+    /* Mark the request and indication pending as they are picked so that
+     * pick_next_send_op() does not return a second one.
+     */
+    while (count < max && (op = pick_next_send_op(chan))) {
+        if (op->type == ATT_OP_TYPE_REQ)
+            chan->pending_req = op;
+        else if (op->type == ATT_OP_TYPE_IND)
+            chan->pending_ind = op;
+
+        ops[count++] = op;
+    }
+
+    if (!count)
+        return false;
+
+    ret = send_att_ops(chan, ops, count, len);
+
+    bt_att_ref(att);
+
+    /* nonblocking socket full: the rest goes on the next EPOLLOUT */
+    for (i = count; i > (unsigned int) MAX(ret, 0); i--) {
+        op = ops[i - 1];
+
+        /* the first op failed with an error other than EAGAIN */
+        if (i == 1 && ret < 0 && ret != -EAGAIN && ret != -EWOULDBLOCK)
+            break;
+
+        att_send_op_unsent(chan, op);
+        requeue_att_send_op(att, op);
+    }
+
+    if (ret < 0) {
+        if (ret != -EAGAIN && ret != -EWOULDBLOCK) {
+            op = ops[0];
+            att_send_op_unsent(chan, op);
+
+            util_debug(att->debug_callback, att->debug_data,
+                       "write failed: %s", strerror(-ret));
+            if (op->callback)
+                op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+                             op->user_data);
+
+            destroy_att_send_op(op);
+        }
+
+        bt_att_unref(att);
+        return true;
+    }
+
+    att->write_batches++;
+    att->write_pdus += ret;
+    if ((unsigned int) ret > att->write_batch_max)
+        att->write_batch_max = ret;
+
+    /* requests and indications first, destroying the others runs user
+     * callbacks which may cancel them
+     */
+    for (i = 0; i < (unsigned int) ret; i++) {
+        if (ops[i]->type == ATT_OP_TYPE_REQ || ops[i]->type == ATT_OP_TYPE_IND)
+            att_send_op_sent(chan, ops[i], len[i]);
+    }
+
+    for (i = 0; i < (unsigned int) ret; i++) {
+        if (ops[i]->type != ATT_OP_TYPE_REQ && ops[i]->type != ATT_OP_TYPE_IND)
+            att_send_op_sent(chan, ops[i], len[i]);
+    }
+
+    bt_att_unref(att);
 
     /* Return true as there may be more operations ready to write. */
     return true;
 }
 
-static void wakeup_writer(struct bt_att * att) {
-    if (att->writer_active)
+static void wakeup_chan_writer(void * data, __attribute__((unused)) void * user_data) {
+    struct bt_att_chan * chan = data;
+    struct bt_att * att = chan->att;
+
+    if (chan->writer_active || !chan->io)
         return;
 
     /* Set the write handler only if there is anything that can be sent
-     * at all.
+     * on this bearer at all.
      */
-    if (queue_isempty(att->write_queue)) {
-        if ((att->pending_req || queue_isempty(att->req_queue)) &&
-                (att->pending_ind || queue_isempty(att->ind_queue)))
-            return;
-    }
+    if (!queue_find(att->write_queue, match_op_chan, chan) &&
+            (chan->pending_req ||
+             !queue_find(att->req_queue, match_op_chan, chan)) &&
+            (chan->pending_ind ||
+             !queue_find(att->ind_queue, match_op_chan, chan)))
+        return;
 
-    if (!io_set_write_handler(att->io, can_write_data, att,
+    if (!io_set_write_handler(chan->io, can_write_data, chan,
                               write_watch_destroy))
         return;
 
-    att->writer_active = true;
+    chan->writer_active = true;
+}
+
+static void wakeup_writer(struct bt_att * att) {
+    queue_foreach(att->chans, wakeup_chan_writer, NULL);
 }
 
 static void disconn_handler(void * data, void * user_data) {
@@ -569,29 +1043,95 @@ static void disconn_handler(void * data, void * user_data) {
         disconn->callback(err, disconn->user_data);
 }
 
+static void bt_att_chan_free(void * data) {
+    struct bt_att_chan * chan = data;
+
+    if (chan->pending_req)
+        destroy_att_send_op(chan->pending_req);
+
+    if (chan->pending_ind)
+        destroy_att_send_op(chan->pending_ind);
+
+    /* a socket left open goes back to the caller as it came */
+    if (chan->io && !chan->att->close_on_unref)
+        fcntl(chan->fd, F_SETFL, chan->fd_flags);
+
+    io_destroy(chan->io);
+
+    free(chan);
+}
+
+/**
+ * @brief an EATT bearer went away, the others carry on: its pending request
+ * fails, its queued responses and confirmations are dropped
+ *
+ * @param chan	EATT bearer
+ */
+static void att_chan_detach(struct bt_att_chan * chan) {
+    struct bt_att * att = chan->att;
+    struct att_send_op * op = chan->pending_req;
+
+    queue_remove(att->chans, chan);
+
+    bt_att_ref(att);
+
+    queue_remove_all(att->write_queue, match_op_pinned, chan,
+                     destroy_att_send_op);
+
+    chan->pending_req = NULL;
+    if (op) {
+        if (op->callback)
+            op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0, op->user_data);
+
+        destroy_att_send_op(op);
+    }
+
+    bt_att_chan_free(chan);
+
+    wakeup_writer(att);
+
+    bt_att_unref(att);
+}
+
 static bool disconnect_cb(__attribute__((unused)) struct io * io, void * user_data) {
-    struct bt_att * att = user_data;
+    struct bt_att_chan * chan = user_data;
+    struct bt_att * att = chan->att;
+    struct bt_att_chan * eatt;
     int err;
     socklen_t len;
 
     len = sizeof(err);
 
-    if (getsockopt(att->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+    if (getsockopt(chan->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
         util_debug(att->debug_callback, att->debug_data,
                    "Failed to obtain disconnect error: %s",
                    strerror(errno));
         err = 0;
     }
 
+    if (chan != att->fixed) {
+        util_debug(att->debug_callback, att->debug_data,
+                   "EATT bearer disconnected: %s", strerror(err));
+        att_chan_detach(chan);
+        return false;
+    }
+
     util_debug(att->debug_callback, att->debug_data,
                "Physical link disconnected: %s",
                strerror(err));
 
-    io_destroy(att->io);
-    att->io = NULL;
+    io_destroy(chan->io);
+    chan->io = NULL;
 
     bt_att_cancel_all(att);
 
+    /* the EATT bearers go down with the link */
+    while (queue_peek_tail(att->chans) != att->fixed) {
+        eatt = queue_peek_tail(att->chans);
+        queue_remove(att->chans, eatt);
+        bt_att_chan_free(eatt);
+    }
+
     bt_att_ref(att);
 
     queue_foreach(att->disconn_list, disconn_handler, INT_TO_PTR(err));
@@ -621,10 +1161,11 @@ static bool change_security(struct bt_att * att, uint8_t ecode) {
     return bt_att_set_security(att, security);
 }
 
-static bool handle_error_rsp(struct bt_att * att, uint8_t * pdu,
+static bool handle_error_rsp(struct bt_att_chan * chan, uint8_t * pdu,
                              ssize_t pdu_len, uint8_t * opcode) {
+    struct bt_att * att = chan->att;
     const struct bt_att_pdu_error_rsp * rsp;
-    struct att_send_op * op = att->pending_req;
+    struct att_send_op * op = chan->pending_req;
 
     if (pdu_len != sizeof(*rsp)) {
         *opcode = 0;
@@ -642,28 +1183,29 @@ static bool handle_error_rsp(struct bt_att * att, uint8_t * pdu,
     util_debug(att->debug_callback, att->debug_data,
                "Retrying operation %p", op);
 
-    att->pending_req = NULL;
+    chan->pending_req = NULL;
 
     /* Push operation back to request queue */
     return queue_push_head(att->req_queue, op);
 }
 
-static void handle_rsp(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
-                       ssize_t pdu_len) {
-    struct att_send_op * op = att->pending_req;
+static void handle_rsp(struct bt_att_chan * chan, uint8_t opcode,
+                       uint8_t * pdu, ssize_t pdu_len) {
+    struct bt_att * att = chan->att;
+    struct att_send_op * op = chan->pending_req;
     uint8_t req_opcode;
     uint8_t rsp_opcode;
     uint8_t * rsp_pdu = NULL;
     uint16_t rsp_pdu_len = 0;
 
     /*
-     * If no request is pending, then the response is unexpected. Disconnect
-     * the bearer.
+     * If no request is pending on the bearer, then the response is
+     * unexpected. Disconnect the bearer.
      */
     if (!op) {
         util_debug(att->debug_callback, att->debug_data,
                    "Received unexpected ATT response");
-        io_shutdown(att->io);
+        io_shutdown(chan->io);
         return;
     }
 
@@ -673,7 +1215,7 @@ static void handle_rsp(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
      */
     if (opcode == BT_ATT_OP_ERROR_RSP) {
         /* Return if error response cause a retry */
-        if (handle_error_rsp(att, pdu, pdu_len, &req_opcode)) {
+        if (handle_error_rsp(chan, pdu, pdu_len, &req_opcode)) {
             wakeup_writer(att);
             return;
         }
@@ -683,6 +1225,8 @@ static void handle_rsp(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
     if (req_opcode != op->opcode)
         goto fail;
 
+    att_latency_rtt(att, op);
+
     rsp_opcode = opcode;
 
     if (pdu_len > 0) {
@@ -703,13 +1247,14 @@ done:
         op->callback(rsp_opcode, rsp_pdu, rsp_pdu_len, op->user_data);
 
     destroy_att_send_op(op);
-    att->pending_req = NULL;
+    chan->pending_req = NULL;
 
     wakeup_writer(att);
 }
 
-static void handle_conf(struct bt_att * att, __attribute__((unused)) uint8_t * pdu, ssize_t pdu_len) {
-    struct att_send_op * op = att->pending_ind;
+static void handle_conf(struct bt_att_chan * chan, __attribute__((unused)) uint8_t * pdu, ssize_t pdu_len) {
+    struct bt_att * att = chan->att;
+    struct att_send_op * op = chan->pending_ind;
 
     /*
      * Disconnect the bearer if the confirmation is unexpected or the PDU is
@@ -718,15 +1263,17 @@ static void handle_conf(struct bt_att * att, __attribute__((unused)) uint8_t * p
     if (!op || pdu_len) {
         util_debug(att->debug_callback, att->debug_data,
                    "Received unexpected/invalid ATT confirmation");
-        io_shutdown(att->io);
+        io_shutdown(chan->io);
         return;
     }
 
+    att_latency_rtt(att, op);
+
     if (op->callback)
         op->callback(BT_ATT_OP_HANDLE_VAL_CONF, NULL, 0, op->user_data);
 
     destroy_att_send_op(op);
-    att->pending_ind = NULL;
+    chan->pending_ind = NULL;
 
     wakeup_writer(att);
 }
@@ -738,16 +1285,6 @@ struct notify_data {
     bool handler_found;
 };
 
-static bool opcode_match(uint8_t opcode, uint8_t test_opcode) {
-    enum att_op_type op_type = get_op_type(test_opcode);
-
-    if (opcode == BT_ATT_ALL_REQUESTS && (op_type == ATT_OP_TYPE_REQ ||
-                                          op_type == ATT_OP_TYPE_CMD))
-        return true;
-
-    return opcode == test_opcode;
-}
-
 static void respond_not_supported(struct bt_att * att, uint8_t opcode) {
     struct bt_att_pdu_error_rsp pdu;
 
@@ -781,9 +1318,9 @@ static bool handle_signed(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
         goto fail;
 
     /* Generate signature and verify it */
-    if (!bt_crypto_sign_att(att->crypto, sign->key, pdu,
-                            pdu_len - BT_ATT_SIGNATURE_LEN, sign_cnt,
-                            signature))
+    if (!bt_crypto_sign_att_key(att->crypto, &sign->cmac, pdu,
+                                pdu_len - BT_ATT_SIGNATURE_LEN, sign_cnt,
+                                signature))
         goto fail;
 
     return true;
@@ -795,41 +1332,60 @@ fail:
     return false;
 }
 
-static void handle_notify(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
-                          ssize_t pdu_len) {
+/**
+ * @brief call every callback of a notify chain
+ *
+ * @return true if the chain had a callback
+ */
+static bool notify_chain(struct queue * chain, uint8_t opcode, uint8_t * pdu,
+                         ssize_t pdu_len) {
     const struct queue_entry * entry;
-    bool found;
-
-    if ((opcode & ATT_OP_SIGNED_MASK) && !att->ext_signed) {
-        if (!handle_signed(att, opcode, pdu, pdu_len))
-            return;
-        pdu_len -= BT_ATT_SIGNATURE_LEN;
-    }
-
-    bt_att_ref(att);
+    bool found = false;
 
-    found = false;
-    entry = queue_get_entries(att->notify_list);
+    entry = queue_get_entries(chain);
 
     while (entry) {
         struct att_notify * notify = entry->data;
 
         entry = entry->next;
 
-        if (!opcode_match(notify->opcode, opcode))
-            continue;
-
         found = true;
 
         if (notify->callback)
             notify->callback(opcode, pdu, pdu_len,
                              notify->user_data);
 
-        /* callback could remove all entries from notify list */
-        if (queue_isempty(att->notify_list))
+        /* callback could remove all entries from the chain, chains are
+         * only freed with the bt_att
+         */
+        if (queue_isempty(chain))
             break;
     }
 
+    return found;
+}
+
+static void handle_notify(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
+                          ssize_t pdu_len) {
+    enum att_op_type op_type = get_op_type(opcode);
+    bool found;
+
+    if ((opcode & ATT_OP_SIGNED_MASK) && !att->ext_signed) {
+        if (!handle_signed(att, opcode, pdu, pdu_len))
+            return;
+        pdu_len -= BT_ATT_SIGNATURE_LEN;
+    }
+
+    bt_att_ref(att);
+
+    /* handlers of the opcode, then the ones for all requests */
+    found = notify_chain(att->notify_table[opcode], opcode, pdu, pdu_len);
+
+    if (opcode != BT_ATT_ALL_REQUESTS &&
+            (op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_CMD))
+        found |= notify_chain(att->notify_table[BT_ATT_ALL_REQUESTS],
+                              opcode, pdu, pdu_len);
+
     /*
      * If this was a request and no handler was registered for it, respond
      * with "Not Supported"
@@ -837,41 +1393,153 @@ static void handle_notify(struct bt_att * att, uint8_t opcode, uint8_t * pdu,
     if (!found && get_op_type(opcode) == ATT_OP_TYPE_REQ)
         respond_not_supported(att, opcode);
 
-    bt_att_unref(att);
+    bt_att_unref(att);
+}
+
+struct bt_att_buf {
+    int ref_count;
+    uint16_t size;
+    uint16_t len;
+    struct timespec time;
+    uint8_t data[];
+};
+
+static struct bt_att_buf * att_buf_new(uint16_t size) {
+    struct bt_att_buf * buf;
+
+    buf = malloc(sizeof(*buf) + size);
+    if (!buf)
+        return NULL;
+
+    buf->ref_count = 1;
+    buf->size = size;
+    buf->len = 0;
+
+    return buf;
+}
+
+/**
+ * @brief pin a receive buffer beyond the callback it was given to
+ *
+ * @param buf	buffer from bt_att_get_rx_buf
+ * @return buf
+ */
+struct bt_att_buf * bt_att_buf_ref(struct bt_att_buf * buf) {
+    if (!buf)
+        return NULL;
+
+    __sync_fetch_and_add(&buf->ref_count, 1);
+
+    return buf;
+}
+
+void bt_att_buf_unref(struct bt_att_buf * buf) {
+    if (!buf)
+        return;
+
+    if (__sync_sub_and_fetch(&buf->ref_count, 1))
+        return;
+
+    free(buf);
+}
+
+const uint8_t * bt_att_buf_data(const struct bt_att_buf * buf) {
+    return buf ? buf->data : NULL;
+}
+
+uint16_t bt_att_buf_len(const struct bt_att_buf * buf) {
+    return buf ? buf->len : 0;
+}
+
+const struct timespec * bt_att_buf_time(const struct bt_att_buf * buf) {
+    return buf ? &buf->time : NULL;
+}
+
+/**
+ * @brief receive buffer of the PDU being dispatched, borrowed: valid until
+ * the callback returns unless pinned with bt_att_buf_ref
+ *
+ * @param att	att structure
+ * @return buffer or NULL outside of a PDU callback
+ */
+struct bt_att_buf * bt_att_get_rx_buf(struct bt_att * att) {
+    return att ? att->rx_buf : NULL;
+}
+
+/**
+ * @brief pick the buffer of the next read, the first ring slot no consumer
+ * pins, grown to size if needed. When every slot is pinned the oldest
+ * one is handed over to its consumers and replaced.
+ *
+ * @param att	att structure
+ * @param size	largest PDU of the bearer read
+ * @return buffer, owned by the ring, or NULL
+ */
+static struct bt_att_buf * att_rx_buf_get(struct bt_att * att, uint16_t size) {
+    struct bt_att_buf * buf;
+    unsigned int n, i = att->rx_next;
+
+    for (n = 0; n < ATT_RX_RING_SIZE; n++) {
+        i = (att->rx_next + n) % ATT_RX_RING_SIZE;
+        buf = att->rx_ring[i];
+        if (!buf || buf->ref_count == 1)
+            break;
+    }
+
+    if (n == ATT_RX_RING_SIZE)
+        i = att->rx_next;
+
+    buf = att->rx_ring[i];
+    if (!buf || buf->ref_count != 1 || buf->size < size) {
+        buf = att_buf_new(size);
+        if (!buf)
+            return NULL;
+
+        bt_att_buf_unref(att->rx_ring[i]);
+        att->rx_ring[i] = buf;
+    }
+
+    att->rx_next = (i + 1) % ATT_RX_RING_SIZE;
+
+    return buf;
 }
 
-static bool can_read_data(__attribute__((unused)) struct io * io, void * user_data) {
-    struct bt_att * att = user_data;
+/**
+ * @brief act on one PDU read in a receive buffer
+ *
+ * @param chan		bearer it was read on, the caller holds an att reference
+ * @param buf		receive buffer from att_rx_buf_get
+ * @return false if the bearer was shut down
+ */
+static bool handle_pdu(struct bt_att_chan * chan, struct bt_att_buf * buf) {
+    struct bt_att * att = chan->att;
+    ssize_t bytes_read = buf->len;
     uint8_t opcode;
     uint8_t * pdu;
-    ssize_t bytes_read;
 
-    bytes_read = read(att->fd, att->buf, att->mtu);
-    if (bytes_read < 0)
-        return false;
-
-    util_hexdump('>', att->buf, bytes_read,
+    util_hexdump('>', buf->data, bytes_read,
                  att->debug_callback, att->debug_data);
 
     if (bytes_read < ATT_MIN_PDU_LEN)
         return true;
 
-    pdu = att->buf;
+    pdu = buf->data;
     opcode = pdu[0];
 
-    bt_att_ref(att);
+    att->rx_buf = buf;
+    att->rx_chan = chan;
 
     /* Act on the received PDU based on the opcode type */
     switch (get_op_type(opcode)) {
     case ATT_OP_TYPE_RSP:
         util_debug(att->debug_callback, att->debug_data,
                    "ATT response received: 0x%02x", opcode);
-        handle_rsp(att, opcode, pdu + 1, bytes_read - 1);
+        handle_rsp(chan, opcode, pdu + 1, bytes_read - 1);
         break;
     case ATT_OP_TYPE_CONF:
         util_debug(att->debug_callback, att->debug_data,
                    "ATT confirmation received: 0x%02x", opcode);
-        handle_conf(att, pdu + 1, bytes_read - 1);
+        handle_conf(chan, pdu + 1, bytes_read - 1);
         break;
     case ATT_OP_TYPE_REQ:
         /*
@@ -879,18 +1547,19 @@ static bool can_read_data(__attribute__((unused)) struct io * io, void * user_da
          * protocol was violated. Disconnect the bearer, which will
          * promptly notify the upper layer via disconnect handlers.
          */
-        if (att->in_req) {
+        if (chan->in_req) {
             util_debug(att->debug_callback, att->debug_data,
                        "Received request while another is "
                        "pending: 0x%02x", opcode);
-            io_shutdown(att->io);
-            bt_att_unref(att);
+            io_shutdown(chan->io);
+            att->rx_buf = NULL;
+            att->rx_chan = NULL;
 
             return false;
         }
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-        att->in_req = true;
+        chan->in_req = true;
         __attribute__((fallthrough));
 #pragma GCC diagnostic pop
     /* Fall through to the next case */
@@ -908,11 +1577,83 @@ static bool can_read_data(__attribute__((unused)) struct io * io, void * user_da
         break;
     }
 
-    bt_att_unref(att);
+    att->rx_buf = NULL;
+    att->rx_chan = NULL;
 
     return true;
 }
 
+/**
+ * @brief read handler, with a read budget above 1 the nonblocking socket
+ * is drained up to the budget before going back to epoll, the batch
+ * handlers run once at the end
+ *
+ * @param io		io structure (not used)
+ * @param user_data	bearer
+ * @return false to remove the handler
+ */
+static bool can_read_data(__attribute__((unused)) struct io * io, void * user_data) {
+    struct bt_att_chan * chan = user_data;
+    struct bt_att * att = chan->att;
+    struct bt_att_buf * buf;
+    unsigned int count = 0;
+    ssize_t bytes_read;
+    bool ret = true;
+
+    bt_att_ref(att);
+
+    att->read_wakeups++;
+
+    do {
+        /* a buffer per PDU, consumers may pin the previous ones */
+        buf = att_rx_buf_get(att, MAX(att->mtu, chan->mtu));
+        if (!buf) {
+            ret = false;
+            break;
+        }
+
+        bytes_read = read(chan->fd, buf->data, buf->size);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+
+            /* drained, or a spurious wakeup */
+            ret = errno == EAGAIN || errno == EWOULDBLOCK;
+            if (!ret || count)
+                break;
+
+            goto done;
+        }
+
+        count++;
+
+        buf->len = bytes_read;
+        clock_gettime(CLOCK_REALTIME, &buf->time);
+
+        if (bytes_read)
+            att_trace_record(att->trace, true, buf->data, bytes_read);
+
+        if (!handle_pdu(chan, buf)) {
+            ret = false;
+            break;
+        }
+
+        /* a zero length read is a hang up, let disconnect_cb see it */
+        if (!bytes_read)
+            break;
+    } while (count < att->read_budget && chan->io);
+
+    att->read_pdus += count;
+
+    if (count && !queue_isempty(att->batch_list))
+        queue_foreach(att->batch_list, batch_handler, UINT_TO_PTR(count));
+
+done:
+    bt_att_unref(att);
+
+    return ret;
+}
+
 static bool is_io_l2cap_based(int fd) {
     int domain;
     int proto;
@@ -937,21 +1678,105 @@ static bool is_io_l2cap_based(int fd) {
     return proto == BTPROTO_L2CAP;
 }
 
-static void bt_att_free(struct bt_att * att) {
-    if (att->pending_req)
-        destroy_att_send_op(att->pending_req);
+/**
+ * @brief L2CAP MTU of an EATT bearer, the smaller of both directions
+ *
+ * @param fd	socket
+ * @param mtu	returned when the socket does not tell
+ * @return mtu
+ */
+static uint16_t get_l2cap_mtu(int fd, uint16_t mtu) {
+    uint16_t snd = 0, rcv = 0;
+    socklen_t len;
+
+    len = sizeof(snd);
+    if (getsockopt(fd, SOL_BLUETOOTH, BT_SNDMTU, &snd, &len) < 0 || !snd)
+        return mtu;
+
+    len = sizeof(rcv);
+    if (getsockopt(fd, SOL_BLUETOOTH, BT_RCVMTU, &rcv, &len) < 0 || !rcv)
+        return mtu;
+
+    return snd < rcv ? snd : rcv;
+}
+
+/**
+ * @brief nonblocking socket above a read budget of 1, the flags the caller
+ * set on the socket for 1
+ *
+ * @param chan		bearer
+ * @param budget	PDUs per wakeup
+ * @return true on success
+ */
+static bool chan_set_read_budget(struct bt_att_chan * chan,
+                                 unsigned int budget) {
+    int flags = chan->fd_flags;
+
+    if (budget > 1)
+        flags |= O_NONBLOCK;
+
+    return fcntl(chan->fd, F_SETFL, flags) >= 0;
+}
+
+static struct bt_att_chan * bt_att_chan_new(struct bt_att * att, int fd,
+        uint8_t type) {
+    struct bt_att_chan * chan;
+
+    chan = new0(struct bt_att_chan, 1);
+    if (!chan)
+        return NULL;
+
+    chan->att = att;
+    chan->type = type;
+    chan->fd = fd;
+
+    chan->fd_flags = fcntl(fd, F_GETFL);
+    if (chan->fd_flags < 0)
+        goto fail;
+
+    chan->io = io_new(fd);
+    if (!chan->io)
+        goto fail;
+
+    if (!io_set_read_handler(chan->io, can_read_data, chan, NULL))
+        goto fail;
+
+    if (!io_set_disconnect_handler(chan->io, disconnect_cb, chan, NULL))
+        goto fail;
+
+    chan->io_on_l2cap = is_io_l2cap_based(fd);
+    if (!chan->io_on_l2cap)
+        chan->io_sec_level = BT_SECURITY_LOW;
+
+    if (type == BT_ATT_EATT)
+        chan->mtu = get_l2cap_mtu(fd, att->mtu);
+    else
+        chan->mtu = att->mtu;
+
+    return chan;
+
+fail:
+    bt_att_chan_free(chan);
+
+    return NULL;
+}
 
-    if (att->pending_ind)
-        destroy_att_send_op(att->pending_ind);
+static void bt_att_free(struct bt_att * att) {
+    unsigned int i;
 
-    io_destroy(att->io);
+    queue_destroy(att->chans, bt_att_chan_free);
     bt_crypto_unref(att->crypto);
 
     queue_destroy(att->req_queue, NULL);
     queue_destroy(att->ind_queue, NULL);
     queue_destroy(att->write_queue, NULL);
     queue_destroy(att->notify_list, NULL);
+    for (i = 0; i < ATT_OPCODE_COUNT; i++) {
+        queue_destroy(att->notify_table[i], NULL);
+        free(att->latency[i]);
+    }
     queue_destroy(att->disconn_list, NULL);
+    queue_destroy(att->batch_list, NULL);
 
     if (att->timeout_destroy)
         att->timeout_destroy(att->timeout_data);
@@ -962,7 +1787,10 @@ static void bt_att_free(struct bt_att * att) {
     free(att->local_sign);
     free(att->remote_sign);
 
-    free(att->buf);
+    flush_att_send_op_pool(att);
+
+    for (i = 0; i < ATT_RX_RING_SIZE; i++)
+        bt_att_buf_unref(att->rx_ring[i]);
 
     free(att);
 }
@@ -977,15 +1805,11 @@ struct bt_att * bt_att_new(int fd, bool ext_signed) {
     if (!att)
         return NULL;
 
-    att->fd = fd;
     att->ext_signed = ext_signed;
     att->mtu = BT_ATT_DEFAULT_LE_MTU;
-    att->buf = malloc(att->mtu);
-    if (!att->buf)
-        goto fail;
 
-    att->io = io_new(fd);
-    if (!att->io)
+    att->chans = queue_new();
+    if (!att->chans)
         goto fail;
 
     /* crypto is optional, if not available leave it NULL */
@@ -1012,15 +1836,20 @@ struct bt_att * bt_att_new(int fd, bool ext_signed) {
     if (!att->disconn_list)
         goto fail;
 
-    if (!io_set_read_handler(att->io, can_read_data, att, NULL))
+    att->batch_list = queue_new();
+    if (!att->batch_list)
         goto fail;
 
-    if (!io_set_disconnect_handler(att->io, disconnect_cb, att, NULL))
+    att->read_budget = 1;
+
+    att->fixed = bt_att_chan_new(att, fd, BT_ATT_LE);
+    if (!att->fixed)
         goto fail;
 
-    att->io_on_l2cap = is_io_l2cap_based(att->fd);
-    if (!att->io_on_l2cap)
-        att->io_sec_level = BT_SECURITY_LOW;
+    if (!queue_push_tail(att->chans, att->fixed)) {
+        bt_att_chan_free(att->fixed);
+        goto fail;
+    }
 
     return bt_att_ref(att);
 
@@ -1052,18 +1881,80 @@ void bt_att_unref(struct bt_att * att) {
     bt_att_free(att);
 }
 
+static void chan_set_close_on_destroy(void * data, void * user_data) {
+    struct bt_att_chan * chan = data;
+
+    io_set_close_on_destroy(chan->io, PTR_TO_INT(user_data));
+}
+
 bool bt_att_set_close_on_unref(struct bt_att * att, bool do_close) {
-    if (!att || !att->io)
+    if (!att || !att->fixed->io)
         return false;
 
-    return io_set_close_on_destroy(att->io, do_close);
+    att->close_on_unref = do_close;
+
+    queue_foreach(att->chans, chan_set_close_on_destroy, INT_TO_PTR(do_close));
+
+    return true;
 }
 
 int bt_att_get_fd(struct bt_att * att) {
     if (!att)
         return -1;
 
-    return att->fd;
+    return att->fixed->fd;
+}
+
+/**
+ * @brief add an EATT bearer, requests are spread over the bearers from now
+ * on, the bearer goes away with the fixed channel or on its own disconnect
+ *
+ * @param att	att structure with a connected fixed channel
+ * @param fd	connected L2CAP enhanced credit based socket, owned by att
+ *				on success if close on unref is set
+ * @return 0 or -errno
+ */
+int bt_att_attach_fd(struct bt_att * att, int fd) {
+    struct bt_att_chan * chan;
+
+    if (!att || fd < 0)
+        return -EINVAL;
+
+    if (!att->fixed->io)
+        return -ENOTCONN;
+
+    chan = bt_att_chan_new(att, fd, BT_ATT_EATT);
+    if (!chan)
+        return -ENOMEM;
+
+    if (!chan_set_read_budget(chan, att->read_budget) ||
+            !queue_push_tail(att->chans, chan)) {
+        bt_att_chan_free(chan);
+        return -EIO;
+    }
+
+    io_set_close_on_destroy(chan->io, att->close_on_unref);
+
+    util_debug(att->debug_callback, att->debug_data,
+               "EATT bearer %d attached, mtu %u", fd, chan->mtu);
+
+    /* queued requests may go out on it right away */
+    wakeup_writer(att);
+
+    return 0;
+}
+
+/**
+ * @brief number of connected bearers
+ *
+ * @param att	att structure
+ * @return 1 with the fixed channel only, 0 once disconnected
+ */
+int bt_att_get_channels(struct bt_att * att) {
+    if (!att || !att->fixed->io)
+        return 0;
+
+    return queue_length(att->chans);
 }
 
 bool bt_att_set_debug(struct bt_att * att, bt_att_debug_func_t callback,
@@ -1089,22 +1980,32 @@ uint16_t bt_att_get_mtu(struct bt_att * att) {
 }
 
 bool bt_att_set_mtu(struct bt_att * att, uint16_t mtu) {
-    void * buf;
-
     if (!att)
         return false;
 
     if (mtu < BT_ATT_DEFAULT_LE_MTU)
         return false;
 
-    buf = malloc(mtu);
-    if (!buf)
-        return false;
+    /* receive buffers grow on their next use, the one being dispatched
+     * stays valid
+     */
+    att->mtu = mtu;
+    att->fixed->mtu = mtu;
 
-    free(att->buf);
+    /* pooled slots only hold a PDU of the previous mtu */
+    flush_att_send_op_pool(att);
 
-    att->mtu = mtu;
-    att->buf = buf;
+    return true;
+}
+
+bool bt_att_get_pool_stats(struct bt_att * att,
+                           struct bt_att_pool_stats * stats) {
+    if (!att || !stats)
+        return false;
+
+    stats->hits = att->op_pool_hits;
+    stats->misses = att->op_pool_misses;
+    stats->free = att->op_pool_count;
 
     return true;
 }
@@ -1131,7 +2032,7 @@ unsigned int bt_att_register_disconnect(struct bt_att * att,
                                         bt_att_destroy_func_t destroy) {
     struct att_disconn * disconn;
 
-    if (!att || !att->io)
+    if (!att || !att->fixed->io)
         return 0;
 
     disconn = new0(struct att_disconn, 1);
@@ -1192,7 +2093,7 @@ unsigned int bt_att_send(struct bt_att * att, uint8_t opcode,
     struct att_send_op * op;
     bool result;
 
-    if (!att || !att->io)
+    if (!att || !att->fixed->io)
         return 0;
 
     op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
@@ -1204,6 +2105,7 @@ unsigned int bt_att_send(struct bt_att * att, uint8_t opcode,
         att->next_send_id = 1;
 
     op->id = att->next_send_id++;
+    op->chan = att_send_op_chan(att, op);
 
     /* Add the op to the correct queue based on its type */
     switch (op->type) {
@@ -1224,8 +2126,7 @@ unsigned int bt_att_send(struct bt_att * att, uint8_t opcode,
     }
 
     if (!result) {
-        free(op->pdu);
-        free(op);
+        release_att_send_op(op);
         return 0;
     }
 
@@ -1242,21 +2143,26 @@ static bool match_op_id(const void * a, const void * b) {
 }
 
 bool bt_att_cancel(struct bt_att * att, unsigned int id) {
+    const struct queue_entry * entry;
     struct att_send_op * op;
 
     if (!att || !id)
         return false;
 
-    if (att->pending_req && att->pending_req->id == id) {
-        /* Don't cancel the pending request; remove it's handlers */
-        cancel_att_send_op(att->pending_req);
-        return true;
-    }
+    for (entry = queue_get_entries(att->chans); entry; entry = entry->next) {
+        struct bt_att_chan * chan = entry->data;
 
-    if (att->pending_ind && att->pending_ind->id == id) {
-        /* Don't cancel the pending indication; remove it's handlers */
-        cancel_att_send_op(att->pending_ind);
-        return true;
+        if (chan->pending_req && chan->pending_req->id == id) {
+            /* Don't cancel the pending request; remove it's handlers */
+            cancel_att_send_op(chan->pending_req);
+            return true;
+        }
+
+        if (chan->pending_ind && chan->pending_ind->id == id) {
+            /* Don't cancel the pending indication; remove it's handlers */
+            cancel_att_send_op(chan->pending_ind);
+            return true;
+        }
     }
 
     op = queue_remove_if(att->req_queue, match_op_id, UINT_TO_PTR(id));
@@ -1282,6 +2188,19 @@ done:
     return true;
 }
 
+static void chan_cancel_pending(void * data,
+                                __attribute__((unused)) void * user_data) {
+    struct bt_att_chan * chan = data;
+
+    if (chan->pending_req)
+        /* Don't cancel the pending request; remove it's handlers */
+        cancel_att_send_op(chan->pending_req);
+
+    if (chan->pending_ind)
+        /* Don't cancel the pending request; remove it's handlers */
+        cancel_att_send_op(chan->pending_ind);
+}
+
 bool bt_att_cancel_all(struct bt_att * att) {
     if (!att)
         return false;
@@ -1290,13 +2209,7 @@ bool bt_att_cancel_all(struct bt_att * att) {
     queue_remove_all(att->ind_queue, NULL, NULL, destroy_att_send_op);
     queue_remove_all(att->write_queue, NULL, NULL, destroy_att_send_op);
 
-    if (att->pending_req)
-        /* Don't cancel the pending request; remove it's handlers */
-        cancel_att_send_op(att->pending_req);
-
-    if (att->pending_ind)
-        /* Don't cancel the pending request; remove it's handlers */
-        cancel_att_send_op(att->pending_ind);
+    queue_foreach(att->chans, chan_cancel_pending, NULL);
 
     return true;
 }
@@ -1354,7 +2267,7 @@ unsigned int bt_att_register(struct bt_att * att, uint8_t opcode,
                              bt_att_destroy_func_t destroy) {
     struct att_notify * notify;
 
-    if (!att || !callback || !att->io)
+    if (!att || !callback || !att->fixed->io)
         return 0;
 
     notify = new0(struct att_notify, 1);
@@ -1371,11 +2284,25 @@ unsigned int bt_att_register(struct bt_att * att, uint8_t opcode,
 
     notify->id = att->next_reg_id++;
 
+    if (!att->notify_table[opcode]) {
+        att->notify_table[opcode] = queue_new();
+        if (!att->notify_table[opcode]) {
+            free(notify);
+            return 0;
+        }
+    }
+
     if (!queue_push_tail(att->notify_list, notify)) {
         free(notify);
         return 0;
     }
 
+    if (!queue_push_tail(att->notify_table[opcode], notify)) {
+        queue_remove(att->notify_list, notify);
+        free(notify);
+        return 0;
+    }
+
     return notify->id;
 }
 
@@ -1390,20 +2317,219 @@ bool bt_att_unregister(struct bt_att * att, unsigned int id) {
     if (!notify)
         return false;
 
+    queue_remove(att->notify_table[notify->opcode], notify);
+
     destroy_att_notify(notify);
     return true;
 }
 
 bool bt_att_unregister_all(struct bt_att * att) {
+    unsigned int i;
+
     if (!att)
         return false;
 
+    for (i = 0; i < ATT_OPCODE_COUNT; i++)
+        queue_remove_all(att->notify_table[i], NULL, NULL, NULL);
     queue_remove_all(att->notify_list, NULL, NULL, destroy_att_notify);
     queue_remove_all(att->disconn_list, NULL, NULL, destroy_att_disconn);
+    queue_remove_all(att->batch_list, NULL, NULL, destroy_att_batch);
+
+    return true;
+}
+
+/**
+ * @brief drain up to budget PDUs per read wakeup, the sockets of the
+ * bearers are made nonblocking when budget is above 1 and get back the
+ * flags they were attached with for 1
+ *
+ * @param att		att structure
+ * @param budget	PDUs per wakeup, at least 1
+ * @return true on success
+ */
+bool bt_att_set_read_budget(struct bt_att * att, unsigned int budget) {
+    const struct queue_entry * entry;
+
+    if (!att || !budget)
+        return false;
+
+    for (entry = queue_get_entries(att->chans); entry; entry = entry->next) {
+        if (!chan_set_read_budget(entry->data, budget))
+            return false;
+    }
+
+    att->read_budget = budget;
+
+    return true;
+}
+
+bool bt_att_get_write_stats(struct bt_att * att,
+                            struct bt_att_write_stats * stats) {
+    if (!att || !stats)
+        return false;
+
+    stats->batches = att->write_batches;
+    stats->pdus = att->write_pdus;
+    stats->syscalls = att->write_syscalls;
+    stats->max_batch = att->write_batch_max;
+
+    return true;
+}
+
+bool bt_att_get_read_stats(struct bt_att * att,
+                           struct bt_att_read_stats * stats) {
+    if (!att || !stats)
+        return false;
+
+    stats->wakeups = att->read_wakeups;
+    stats->pdus = att->read_pdus;
+
+    return true;
+}
+
+static void latency_summary(const struct latency_hist * hist,
+                            struct bt_att_latency * summary) {
+    if (!summary)
+        return;
+
+    summary->count = hist->count;
+    summary->min = hist->min;
+    summary->mean = hist->count ? (uint32_t)(hist->sum / hist->count) : 0;
+    summary->p50 = latency_hist_percentile(hist, 500);
+    summary->p90 = latency_hist_percentile(hist, 900);
+    summary->p99 = latency_hist_percentile(hist, 990);
+    summary->max = hist->max;
+}
+
+/**
+ * @brief latency of one opcode since the bt_att was created or reset
+ *
+ * @param att		att structure
+ * @param opcode	request, command, notification or indication opcode
+ * @param rtt		filled with the round trip, empty for PDUs not answered,
+ *					may be NULL
+ * @param wait		filled with the queue wait, may be NULL
+ * @return false if no PDU of opcode was sent
+ */
+bool bt_att_get_latency(struct bt_att * att, uint8_t opcode,
+                        struct bt_att_latency * rtt,
+                        struct bt_att_latency * wait) {
+    if (!att || !att->latency[opcode])
+        return false;
+
+    latency_summary(&att->latency[opcode]->rtt, rtt);
+    latency_summary(&att->latency[opcode]->wait, wait);
+
+    return true;
+}
+
+/**
+ * @brief call func for every opcode sent so far, in opcode order
+ *
+ * @param att		att structure
+ * @param func		called with the round trip and queue wait summaries
+ * @param user_data	passed to func
+ */
+void bt_att_foreach_latency(struct bt_att * att, bt_att_latency_func_t func,
+                            void * user_data) {
+    struct bt_att_latency rtt, wait;
+    unsigned int i;
+
+    if (!att || !func)
+        return;
+
+    for (i = 0; i < ATT_OPCODE_COUNT; i++) {
+        if (!bt_att_get_latency(att, i, &rtt, &wait))
+            continue;
+
+        func(i, &rtt, &wait, user_data);
+    }
+}
+
+void bt_att_reset_latency(struct bt_att * att) {
+    unsigned int i;
+
+    if (!att)
+        return;
+
+    for (i = 0; i < ATT_OPCODE_COUNT; i++) {
+        free(att->latency[i]);
+        att->latency[i] = NULL;
+    }
+}
+
+/**
+ * @brief record every PDU read and written into a trace ring, the ring
+ * outlives the bt_att and may be shared by the successive connections
+ *
+ * @param att	att structure
+ * @param trace	ring or NULL to stop tracing
+ * @return true on success
+ */
+bool bt_att_set_trace(struct bt_att * att, struct att_trace * trace) {
+    if (!att)
+        return false;
+
+    att->trace = trace;
 
     return true;
 }
 
+/**
+ * @brief register a handler called once after each batch of PDUs read
+ * in one wakeup, when all of them have been dispatched
+ *
+ * @param att		att structure
+ * @param callback	called with the number of PDUs of the batch
+ * @param user_data	user pointer
+ * @param destroy	user_data destructor
+ * @return id or 0 on failure
+ */
+unsigned int bt_att_register_batch(struct bt_att * att,
+                                   bt_att_batch_func_t callback,
+                                   void * user_data,
+                                   bt_att_destroy_func_t destroy) {
+    struct att_batch * batch;
+
+    if (!att || !callback || !att->fixed->io)
+        return 0;
+
+    batch = new0(struct att_batch, 1);
+    if (!batch)
+        return 0;
+
+    batch->callback = callback;
+    batch->destroy = destroy;
+    batch->user_data = user_data;
+
+    if (att->next_reg_id < 1)
+        att->next_reg_id = 1;
+
+    batch->id = att->next_reg_id++;
+
+    if (!queue_push_tail(att->batch_list, batch)) {
+        free(batch);
+        return 0;
+    }
+
+    return batch->id;
+}
+
+bool bt_att_unregister_batch(struct bt_att * att, unsigned int id) {
+    struct att_batch * batch;
+
+    if (!att || !id)
+        return false;
+
+    batch = queue_remove_if(att->batch_list, match_batch_id,
+                            UINT_TO_PTR(id));
+    if (!batch)
+        return false;
+
+    destroy_att_batch(batch);
+    return true;
+}
+
 int bt_att_get_security(struct bt_att * att) {
     struct bt_security sec;
     socklen_t len;
@@ -1411,12 +2537,13 @@ int bt_att_get_security(struct bt_att * att) {
     if (!att)
         return -EINVAL;
 
-    if (!att->io_on_l2cap)
-        return att->io_sec_level;
+    /* the security of the link, the EATT bearers share it */
+    if (!att->fixed->io_on_l2cap)
+        return att->fixed->io_sec_level;
 
     memset(&sec, 0, sizeof(sec));
     len = sizeof(sec);
-    if (getsockopt(att->fd, SOL_BLUETOOTH, BT_SECURITY, &sec, &len) < 0)
+    if (getsockopt(att->fixed->fd, SOL_BLUETOOTH, BT_SECURITY, &sec, &len) < 0)
         return -EIO;
 
     return sec.level;
@@ -1429,15 +2556,15 @@ bool bt_att_set_security(struct bt_att * att, int level) {
             level > BT_ATT_SECURITY_HIGH)
         return false;
 
-    if (!att->io_on_l2cap) {
-        att->io_sec_level = level;
+    if (!att->fixed->io_on_l2cap) {
+        att->fixed->io_sec_level = level;
         return true;
     }
 
     memset(&sec, 0, sizeof(sec));
     sec.level = level;
 
-    if (setsockopt(att->fd, SOL_BLUETOOTH, BT_SECURITY, &sec,
+    if (setsockopt(att->fixed->fd, SOL_BLUETOOTH, BT_SECURITY, &sec,
                    sizeof(sec)) < 0)
         return false;
 
@@ -1455,6 +2582,7 @@ static bool sign_set_key(struct sign_info ** sign, uint8_t key[16],
     (*sign)->counter = func;
     (*sign)->user_data = user_data;
     memcpy((*sign)->key, key, 16);
+    bt_crypto_key_init(&(*sign)->cmac, key);
 
     return true;
 }
@@ -1480,4 +2608,11 @@ bool bt_att_has_crypto(struct bt_att * att) {
         return false;
 
     return att->crypto ? true : false;
+}
+
+bool bt_att_set_crypto_af_alg(struct bt_att * att, bool enable) {
+    if (!att)
+        return false;
+
+    return bt_crypto_set_af_alg(att->crypto, enable);
 }
\ No newline at end of file
@@ -27,6 +27,9 @@
 #include "att-types.h"
 
 struct bt_att;
+struct bt_att_buf;
+struct att_trace;
+struct timespec;
 
 struct bt_att * bt_att_new(int fd, bool ext_signed);
 
@@ -37,6 +40,9 @@ bool bt_att_set_close_on_unref(struct bt_att * att, bool do_close);
 
 int bt_att_get_fd(struct bt_att * att);
 
+int bt_att_attach_fd(struct bt_att * att, int fd);
+int bt_att_get_channels(struct bt_att * att);
+
 typedef void (*bt_att_response_func_t)(uint8_t opcode, const void * pdu,
                                        uint16_t length, void * user_data);
 typedef void (*bt_att_notify_func_t)(uint8_t opcode, const void * pdu,
@@ -47,6 +53,7 @@ typedef void (*bt_att_timeout_func_t)(unsigned int id, uint8_t opcode,
                                       void * user_data);
 typedef void (*bt_att_disconnect_func_t)(int err, void * user_data);
 typedef bool (*bt_att_counter_func_t)(uint32_t * sign_cnt, void * user_data);
+typedef void (*bt_att_batch_func_t)(unsigned int count, void * user_data);
 
 bool bt_att_set_debug(struct bt_att * att, bt_att_debug_func_t callback,
                       void * user_data, bt_att_destroy_func_t destroy);
@@ -54,6 +61,62 @@ bool bt_att_set_debug(struct bt_att * att, bt_att_debug_func_t callback,
 uint16_t bt_att_get_mtu(struct bt_att * att);
 bool bt_att_set_mtu(struct bt_att * att, uint16_t mtu);
 
+/* send op slot pool counters */
+struct bt_att_pool_stats {
+    uint64_t hits;          /* ops served from the pool */
+    uint64_t misses;        /* ops that needed an allocation */
+    unsigned int free;      /* slots currently pooled */
+};
+
+bool bt_att_get_pool_stats(struct bt_att * att,
+                           struct bt_att_pool_stats * stats);
+
+/* read side counters, pdus / wakeups is the mean batch size */
+struct bt_att_read_stats {
+    uint64_t wakeups;       /* EPOLLIN wakeups */
+    uint64_t pdus;          /* PDUs read */
+};
+
+bool bt_att_set_read_budget(struct bt_att * att, unsigned int budget);
+bool bt_att_get_read_stats(struct bt_att * att,
+                           struct bt_att_read_stats * stats);
+
+bool bt_att_set_trace(struct bt_att * att, struct att_trace * trace);
+
+/* latency summary of one opcode, microseconds, percentiles within 1/16 */
+struct bt_att_latency {
+    uint64_t count;         /* samples */
+    uint32_t min;
+    uint32_t mean;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+};
+
+typedef void (*bt_att_latency_func_t)(uint8_t opcode,
+                                      const struct bt_att_latency * rtt,
+                                      const struct bt_att_latency * wait,
+                                      void * user_data);
+
+bool bt_att_get_latency(struct bt_att * att, uint8_t opcode,
+                        struct bt_att_latency * rtt,
+                        struct bt_att_latency * wait);
+void bt_att_foreach_latency(struct bt_att * att, bt_att_latency_func_t func,
+                            void * user_data);
+void bt_att_reset_latency(struct bt_att * att);
+
+/* write side counters, a batch is the PDUs sent from one EPOLLOUT wakeup */
+struct bt_att_write_stats {
+    uint64_t batches;       /* batches sent */
+    uint64_t pdus;          /* PDUs sent */
+    uint64_t syscalls;      /* sendmmsg / writev calls */
+    unsigned int max_batch; /* largest batch */
+};
+
+bool bt_att_get_write_stats(struct bt_att * att,
+                            struct bt_att_write_stats * stats);
+
 bool bt_att_set_timeout_cb(struct bt_att * att, bt_att_timeout_func_t callback,
                            void * user_data,
                            bt_att_destroy_func_t destroy);
@@ -81,8 +144,22 @@ unsigned int bt_att_register_disconnect(struct bt_att * att,
                                         bt_att_destroy_func_t destroy);
 bool bt_att_unregister_disconnect(struct bt_att * att, unsigned int id);
 
+unsigned int bt_att_register_batch(struct bt_att * att,
+                                   bt_att_batch_func_t callback,
+                                   void * user_data,
+                                   bt_att_destroy_func_t destroy);
+bool bt_att_unregister_batch(struct bt_att * att, unsigned int id);
+
 bool bt_att_unregister_all(struct bt_att * att);
 
+/* received PDU buffers, borrowed in callbacks, pinned with a reference */
+struct bt_att_buf * bt_att_get_rx_buf(struct bt_att * att);
+struct bt_att_buf * bt_att_buf_ref(struct bt_att_buf * buf);
+void bt_att_buf_unref(struct bt_att_buf * buf);
+const uint8_t * bt_att_buf_data(const struct bt_att_buf * buf);
+uint16_t bt_att_buf_len(const struct bt_att_buf * buf);
+const struct timespec * bt_att_buf_time(const struct bt_att_buf * buf);
+
 int bt_att_get_security(struct bt_att * att);
 bool bt_att_set_security(struct bt_att * att, int level);
 
@@ -91,3 +168,4 @@ bool bt_att_set_local_key(struct bt_att * att, uint8_t sign_key[16],
 bool bt_att_set_remote_key(struct bt_att * att, uint8_t sign_key[16],
                            bt_att_counter_func_t func, void * user_data);
 bool bt_att_has_crypto(struct bt_att * att);
+bool bt_att_set_crypto_af_alg(struct bt_att * att, bool enable);
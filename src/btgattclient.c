@@ -48,6 +48,9 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <alloca.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "bluetooth.h"
 #include "hci.h"
@@ -58,19 +61,34 @@
 #include "mainloop.h"
 #include "util.h"
 #include "att.h"
+#include "crypto.h"
 #include "queue.h"
 #include "gatt-db.h"
 #include "gatt-client.h"
+#include "gatt-cache.h"
+#include "att-trace.h"
+#include "hci-engine.h"
 #include "mqtt.h"
+#include "dl24.h"
 #include "dlog.h"
 
 #define ATT_CID 4
 
+#define CLIENT_NAME_SIZE 32
+#define CLIENT_CONNECT_DELAY 1         // first attempt, ms
+#define CLIENT_CONNECT_TIMEOUT 30000   // give up a pending connect, ms
+#define CLIENT_BACKOFF_MIN 1000        // first retry delay, ms
+#define CLIENT_BACKOFF_MAX 60000       // retry delay cap, ms
+#define CLIENT_READ_BUDGET 16          // ATT PDUs drained per wakeup
+#define CLIENT_TRACE_ENTRIES 2048      // ATT PDUs kept for the btsnoop dump
+#define CLIENT_TRACE_SNAPLEN 64        // bytes kept per traced PDU
+#define CLIENT_LATENCY_INTERVAL 10000  // ATT latency export to MQTT, ms
+#define CLIENT_EATT_CHANNELS 2         // EATT bearers opened by default
+#define CLIENT_EATT_CHANNELS_MAX 5     // bearers of one ECRED connect request
+#define CLIENT_SERVICES_MAX 8          // service UUIDs of the -S allow-list
+
 static bool disable_mqtt = false;
-static int batt_timer_fd = -1;
-static int batt_timer_interval = 0;
-static int rssi_timer_fd = -1;
-static int rssi_timer_interval = 0;
+static bool mqtt_mainloop = false;
 
 #define PRLOGE(format, ...) \
     while(1) {     \
@@ -104,9 +122,39 @@ break;                   \
 static bool verbose = false;
 
 /**
- * client structure holds gatt client context
+ * device connection state machine
+ *
+ * IDLE --timer--> CONNECTING --EPOLLOUT--> CONNECTED --ready_cb--> READY
+ *   ^                 |                         |                     |
+ *   +--backoff--------+--error/timeout----------+----disconnect-------+
+ */
+enum client_state {
+    CLIENT_IDLE,
+    CLIENT_CONNECTING,
+    CLIENT_CONNECTED,
+    CLIENT_READY,
+};
+
+/**
+ * client structure holds gatt client context, one per device
  */
 struct client {
+    /// device address
+    bdaddr_t dst;
+    /// BDADDR_LE_PUBLIC or BDADDR_LE_RANDOM
+    uint8_t dst_type;
+    /// name used in logs and in the MQTT topic
+    char name[CLIENT_NAME_SIZE];
+    /// MQTT device index or -1
+    int mqtt_device;
+    /// connection state
+    enum client_state state;
+    /// connect timer, retry delay while IDLE, timeout while CONNECTING
+    int connect_timer;
+    /// current retry delay, ms
+    unsigned int backoff;
+    /// client_disconnected posted, the link is being dropped
+    bool drop_pending;
     /// socket
     int fd;
     /// pointer to a bt_att structure
@@ -117,14 +165,59 @@ struct client {
     struct bt_gatt_client *gatt;
     /// session id
     unsigned int reliable_session_id;
-    /// hci_socket
-    int hci_socket;
+    /// pending RSSI read on hci_dev
+    unsigned int rssi_cmd;
     /// hci handle
     uint16_t hci_handle;
     /// battery handle
     uint16_t battery_handle;
+    /// battery polling timer and interval
+    int batt_timer_fd;
+    int batt_timer_interval;
+    /// rssi polling timer and interval
+    int rssi_timer_fd;
+    int rssi_timer_interval;
+    /// ATT latency export timer
+    int latency_timer_fd;
+    /// last logged sample
+    struct dl24_sample prev;
+    /// last decoded sample, logged at the end of the read batch
+    struct dl24_sample last;
+    bool last_valid;
+    /// last good frame, pinned ATT receive buffer and the value in it
+    struct bt_att_buf *frame;
+    const uint8_t *frame_value;
+    uint16_t frame_len;
+    /// decoder counters, frames accepted and dropped
+    struct dl24_stats dl24_stats;
+    /// raw ATT PDUs of the last connections, dumped on SIGUSR1 and disconnect
+    struct att_trace *trace;
+    /// EATT sockets still connecting, -1 when unused
+    int eatt_fd[CLIENT_EATT_CHANNELS_MAX];
 };
 
+/// every configured device
+static struct queue *clients = NULL;
+/// device the console commands apply to
+static struct client *console_cli = NULL;
+
+/// HCI command engine of the adapter, shared by all devices
+static struct bt_hci *hci_dev = NULL;
+
+/// connection parameters shared by all devices
+static bdaddr_t src_addr;
+static int sec_level = BT_SECURITY_LOW;
+static uint16_t att_mtu = 0;
+/// directory of the per device GATT caches, NULL to always discover
+static const char *cache_dir = NULL;
+/// directory of the per device btsnoop ATT traces
+static const char *trace_dir = "/tmp";
+/// EATT bearers opened next to the fixed channel, 0 for a single bearer
+static int eatt_channels = CLIENT_EATT_CHANNELS;
+/// services discovered on connect, none for a full discovery
+static bt_uuid_t service_filter[CLIENT_SERVICES_MAX];
+static unsigned int service_filter_count = 0;
+
 /**
  * print prompt
  */
@@ -191,15 +284,79 @@ static const char *ecode_to_string(uint8_t ecode) {
     }
 }
 
+static void client_detach(struct client *cli);
+static void client_schedule_connect(struct client *cli, unsigned int msec);
+static void client_schedule_retry(struct client *cli);
+
+/**
+ * tear the connection down outside of the bt_att disconnect handlers
+ *
+ * @param user_data	client pointer
+ */
+static void client_disconnected(void *user_data) {
+    struct client *cli = user_data;
+
+    cli->drop_pending = false;
+    client_detach(cli);
+    client_schedule_retry(cli);
+}
+
+/**
+ * drop the connection and schedule a reconnect once the bt_att and
+ * bt_gatt_client callbacks have returned, several callers may ask for it
+ * on the same failure
+ *
+ * @param cli	client pointer
+ */
+static void client_drop(struct client *cli) {
+    if (cli->drop_pending)
+        return;
+
+    cli->drop_pending = true;
+    if (mainloop_post(client_disconnected, cli) < 0)
+        client_disconnected(cli);
+}
+
+/**
+ * write the ATT trace ring of a client to <trace_dir>/<address>.btsnoop
+ *
+ * @param data		client pointer
+ * @param user_data	not used
+ */
+static void client_trace_dump(void *data, __attribute__((unused)) void *user_data) {
+    struct client *cli = data;
+    char addr[18], path[PATH_MAX];
+    int ret;
+
+    if (!cli->trace || !att_trace_count(cli->trace))
+        return;
+
+    ba2str(&cli->dst, addr);
+    if (snprintf(path, sizeof(path), "%s/%s.btsnoop", trace_dir, addr) >=
+        (int) sizeof(path))
+        return;
+
+    ret = att_trace_dump(cli->trace, cli->hci_handle, path);
+    if (ret < 0)
+        daemon_log(LOG_ERR, "%s: Failed to write ATT trace %s: %s", cli->name,
+                   path, strerror(-ret));
+    else
+        daemon_log(LOG_INFO, "%s: %d ATT PDUs written to %s", cli->name, ret,
+                   path);
+}
+
 /**
- * disconnect callback, quit mainloop
+ * disconnect callback, drop the connection and schedule a reconnect
  *
  * @param err		error code associated with disconnect
- * @param user_data	user data pointer (not used)
+ * @param user_data	client pointer
  */
-static void att_disconnect_cb(int err, __attribute__((unused)) void *user_data) {
-    daemon_log(LOG_ERR, "Device disconnected: %s", strerror(err));
-    mainloop_quit();
+static void att_disconnect_cb(int err, void *user_data) {
+    struct client *cli = user_data;
+
+    daemon_log(LOG_ERR, "%s: device disconnected: %s", cli->name, strerror(err));
+    client_trace_dump(cli, NULL);
+    client_drop(cli);
 }
 
 /**
@@ -228,10 +385,15 @@ static void gatt_debug_cb(const char *str, void *user_data) {
 }
 
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data);
+static void client_eatt_start(struct client *cli);
+
+static void latency_timer_cb(int fd, void *user_data);
 
 static void service_changed_cb(uint16_t start_handle, uint16_t end_handle,
                                void *user_data);
 
+static void att_batch_cb(unsigned int count, void *user_data);
+
 /**
  * log discovered service
  *
@@ -273,14 +435,16 @@ static void service_removed_cb(struct gatt_db_attribute *attr, __attribute__((un
 }
 
 /**
- * create an gatt client attached to the fd l2cap socket
+ * create an idle client for a device
  *
- * @param fd	socket
- * @param mtu	selected pdu size
- * @return gatt client structure
+ * @param dst		device address
+ * @param dst_type	BDADDR_LE_PUBLIC or BDADDR_LE_RANDOM
+ * @param name		device name, NULL for the address
+ * @return client structure or NULL
  */
-static struct client *client_create(int fd, uint16_t mtu) {
+static struct client *client_new(const bdaddr_t *dst, uint8_t dst_type, const char *name) {
     struct client *cli;
+    int i;
 
     cli = new0(struct client, 1);
     if (!cli) {
@@ -288,47 +452,210 @@ static struct client *client_create(int fd, uint16_t mtu) {
         return NULL;
     }
 
+    bacpy(&cli->dst, dst);
+    cli->dst_type = dst_type;
+    if (name) {
+        snprintf(cli->name, sizeof(cli->name), "%s", name);
+    } else {
+        char addr[18], *c, *n = cli->name;
+
+        ba2str(dst, addr);
+        for (c = addr; *c; c++) {
+            if (*c != ':')
+                *n++ = *c;
+        }
+        *n = '\0';
+    }
+    cli->mqtt_device = -1;
+    cli->state = CLIENT_IDLE;
+    cli->connect_timer = -1;
+    cli->fd = -1;
+    cli->batt_timer_fd = -1;
+    cli->rssi_timer_fd = -1;
+    cli->latency_timer_fd = -1;
+    for (i = 0; i < CLIENT_EATT_CHANNELS_MAX; i++)
+        cli->eatt_fd[i] = -1;
+
+    /* the trace is optional, allocated once and kept across reconnects */
+    cli->trace = att_trace_new(CLIENT_TRACE_ENTRIES, CLIENT_TRACE_SNAPLEN);
+    if (!cli->trace)
+        PRLOGE("Failed to allocate ATT trace");
+
+    return cli;
+}
+
+/**
+ * cache file of a client, named after the device address
+ *
+ * @param cli	client
+ * @param path	filled with the file name
+ * @param size	path size
+ * @return false if caching is off
+ */
+static bool client_cache_path(struct client *cli, char *path, size_t size) {
+    char addr[18];
+
+    if (!cache_dir)
+        return false;
+
+    ba2str(&cli->dst, addr);
+    return snprintf(path, size, "%s/%s.gatt", cache_dir, addr) < (int) size;
+}
+
+/**
+ * restore the services found on a previous connection
+ *
+ * @param cli		client
+ * @param hash		filled with the Database Hash the cache was saved with
+ * @param has_hash	set if hash is valid
+ * @return db or NULL if there is no usable cache
+ */
+static struct gatt_db *client_cache_load(struct client *cli, uint8_t *hash,
+                                         bool *has_hash) {
+    char path[PATH_MAX];
+    struct gatt_db *db;
+
+    if (!client_cache_path(cli, path, sizeof(path)))
+        return NULL;
+
+    db = gatt_cache_load(path, hash, has_hash);
+    if (db)
+        daemon_log(LOG_INFO, "%s: GATT cache loaded from %s%s", cli->name,
+                   path, *has_hash ? "" : " (no Database Hash)");
+
+    return db;
+}
+
+static void client_cache_write(struct client *cli, const uint8_t *hash) {
+    char path[PATH_MAX];
+    int err;
+
+    if (!client_cache_path(cli, path, sizeof(path)))
+        return;
+
+    err = gatt_cache_save(cli->db, hash, path);
+    if (err < 0)
+        daemon_log(LOG_ERR, "%s: Failed to write GATT cache %s: %s",
+                   cli->name, path, strerror(-err));
+}
+
+static void cache_hash_read_cb(bool success, uint8_t att_ecode,
+                               const uint8_t *value, uint16_t length,
+                               void *user_data) {
+    struct client *cli = user_data;
+
+    if (!success || length != GATT_CACHE_HASH_SIZE) {
+        daemon_log(LOG_INFO, "%s: Database Hash not read (0x%02x)", cli->name,
+                   att_ecode);
+        value = NULL;
+    }
+
+    client_cache_write(cli, value);
+}
+
+static void find_handle_cb(struct gatt_db_attribute *attr, void *user_data) {
+    uint16_t *handle = user_data;
+
+    if (!*handle)
+        *handle = gatt_db_attribute_get_handle(attr);
+}
+
+/**
+ * store the discovered services, with the Database Hash if the server has
+ * one, the next connection then skips the discovery
+ *
+ * @param cli	ready client
+ */
+static void client_cache_save(struct client *cli) {
+    uint16_t handle = 0;
+    bt_uuid_t uuid;
+
+    if (!cache_dir)
+        return;
+
+    bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+    gatt_db_find_by_type(cli->db, 0x0001, 0xffff, &uuid, find_handle_cb,
+                         &handle);
+
+    if (handle && bt_gatt_client_read_value(cli->gatt, handle,
+                                            cache_hash_read_cb, cli, NULL))
+        return;
+
+    client_cache_write(cli, NULL);
+}
+
+/**
+ * create an gatt client attached to the fd l2cap socket
+ *
+ * @param cli	idle client
+ * @param fd	socket
+ * @param mtu	selected pdu size
+ * @return true on success, the socket is closed on failure
+ */
+static bool client_attach(struct client *cli, int fd, uint16_t mtu) {
+    uint8_t hash[GATT_CACHE_HASH_SIZE];
+    bool has_hash = false;
+
     cli->att = bt_att_new(fd, false);
     if (!cli->att) {
         PRLOGE("Failed to initialze ATT transport layer");
-        bt_att_unref(cli->att);
-        free(cli);
-        return NULL;
+        close(fd);
+        cli->fd = -1;
+        return false;
     }
 
     if (!bt_att_set_close_on_unref(cli->att, true)) {
         PRLOGE("Failed to set up ATT transport layer");
         bt_att_unref(cli->att);
-        free(cli);
-        return NULL;
+        cli->att = NULL;
+        close(fd);
+        cli->fd = -1;
+        return false;
     }
 
-    if (!bt_att_register_disconnect(cli->att, att_disconnect_cb, NULL,
+    if (!bt_att_register_disconnect(cli->att, att_disconnect_cb, cli,
                                     NULL)) {
         PRLOGE("Failed to set ATT disconnect handler");
-        bt_att_unref(cli->att);
-        free(cli);
-        return NULL;
+        goto fail;
     }
 
+    /* several notifications per wakeup, the log is written once per batch */
+    if (!bt_att_set_read_budget(cli->att, CLIENT_READ_BUDGET))
+        daemon_log(LOG_ERR, "%s: ATT read draining not available", cli->name);
+
+    if (!bt_att_register_batch(cli->att, att_batch_cb, cli, NULL)) {
+        PRLOGE("Failed to set ATT batch handler");
+        goto fail;
+    }
+
+    bt_att_set_trace(cli->att, cli->trace);
+
     cli->fd = fd;
-    cli->db = gatt_db_new();
+    cli->db = client_cache_load(cli, hash, &has_hash);
+    if (!cli->db)
+        cli->db = gatt_db_new();
     if (!cli->db) {
         PRLOGE("Failed to create GATT database");
-        bt_att_unref(cli->att);
-        free(cli);
-        return NULL;
+        goto fail;
     }
 
     cli->gatt = bt_gatt_client_new(cli->db, cli->att, mtu);
     if (!cli->gatt) {
         PRLOGE("Failed to create GATT client");
         gatt_db_unref(cli->db);
-        bt_att_unref(cli->att);
-        free(cli);
-        return NULL;
+        cli->db = NULL;
+        goto fail;
     }
 
+    if (has_hash)
+        bt_gatt_client_set_db_hash(cli->gatt, hash);
+
+    if (service_filter_count &&
+        !bt_gatt_client_set_service_filter(cli->gatt, service_filter,
+                                           service_filter_count))
+        daemon_log(LOG_ERR, "%s: service filter not set, discovering all "
+                   "services", cli->name);
+
     gatt_db_register(cli->db, service_added_cb, service_removed_cb,
                      NULL, NULL);
 
@@ -345,17 +672,82 @@ static struct client *client_create(int fd, uint16_t mtu) {
     /* bt_gatt_client already holds a reference */
     gatt_db_unref(cli->db);
 
-    return cli;
+    cli->state = CLIENT_CONNECTED;
+
+    return true;
+
+fail:
+    /* close on unref */
+    bt_att_unref(cli->att);
+    cli->att = NULL;
+    cli->fd = -1;
+    return false;
 }
 
 /**
- * client structure cleanup
+ * drop the connection of a client, it goes back to idle
  *
- * @param cli client pointer to destroy
+ * @param cli client pointer
  */
-static void client_destroy(struct client *cli) {
+static void client_detach(struct client *cli) {
+    int i;
+
+    if (cli->state == CLIENT_CONNECTING && cli->fd >= 0) {
+        /* connect still pending, the socket is not owned by bt_att yet */
+        mainloop_remove_fd(cli->fd);
+        close(cli->fd);
+    }
+    for (i = 0; i < CLIENT_EATT_CHANNELS_MAX; i++) {
+        if (cli->eatt_fd[i] < 0)
+            continue;
+        mainloop_remove_fd(cli->eatt_fd[i]);
+        close(cli->eatt_fd[i]);
+        cli->eatt_fd[i] = -1;
+    }
+    if (cli->batt_timer_fd != -1) {
+        mainloop_remove_timeout(cli->batt_timer_fd);
+        cli->batt_timer_fd = -1;
+    }
+    if (cli->rssi_timer_fd != -1) {
+        mainloop_remove_timeout(cli->rssi_timer_fd);
+        cli->rssi_timer_fd = -1;
+    }
+    if (cli->latency_timer_fd != -1) {
+        mainloop_remove_timeout(cli->latency_timer_fd);
+        cli->latency_timer_fd = -1;
+    }
+    if (cli->rssi_cmd) {
+        bt_hci_cancel(hci_dev, cli->rssi_cmd);
+        cli->rssi_cmd = 0;
+    }
+    if (cli->state == CLIENT_READY && cli->mqtt_device >= 0) {
+        mosq_device_state(cli->mqtt_device, false);
+    }
+
     bt_gatt_client_unref(cli->gatt);
     bt_att_unref(cli->att);
+    cli->gatt = NULL;
+    cli->att = NULL;
+    cli->db = NULL;
+    cli->fd = -1;
+    cli->battery_handle = 0;
+    cli->reliable_session_id = 0;
+    cli->state = CLIENT_IDLE;
+}
+
+/**
+ * client structure cleanup
+ *
+ * @param data client pointer to destroy
+ */
+static void client_destroy(void *data) {
+    struct client *cli = data;
+
+    if (cli->connect_timer != -1)
+        mainloop_remove_timeout(cli->connect_timer);
+    client_detach(cli);
+    bt_att_buf_unref(cli->frame);
+    att_trace_free(cli->trace);
     free(cli);
 }
 
@@ -414,7 +806,7 @@ static void print_desc(struct gatt_db_attribute *attr, __attribute__((unused)) v
 static void register_notify_cb(uint16_t att_ecode, void *user_data);
 
 static void notify_cb(uint16_t value_handle, const uint8_t *value,
-                      uint16_t length, __attribute__((unused)) void *user_data);
+                      uint16_t length, void *user_data);
 
 static void notify_battery_cb(uint16_t value_handle, const uint8_t *value,
                               uint16_t length, __attribute__((unused)) void *user_data);
@@ -435,7 +827,7 @@ static void subscribe_chrc(struct gatt_db_attribute *attr, void *user_data) {
                    value_handle, properties);
         unsigned int id = bt_gatt_client_register_notify(cli->gatt, value_handle,
                                                          register_notify_cb,
-                                                         notify_cb, NULL, NULL);
+                                                         notify_cb, cli, NULL);
         if (!id) {
             daemon_log(LOG_ERR, "Failed to register notify handler");
             return;
@@ -549,12 +941,26 @@ static void ready_cb(bool success, uint8_t att_ecode, void *user_data) {
     struct client *cli = user_data;
 
     if (!success) {
-        PRLOG("GATT discovery procedures failed - error code: 0x%02x",
-              att_ecode);
+        PRLOG("%s: GATT discovery procedures failed - error code: 0x%02x",
+              cli->name, att_ecode);
+        /* never becomes READY, start over rather than idle on the link */
+        client_drop(cli);
         return;
     }
 
-    PRLOG("GATT discovery procedures complete");
+    PRLOG("%s: GATT discovery procedures complete", cli->name);
+
+    cli->state = CLIENT_READY;
+    cli->backoff = 0;
+    if (cli->mqtt_device >= 0) {
+        mosq_device_state(cli->mqtt_device, true);
+        if (cli->latency_timer_fd == -1)
+            cli->latency_timer_fd = mainloop_add_timeout(CLIENT_LATENCY_INTERVAL,
+                                                         latency_timer_cb, cli, NULL);
+    }
+
+    client_cache_save(cli);
+    client_eatt_start(cli);
 
     print_services(cli);
     print_prompt();
@@ -577,6 +983,9 @@ static void service_changed_cb(uint16_t start_handle, uint16_t end_handle,
     gatt_db_foreach_service_in_range(cli->db, NULL, print_service, cli,
                                      start_handle, end_handle);
     print_prompt();
+
+    if (cli->state == CLIENT_READY)
+        client_cache_save(cli);
 }
 
 /**
@@ -1388,30 +1797,6 @@ static void register_notify_usage(void) {
 
 }
 
-//ff 55 01 02 00 01 08 00 0e f4 00 03 7a 00 00 00 17 00 00 34 00 00 00 00 00 14 00 03 14 37 3c 00 00 00 00 23
-
-static uint32_t dl24_get_16bit(const uint8_t *data, size_t i) {
-    return ((uint16_t) data[i + 0] << 8) | ((uint16_t) data[i + 1] << 0);
-}
-
-static int32_t dl24_get_24bit(const uint8_t *data, size_t i) {
-    return ((uint32_t) data[i + 0] << 16) | ((uint32_t) data[i + 1] << 8) | ((uint32_t) data[i + 2] << 0);
-}
-
-static int32_t dl24_get_32bit(const uint8_t *data, size_t i) {
-    return ((uint32_t) dl24_get_16bit(data, i + 0) << 16) | ((uint32_t) dl24_get_16bit(data, i + 2) << 0);
-}
-
-//static uint8_t crc(const uint8_t * data, const uint16_t len) {
-//    uint8_t crc = 0;
-//
-//    // skip header
-//    for (uint16_t i = 2; i < len; i++) {
-//        crc = crc + data[i];
-//    }
-//    return crc ^ 0x44;
-//}
-
 static void notify_battery_cb(uint16_t value_handle, const uint8_t *value,
                               uint16_t length, __attribute__((unused)) void *user_data) {
     daemon_log(LOG_INFO, "Battery notify: 0x%04x - (%u bytes)", value_handle, length);
@@ -1424,43 +1809,71 @@ static void notify_battery_cb(uint16_t value_handle, const uint8_t *value,
  * @param value_handle	handle of the notifying object
  * @param value			vector value of the object
  * @param length		length of vector value
- * @param user_data		not used
+ * @param user_data		client pointer
  */
 static void notify_cb(uint16_t value_handle, const uint8_t *value,
-                      uint16_t length, __attribute__((unused)) void *user_data) {
-    if (length == 36 && value[0] == 0xff && value[1] == 0x55) {
-        double voltage = dl24_get_24bit(value, 4) * 0.1f;
-        double current = dl24_get_24bit(value, 7) * 0.001f;
-        double temp = dl24_get_16bit(value, 24);
-        double cap_ah = dl24_get_24bit(value, 10) * 0.01f;
-        double cap_wh = dl24_get_32bit(value, 13) * 10.0f;
-
-        static double p_voltage = NAN;
-        static double p_current = NAN;
-        static double p_temp = NAN;
-        static double p_cap_ah = NAN;
-        static double p_cap_wh = NAN;
-
-        if (!disable_mqtt) {
-            mosq_gather_data(current, voltage);
-        }
-
-        if (voltage != p_voltage || current != p_current || temp != p_temp || cap_ah != p_cap_ah ||
-            cap_wh != p_cap_wh) {
-            p_voltage = voltage;
-            p_current = current;
-            p_temp = temp;
-            p_cap_ah = cap_ah;
-            p_cap_wh = cap_wh;
-            daemon_log(LOG_INFO, "%.2fV %.2fA %.0fC %.2fAh %.2fWh", voltage, current, temp, cap_ah, cap_wh);
-        }
-    } else {
-        daemon_log(LOG_ERR, "Handle Value Not/Ind: 0x%04x - (%u bytes)", value_handle, length);
+                      uint16_t length, void *user_data) {
+    struct client *cli = user_data;
+    struct dl24_sample sample;
+    int err;
+
+    err = dl24_decode(value, length, &sample, &cli->dl24_stats);
+    if (err < 0) {
+        const struct dl24_stats *st = &cli->dl24_stats;
+
+        daemon_log(LOG_ERR, "%s: Handle Value Not/Ind: 0x%04x - (%u bytes) %s, "
+                   "bad frames: %u invalid, %u unsupported, %u checksum, "
+                   "%u implausible",
+                   cli->name, value_handle, length, strerror(-err),
+                   st->invalid, st->unsupported, st->bad_checksum,
+                   st->implausible);
         hex_dump(value, length);
+        return;
+    }
+
+    if (!disable_mqtt && cli->mqtt_device >= 0) {
+        mosq_gather_data(cli->mqtt_device, sample.current_ma, sample.voltage_mv);
+    }
+
+    /* every sample is averaged, only the last one of a batch is logged */
+    cli->last = sample;
+    cli->last_valid = true;
+
+    /* keep the frame without copying it, value points into the buffer */
+    bt_att_buf_unref(cli->frame);
+    cli->frame = bt_att_buf_ref(bt_att_get_rx_buf(cli->att));
+    cli->frame_value = cli->frame ? value : NULL;
+    cli->frame_len = cli->frame ? length : 0;
+}
+
+/**
+ * end of an ATT read batch, log the last sample if it changed
+ *
+ * @param count		PDUs of the batch
+ * @param user_data	client pointer
+ */
+static void att_batch_cb(__attribute__((unused)) unsigned int count, void *user_data) {
+    struct client *cli = user_data;
+    struct dl24_sample sample = cli->last;
+
+    if (!cli->last_valid)
+        return;
+
+    cli->last_valid = false;
+
+    if (sample.voltage_mv != cli->prev.voltage_mv || sample.current_ma != cli->prev.current_ma ||
+        sample.temperature_c != cli->prev.temperature_c || sample.capacity_mah != cli->prev.capacity_mah ||
+        sample.energy_cwh != cli->prev.energy_cwh) {
+        cli->prev = sample;
+        daemon_log(LOG_INFO, "%s: %u.%03uV %u.%03uA %u.%03uW %uC %u.%03uAh %u.%02uWh",
+                   cli->name, sample.voltage_mv / 1000, sample.voltage_mv % 1000,
+                   sample.current_ma / 1000, sample.current_ma % 1000,
+                   sample.power_mw / 1000, sample.power_mw % 1000,
+                   sample.temperature_c,
+                   sample.capacity_mah / 1000, sample.capacity_mah % 1000,
+                   sample.energy_cwh / 100, sample.energy_cwh % 100);
     }
 }
-// ff 55 01 02 00 01 0e 00 4d c8 00 09 3c 00 00 00 3e 00 00 34 00 00 00 00 00 17 00 06 05 08 3c 00 00 00 00 23
-// ff 55 01 02 00 01 07 00 0f 8f 00 04 80 00 00 00 1e 00 00 34 00 00 00 00 00 14 00 03 3b 05 3c 00 00 00 00 23
 
 /**
  *  register notify call back
@@ -1509,7 +1922,7 @@ static void cmd_register_notify(struct client *cli, char *cmd_str) {
 
     id = bt_gatt_client_register_notify(cli->gatt, value_handle,
                                         register_notify_cb,
-                                        notify_cb, NULL, NULL);
+                                        notify_cb, cli, NULL);
     if (!id) {
         daemon_log(LOG_ERR, "Failed to register notify handler");
         return;
@@ -1612,19 +2025,79 @@ static void cmd_set_security(struct client *cli, char *cmd_str) {
         daemon_log(LOG_INFO, "Setting security level %d success", level);
 }
 
-static void read_rssi_timer_cb(int fd, void *user_data) {
+/**
+ * Read RSSI command complete
+ *
+ * @param err		0 or -errno
+ * @param data		read_rssi_rp
+ * @param size		data length
+ * @param user_data	client pointer
+ */
+static void read_rssi_cb(int err, const void *data, uint8_t size, void *user_data) {
     struct client *cli = user_data;
-    int8_t rssi = 0;
-    if (!hci_read_rssi(cli->hci_socket, cli->hci_handle, &rssi, 1000)) {
-        daemon_log(LOG_INFO, COLOR_GREEN "RSSI: %d" COLOR_OFF, rssi);
-    } else {
-        daemon_log(LOG_ERR, COLOR_RED "Could not read RSSI" COLOR_OFF);
+    const read_rssi_rp *rp = data;
+
+    cli->rssi_cmd = 0;
+
+    if (err == -ECANCELED)
+        return;
+
+    if (err || size < READ_RSSI_RP_SIZE || rp->status) {
+        daemon_log(LOG_ERR, COLOR_RED "%s: Could not read RSSI" COLOR_OFF, cli->name);
+        return;
     }
-    if (rssi_timer_interval) {
-        mainloop_modify_timeout(fd, rssi_timer_interval);
+
+    daemon_log(LOG_INFO, COLOR_GREEN "%s: RSSI: %d" COLOR_OFF, cli->name, rp->rssi);
+}
+
+/**
+ * queue an RSSI read unless one is already pending
+ *
+ * @param cli	client pointer
+ */
+static void read_rssi(struct client *cli) {
+    if (cli->rssi_cmd)
+        return;
+
+    cli->rssi_cmd = bt_hci_read_rssi(hci_dev, cli->hci_handle, read_rssi_cb, cli, NULL);
+    if (!cli->rssi_cmd)
+        daemon_log(LOG_ERR, COLOR_RED "%s: Could not read RSSI" COLOR_OFF, cli->name);
+}
+
+static void read_rssi_timer_cb(int fd, void *user_data) {
+    struct client *cli = user_data;
+
+    read_rssi(cli);
+    if (cli->rssi_timer_interval) {
+        mainloop_modify_timeout(fd, cli->rssi_timer_interval);
     }
 }
 
+static void export_latency(uint8_t opcode, const struct bt_att_latency *rtt,
+                           const struct bt_att_latency *wait, void *user_data) {
+    struct client *cli = user_data;
+    struct mosq_latency lat = {
+        .opcode = opcode,
+        .count = (uint32_t) (rtt->count ? rtt->count : wait->count),
+        .p50_us = rtt->p50,
+        .p99_us = rtt->p99,
+        .max_us = rtt->max,
+        .wait_p99_us = wait->p99,
+    };
+
+    mosq_att_latency(cli->mqtt_device, &lat);
+}
+
+/**
+ * hand the ATT latency of every opcode sent so far to the MQTT publisher
+ */
+static void latency_timer_cb(int fd, void *user_data) {
+    struct client *cli = user_data;
+
+    bt_att_foreach_latency(cli->att, export_latency, cli);
+    mainloop_modify_timeout(fd, CLIENT_LATENCY_INTERVAL);
+}
+
 static void read_battery_timer_cb(int fd, void *user_data) {
     struct client *cli = user_data;
     if (!cli->battery_handle) {
@@ -1635,11 +2108,36 @@ static void read_battery_timer_cb(int fd, void *user_data) {
                                    NULL, NULL)) {
         daemon_log(LOG_ERR, "Failed to initiate read value procedure");
     }
-    if (batt_timer_interval) {
-        mainloop_modify_timeout(fd, batt_timer_interval);
+    if (cli->batt_timer_interval) {
+        mainloop_modify_timeout(fd, cli->batt_timer_interval);
     }
 }
 
+/**
+ * frame command, dump the last good DL24 frame with its receive time
+ *
+ * @param cli		pointer to the client structure
+ * @param cmd_str	not used
+ */
+static void cmd_frame(struct client *cli, __attribute__((unused)) char *cmd_str) {
+    const struct timespec *ts;
+    struct tm tm;
+    char tm_buffer[32];
+
+    if (!cli->frame) {
+        daemon_log(LOG_INFO, "%s: no frame received", cli->name);
+        return;
+    }
+
+    ts = bt_att_buf_time(cli->frame);
+    localtime_r(&ts->tv_sec, &tm);
+    strftime(tm_buffer, sizeof(tm_buffer), "%Y-%m-%d %H:%M:%S", &tm);
+
+    daemon_log(LOG_INFO, "%s: frame received %s.%03ld, %u bytes", cli->name,
+               tm_buffer, ts->tv_nsec / 1000000, cli->frame_len);
+    hex_dump(cli->frame_value, cli->frame_len);
+}
+
 static void cmd_battery(struct client *cli, char *cmd_str) {
     if (!bt_gatt_client_is_ready(cli->gatt)) {
         daemon_log(LOG_INFO, "GATT client not initialized");
@@ -1660,21 +2158,21 @@ static void cmd_battery(struct client *cli, char *cmd_str) {
         return;
     }
     if (argc == 1) {
-        batt_timer_interval = (int) strtol(argv[0], &endptr, 0);
-        if (!endptr || *endptr != '\0' || batt_timer_interval < 500 || batt_timer_interval > 3000) {
+        cli->batt_timer_interval = (int) strtol(argv[0], &endptr, 0);
+        if (!endptr || *endptr != '\0' || cli->batt_timer_interval < 500 || cli->batt_timer_interval > 3000) {
             daemon_log(LOG_ERR, "Invalid interval: %s", argv[0]);
-            batt_timer_interval = 0;
+            cli->batt_timer_interval = 0;
             return;
         }
     } else {
-        batt_timer_interval = 0;
+        cli->batt_timer_interval = 0;
     }
 
-    if (batt_timer_interval) {
-        if (batt_timer_fd != -1) {
-            mainloop_modify_timeout(batt_timer_fd, batt_timer_interval);
+    if (cli->batt_timer_interval) {
+        if (cli->batt_timer_fd != -1) {
+            mainloop_modify_timeout(cli->batt_timer_fd, cli->batt_timer_interval);
         } else {
-            batt_timer_fd = mainloop_add_timeout(batt_timer_interval, read_battery_timer_cb, cli, NULL);
+            cli->batt_timer_fd = mainloop_add_timeout(cli->batt_timer_interval, read_battery_timer_cb, cli, NULL);
         }
 
     } else {
@@ -1701,29 +2199,24 @@ static void cmd_rssi(struct client *cli, char *cmd_str) {
         return;
     }
     if (argc == 1) {
-        rssi_timer_interval = (int) strtol(argv[0], &endptr, 0);
-        if (!endptr || *endptr != '\0' || rssi_timer_interval < 500 || rssi_timer_interval > 3000) {
+        cli->rssi_timer_interval = (int) strtol(argv[0], &endptr, 0);
+        if (!endptr || *endptr != '\0' || cli->rssi_timer_interval < 500 || cli->rssi_timer_interval > 3000) {
             daemon_log(LOG_ERR, "Invalid interval: %s", argv[0]);
-            rssi_timer_interval = 0;
+            cli->rssi_timer_interval = 0;
             return;
         }
     } else {
-        rssi_timer_interval = 0;
+        cli->rssi_timer_interval = 0;
     }
 
-    if (rssi_timer_interval) {
-        if (rssi_timer_fd != -1) {
-            mainloop_modify_timeout(rssi_timer_fd, rssi_timer_interval);
+    if (cli->rssi_timer_interval) {
+        if (cli->rssi_timer_fd != -1) {
+            mainloop_modify_timeout(cli->rssi_timer_fd, cli->rssi_timer_interval);
         } else {
-            rssi_timer_fd = mainloop_add_timeout(rssi_timer_interval, read_rssi_timer_cb, cli, NULL);
+            cli->rssi_timer_fd = mainloop_add_timeout(cli->rssi_timer_interval, read_rssi_timer_cb, cli, NULL);
         }
     } else {
-        int8_t rssi = 0;
-        if (!hci_read_rssi(cli->hci_socket, cli->hci_handle, &rssi, 1000)) {
-            daemon_log(LOG_INFO, COLOR_GREEN "RSSI: %d" COLOR_OFF, rssi);
-        } else {
-            daemon_log(LOG_ERR, COLOR_RED "Could not read RSSI" COLOR_OFF);
-        }
+        read_rssi(cli);
     }
 }
 
@@ -1777,6 +2270,7 @@ static bool convert_sign_key(char *optarg, uint8_t key[16]) {
 static void set_sign_key_usage(void) {
     printf("Usage: set-sign-key [options]\nOptions:\n"
            "\t -c, --sign-key <csrk>\tCSRK\n"
+           "\t -k, --kernel\t\tSign with the kernel AF_ALG crypto\n"
            "e.g.:\n"
            "\tset-sign-key -c D8515948451FEA320DC05A2E88308188\n");
 }
@@ -1803,27 +2297,158 @@ static bool local_counter(uint32_t *sign_cnt, __attribute__((unused)) void *user
  * @param cmd_str	set sign key command string
  */
 static void cmd_set_sign_key(struct client *cli, char *cmd_str) {
-    char *argv[3];
+    char *argv[4];
     int argc = 0;
     uint8_t key[16];
+    bool kernel = false;
 
     memset(key, 0, 16);
 
-    if (!parse_args(cmd_str, 2, argv, &argc)) {
+    if (!parse_args(cmd_str, 3, argv, &argc)) {
         set_sign_key_usage();
         return;
     }
 
-    if (argc != 2) {
+    if (argc == 3 && (!strcmp(argv[2], "-k") || !strcmp(argv[2], "--kernel")))
+        kernel = true;
+    else if (argc != 2) {
         set_sign_key_usage();
         return;
     }
 
-    if (!strcmp(argv[0], "-c") || !strcmp(argv[0], "--sign-key")) {
-        if (convert_sign_key(argv[1], key))
-            bt_att_set_local_key(cli->att, key, local_counter, cli);
-    } else
+    if (strcmp(argv[0], "-c") && strcmp(argv[0], "--sign-key")) {
         set_sign_key_usage();
+        return;
+    }
+
+    if (!convert_sign_key(argv[1], key))
+        return;
+
+    if (!bt_att_set_crypto_af_alg(cli->att, kernel)) {
+        daemon_log(LOG_ERR, "%s: %s crypto not available", cli->name,
+                   kernel ? "AF_ALG" : "userspace");
+        return;
+    }
+
+    bt_att_set_local_key(cli->att, key, local_counter, cli);
+    daemon_log(LOG_INFO, "%s: signing with %s", cli->name,
+               kernel ? "AF_ALG" : bt_crypto_aes_impl());
+}
+
+static const char *client_state_str(enum client_state state) {
+    switch (state) {
+        case CLIENT_IDLE:
+            return "idle";
+        case CLIENT_CONNECTING:
+            return "connecting";
+        case CLIENT_CONNECTED:
+            return "connected";
+        case CLIENT_READY:
+            return "ready";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * find a client by position in the device list or by name
+ *
+ * @param key	index or name
+ * @return client pointer or NULL
+ */
+static struct client *client_lookup(const char *key) {
+    const struct queue_entry *entry;
+    char *endptr = NULL;
+    unsigned long index;
+
+    index = strtoul(key, &endptr, 0);
+    for (entry = queue_get_entries(clients); entry; entry = entry->next) {
+        struct client *cli = entry->data;
+
+        if ((endptr && *endptr == '\0' && !index--) || !strcmp(cli->name, key))
+            return cli;
+    }
+
+    return NULL;
+}
+
+static void print_latency(uint8_t opcode, const struct bt_att_latency *rtt,
+                          const struct bt_att_latency *wait,
+                          __attribute__((unused)) void *user_data) {
+    if (rtt->count)
+        daemon_log(LOG_INFO, "\tatt 0x%02x rtt: %llu, min %u, mean %u, "
+                   "p50 %u, p90 %u, p99 %u, max %u us", opcode,
+                   (unsigned long long) rtt->count, rtt->min, rtt->mean,
+                   rtt->p50, rtt->p90, rtt->p99, rtt->max);
+
+    daemon_log(LOG_INFO, "\tatt 0x%02x wait: %llu, min %u, mean %u, "
+               "p50 %u, p90 %u, p99 %u, max %u us", opcode,
+               (unsigned long long) wait->count, wait->min, wait->mean,
+               wait->p50, wait->p90, wait->p99, wait->max);
+}
+
+static void print_client(void *data, void *user_data) {
+    struct client *cli = data;
+    unsigned int *index = user_data;
+    char addr[18];
+    struct bt_att_pool_stats pool;
+    struct bt_att_read_stats reads;
+    struct bt_att_write_stats writes;
+
+    ba2str(&cli->dst, addr);
+    daemon_log(LOG_INFO, "%c %u\t%s\t%s\t%s", cli == console_cli ? '*' : ' ',
+               (*index)++, addr, cli->name, client_state_str(cli->state));
+
+    if (bt_att_get_pool_stats(cli->att, &pool))
+        daemon_log(LOG_INFO, "\tatt op pool: %llu hits, %llu misses, %u free",
+                   (unsigned long long) pool.hits,
+                   (unsigned long long) pool.misses, pool.free);
+
+    if (bt_att_get_read_stats(cli->att, &reads))
+        daemon_log(LOG_INFO, "\tatt reads: %llu PDUs in %llu wakeups",
+                   (unsigned long long) reads.pdus,
+                   (unsigned long long) reads.wakeups);
+
+    if (bt_att_get_write_stats(cli->att, &writes))
+        daemon_log(LOG_INFO, "\tatt writes: %llu PDUs in %llu batches, "
+                   "%llu syscalls, largest batch %u",
+                   (unsigned long long) writes.pdus,
+                   (unsigned long long) writes.batches,
+                   (unsigned long long) writes.syscalls, writes.max_batch);
+
+    bt_att_foreach_latency(cli->att, print_latency, NULL);
+}
+
+/**
+ * device command, list the devices or select the one the commands apply to
+ *
+ * @param cli		pointer to the client structure (not used)
+ * @param cmd_str	device command string
+ */
+static void cmd_device(__attribute__((unused)) struct client *cli, char *cmd_str) {
+    char *argv[2];
+    int argc = 0;
+    struct client *found;
+    unsigned int index = 0;
+
+    if (!parse_args(cmd_str, 1, argv, &argc)) {
+        printf("Usage: device [<index>|<name>]\n");
+        return;
+    }
+
+    if (!argc) {
+        queue_foreach(clients, print_client, &index);
+        return;
+    }
+
+    found = client_lookup(argv[0]);
+    if (!found) {
+        daemon_log(LOG_ERR, "Unknown device: %s", argv[0]);
+        return;
+    }
+
+    console_cli = found;
+    daemon_log(LOG_INFO, "Selected device %s", console_cli->name);
 }
 
 static void cmd_help(struct client *cli, char *cmd_str);
@@ -1841,6 +2466,7 @@ static struct {
     char *doc;
 } command[] = {
         {"help",              cmd_help,          "\tDisplay help message"},
+        {"device",            cmd_device,        "\tList devices or select one"},
         {"services",          cmd_services,      "\tShow discovered services"},
         {
          "read-value",        cmd_read_value,
@@ -1892,6 +2518,7 @@ static struct {
                                                  "\tGet RSSI value"
         },
         {"batt",              cmd_battery,       "\tGet battery value"},
+        {"frame",             cmd_frame,         "\tDump the last DL24 frame"},
 
         {"quit",              cmd_quit,          "\tQuit"},
         {}
@@ -1916,14 +2543,15 @@ static void cmd_help(__attribute__((unused)) struct client *cli, __attribute__((
  *
  * @param fd		stdin
  * @param events	epoll event
- * @param user_data pointer to client structure
+ * @param user_data not used, commands apply to console_cli
  */
-static void prompt_read_cb(__attribute__((unused)) int fd, uint32_t events, void *user_data) {
+static void prompt_read_cb(__attribute__((unused)) int fd, uint32_t events,
+                           __attribute__((unused)) void *user_data) {
     ssize_t read;
     size_t len = 0;
     char *line = NULL;
     char *cmd = NULL, *args;
-    struct client *cli = user_data;
+    struct client *cli = console_cli;
     int i;
 
     if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -1969,7 +2597,8 @@ static void prompt_read_cb(__attribute__((unused)) int fd, uint32_t events, void
 static bool terminate = false;
 
 /**
- * signal call back SIGINT and SIGTERM processing
+ * signal call back SIGINT and SIGTERM processing, SIGUSR1 dumps the ATT
+ * traces
  *
  * @param signum		SIGXXX
  * @param user_data		unused
@@ -1982,6 +2611,9 @@ static void signal_cb(int signum, __attribute__((unused)) void *user_data) {
             mainloop_exit_success();
             daemon_log(LOG_INFO, "Terminate: %d", terminate);
             break;
+        case SIGUSR1:
+            queue_foreach(clients, client_trace_dump, NULL);
+            break;
         default:
             break;
     }
@@ -1994,10 +2626,11 @@ static void signal_cb(int signum, __attribute__((unused)) void *user_data) {
  * @param dst	6 bytes BD Address destination address
  * @param dst_type  destination type BDADDR_LE_PUBLIC or BDADDR_LE_RANDOM
  * @param sec   security level BT_SECURITY_LOW or BT_SECURITY_MEDIUM or BT_SECURITY_HIGH
- * @return socket or -1 if error
+ * @return non blocking socket with the connect in progress or -1 if error,
+ *         completion is signalled by EPOLLOUT, result in SO_ERROR
  */
 static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
-                                int sec) {
+                                int sec, uint16_t psm) {
     int sock;
     struct sockaddr_l2 srcaddr, dstaddr;
     struct bt_security btsec;
@@ -2008,12 +2641,13 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
         ba2str(src, srcaddr_str);
         ba2str(dst, dstaddr_str);
 
-        daemon_log(LOG_INFO, "btgatt-client: Opening L2CAP LE connection on ATT "
+        daemon_log(LOG_INFO, "btgatt-client: Opening L2CAP LE connection on %s "
                              "channel:\n\t src: %s\n\tdest: %s",
-                   srcaddr_str, dstaddr_str);
+                   psm ? "EATT" : "ATT", srcaddr_str, dstaddr_str);
     }
 
-    sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+    sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  BTPROTO_L2CAP);
     if (sock < 0) {
         perror("Failed to create L2CAP socket");
         return -1;
@@ -2022,8 +2656,12 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
     /* Set up source address */
     memset(&srcaddr, 0, sizeof(srcaddr));
     srcaddr.l2_family = AF_BLUETOOTH;
-    srcaddr.l2_cid = htobs(ATT_CID);
-    srcaddr.l2_bdaddr_type = 0;
+    if (psm) {
+        srcaddr.l2_bdaddr_type = BDADDR_LE_PUBLIC;
+    } else {
+        srcaddr.l2_cid = htobs(ATT_CID);
+        srcaddr.l2_bdaddr_type = 0;
+    }
     bacpy(&srcaddr.l2_bdaddr, src);
 
     if (bind(sock, (struct sockaddr *) &srcaddr, sizeof(srcaddr)) < 0) {
@@ -2042,23 +2680,36 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
         return -1;
     }
 
+    /* EATT runs on enhanced credit based channels, kernel 5.7 or later */
+    if (psm) {
+        uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+        if (setsockopt(sock, SOL_BLUETOOTH, BT_MODE, &mode,
+                       sizeof(mode)) != 0) {
+            PRLOGE("Failed to set L2CAP enhanced credit based mode: %s",
+                   strerror(errno));
+            close(sock);
+            return -1;
+        }
+    }
+
     /* Set up destination address */
     memset(&dstaddr, 0, sizeof(dstaddr));
     dstaddr.l2_family = AF_BLUETOOTH;
-    dstaddr.l2_cid = htobs(ATT_CID);
+    if (psm)
+        dstaddr.l2_psm = htobs(psm);
+    else
+        dstaddr.l2_cid = htobs(ATT_CID);
     dstaddr.l2_bdaddr_type = dst_type;
     bacpy(&dstaddr.l2_bdaddr, dst);
 
-    daemon_log(LOG_INFO, "Connecting to device...");
-
-    if (connect(sock, (struct sockaddr *) &dstaddr, sizeof(dstaddr)) < 0) {
+    if (connect(sock, (struct sockaddr *) &dstaddr, sizeof(dstaddr)) < 0 &&
+        errno != EINPROGRESS) {
         perror(" Failed to connect");
         close(sock);
         return -1;
     }
 
-    daemon_log(LOG_INFO, "Connecting to device... Done");
-
     return sock;
 }
 
@@ -2079,6 +2730,376 @@ int get_l2cap_handle(int fd, uint16_t *hciHandle) {
     return 0;
 }
 
+/**
+ * abort a pending connect and go back to IDLE, the retry is scheduled
+ *
+ * @param cli	client pointer
+ * @param err	errno of the failure
+ */
+static void client_connect_failed(struct client *cli, int err) {
+    PRLOGE("%s: connection failed: %s", cli->name, strerror(err));
+
+    mainloop_remove_fd(cli->fd);
+    close(cli->fd);
+    cli->fd = -1;
+    cli->state = CLIENT_IDLE;
+
+    client_schedule_retry(cli);
+}
+
+/**
+ * pending connect call back, CONNECTING -> CONNECTED or back to IDLE
+ *
+ * @param fd		l2cap socket
+ * @param events	epoll events
+ * @param user_data	client pointer
+ */
+static void client_connect_io_cb(int fd, __attribute__((unused)) uint32_t events, void *user_data) {
+    struct client *cli = user_data;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    if (err) {
+        client_connect_failed(cli, err);
+        return;
+    }
+
+    daemon_log(LOG_INFO, "%s: connecting to device... Done", cli->name);
+
+    mainloop_remove_fd(fd);
+
+    /* bt_att owns the socket from now on, it stays nonblocking */
+    if (!client_attach(cli, fd, att_mtu)) {
+        cli->state = CLIENT_IDLE;
+        client_schedule_retry(cli);
+        return;
+    }
+
+    /* connected, the next retry adds a new timer */
+    if (cli->connect_timer != -1)
+        mainloop_remove_timeout(cli->connect_timer);
+
+    get_l2cap_handle(cli->fd, &cli->hci_handle);
+}
+
+/**
+ * connect timer call back
+ * IDLE: start a non blocking connect -> CONNECTING
+ * CONNECTING: the connect timed out -> IDLE
+ *
+ * @param id		timer id
+ * @param user_data	client pointer
+ */
+static void client_connect_cb(int id, void *user_data) {
+    struct client *cli = user_data;
+    int fd;
+
+    switch (cli->state) {
+        case CLIENT_IDLE:
+            break;
+        case CLIENT_CONNECTING:
+            client_connect_failed(cli, ETIMEDOUT);
+            return;
+        default:
+            return;
+    }
+
+    daemon_log(LOG_INFO, "%s: connecting to device...", cli->name);
+
+    fd = l2cap_le_att_connect(&src_addr, &cli->dst, cli->dst_type, sec_level, 0);
+    if (fd < 0) {
+        client_schedule_retry(cli);
+        return;
+    }
+
+    if (mainloop_add_fd(fd, EPOLLOUT, client_connect_io_cb, cli, NULL) < 0) {
+        PRLOGE("%s: failed to watch connect", cli->name);
+        close(fd);
+        client_schedule_retry(cli);
+        return;
+    }
+
+    cli->fd = fd;
+    cli->state = CLIENT_CONNECTING;
+    mainloop_modify_timeout(id, CLIENT_CONNECT_TIMEOUT);
+}
+
+static void client_connect_destroy(void *user_data) {
+    struct client *cli = user_data;
+
+    cli->connect_timer = -1;
+}
+
+/**
+ * connect completion of an EATT socket, the bearer joins the bt_att of the
+ * client, a failure leaves the client on the bearers it has
+ *
+ * @param fd		EATT socket
+ * @param events	epoll events (not used)
+ * @param user_data	client pointer
+ */
+static void client_eatt_io_cb(int fd, __attribute__((unused)) uint32_t events, void *user_data) {
+    struct client *cli = user_data;
+    socklen_t len = sizeof(int);
+    int err = 0, i;
+
+    for (i = 0; i < CLIENT_EATT_CHANNELS_MAX; i++) {
+        if (cli->eatt_fd[i] == fd)
+            cli->eatt_fd[i] = -1;
+    }
+
+    mainloop_remove_fd(fd);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+    if (!err)
+        err = -bt_att_attach_fd(cli->att, fd);
+
+    if (err) {
+        daemon_log(LOG_ERR, "%s: EATT bearer failed: %s", cli->name,
+                   strerror(err));
+        close(fd);
+        return;
+    }
+
+    daemon_log(LOG_INFO, "%s: EATT bearer up, %d ATT bearers", cli->name,
+               bt_att_get_channels(cli->att));
+}
+
+/**
+ * open the EATT bearers of a client, nonblocking connects completed by
+ * client_eatt_io_cb
+ *
+ * @param cli	ready client
+ */
+static void client_eatt_connect(struct client *cli) {
+    int sec, fd, i;
+
+    /* the server wants an encrypted link on EATT */
+    sec = sec_level > BT_SECURITY_MEDIUM ? sec_level : BT_SECURITY_MEDIUM;
+
+    for (i = 0; i < eatt_channels; i++) {
+        fd = l2cap_le_att_connect(&src_addr, &cli->dst, cli->dst_type, sec,
+                                  BT_ATT_EATT_PSM);
+        if (fd < 0)
+            break;
+
+        if (mainloop_add_fd(fd, EPOLLOUT, client_eatt_io_cb, cli, NULL) < 0) {
+            close(fd);
+            break;
+        }
+
+        cli->eatt_fd[i] = fd;
+    }
+
+    if (!i)
+        daemon_log(LOG_INFO, "%s: EATT not available, single ATT bearer",
+                   cli->name);
+}
+
+static void client_feat_write_cb(bool success, uint8_t att_ecode,
+                                 void *user_data) {
+    struct client *cli = user_data;
+
+    if (!success) {
+        daemon_log(LOG_INFO, "%s: EATT not enabled (0x%02x), single ATT "
+                             "bearer", cli->name, att_ecode);
+        return;
+    }
+
+    client_eatt_connect(cli);
+}
+
+static void server_feat_read_cb(bool success, __attribute__((unused)) uint8_t att_ecode,
+                                const uint8_t *value, uint16_t length,
+                                void *user_data) {
+    struct client *cli = user_data;
+    uint8_t feat = BT_GATT_CHRC_CLI_FEAT_EATT;
+    uint16_t handle = 0;
+    bt_uuid_t uuid;
+
+    if (!success || !length || !(value[0] & BT_GATT_CHRC_SERVER_FEAT_EATT)) {
+        daemon_log(LOG_INFO, "%s: no EATT on the server, single ATT bearer",
+                   cli->name);
+        return;
+    }
+
+    /* the client declares EATT before opening the bearers */
+    bt_uuid16_create(&uuid, GATT_CHARAC_CLI_FEAT);
+    gatt_db_find_by_type(cli->db, 0x0001, 0xffff, &uuid, find_handle_cb,
+                         &handle);
+
+    if (!handle || !bt_gatt_client_write_value(cli->gatt, handle, &feat,
+                                               sizeof(feat),
+                                               client_feat_write_cb, cli,
+                                               NULL))
+        daemon_log(LOG_INFO, "%s: no Client Supported Features, single "
+                             "ATT bearer", cli->name);
+}
+
+/**
+ * look for EATT support once a client is ready, requests are spread over
+ * the extra bearers when the server has it, the fixed channel carries
+ * everything otherwise
+ *
+ * @param cli	ready client
+ */
+static void client_eatt_start(struct client *cli) {
+    uint16_t handle = 0;
+    bt_uuid_t uuid;
+    int i;
+
+    if (!eatt_channels || bt_att_get_channels(cli->att) > 1)
+        return;
+
+    for (i = 0; i < CLIENT_EATT_CHANNELS_MAX; i++) {
+        if (cli->eatt_fd[i] >= 0)
+            return;
+    }
+
+    bt_uuid16_create(&uuid, GATT_CHARAC_SERVER_FEAT);
+    gatt_db_find_by_type(cli->db, 0x0001, 0xffff, &uuid, find_handle_cb,
+                         &handle);
+
+    if (!handle || !bt_gatt_client_read_value(cli->gatt, handle,
+                                              server_feat_read_cb, cli, NULL))
+        daemon_log(LOG_INFO, "%s: no EATT on the server, single ATT bearer",
+                   cli->name);
+}
+
+/**
+ * (re)arm the connect timer of a client
+ *
+ * @param cli	client pointer
+ * @param msec	delay
+ */
+static void client_schedule_connect(struct client *cli, unsigned int msec) {
+    if (cli->connect_timer != -1) {
+        mainloop_modify_timeout(cli->connect_timer, msec);
+        return;
+    }
+
+    cli->connect_timer = mainloop_add_timeout(msec, client_connect_cb, cli,
+                                              client_connect_destroy);
+    if (cli->connect_timer < 0) {
+        PRLOGE("%s: failed to create connect timer", cli->name);
+        cli->connect_timer = -1;
+    }
+}
+
+/**
+ * schedule the next connect with exponential backoff, the delay is drawn
+ * from [backoff / 2, backoff] so that meters lost together do not retry
+ * in lockstep
+ *
+ * @param cli	client pointer
+ */
+static void client_schedule_retry(struct client *cli) {
+    unsigned int delay;
+
+    if (!cli->backoff)
+        cli->backoff = CLIENT_BACKOFF_MIN;
+    else if (cli->backoff < CLIENT_BACKOFF_MAX / 2)
+        cli->backoff *= 2;
+    else
+        cli->backoff = CLIENT_BACKOFF_MAX;
+
+    delay = cli->backoff / 2 + (unsigned int) random() % (cli->backoff / 2 + 1);
+
+    daemon_log(LOG_INFO, "%s: reconnect in %u.%03u s (backoff %u ms)",
+               cli->name, delay / 1000, delay % 1000, cli->backoff);
+    client_schedule_connect(cli, delay);
+}
+
+static void client_register_mqtt(void *data, __attribute__((unused)) void *user_data) {
+    struct client *cli = data;
+
+    cli->mqtt_device = mosq_add_device(cli->name);
+    if (cli->mqtt_device < 0)
+        PRLOGE("%s: failed to register MQTT device", cli->name);
+}
+
+static void client_start(void *data, __attribute__((unused)) void *user_data) {
+    client_schedule_connect(data, CLIENT_CONNECT_DELAY);
+}
+
+/**
+ * parse a -d argument <addr>[=<name>] and add the device
+ *
+ * @param arg		option argument
+ * @param dst_type	BDADDR_LE_PUBLIC or BDADDR_LE_RANDOM
+ * @return true on success
+ */
+static bool add_device(char *arg, uint8_t dst_type) {
+    struct client *cli;
+    char *name;
+    bdaddr_t dst;
+
+    name = strchr(arg, '=');
+    if (name)
+        *name++ = '\0';
+
+    if (str2ba(arg, &dst) < 0) {
+        PRLOGE("Invalid remote address: %s", arg);
+        return false;
+    }
+
+    if (name && (!*name || strpbrk(name, "/+#"))) {
+        PRLOGE("Invalid device name: %s", name);
+        return false;
+    }
+
+    cli = client_new(&dst, dst_type, name);
+    if (!cli)
+        return false;
+
+    if (!queue_push_tail(clients, cli)) {
+        free(cli);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * parse a -S argument, comma separated service UUIDs
+ *
+ * @param arg	option argument
+ * @return true on success
+ */
+static bool parse_service_filter(char *arg) {
+    char *uuid, *save;
+
+    service_filter_count = 0;
+
+    for (uuid = strtok_r(arg, ",", &save); uuid;
+         uuid = strtok_r(NULL, ",", &save)) {
+        if (service_filter_count == CLIENT_SERVICES_MAX) {
+            PRLOGE("At most %d services may be listed", CLIENT_SERVICES_MAX);
+            return false;
+        }
+
+        if (bt_string_to_uuid(&service_filter[service_filter_count],
+                              uuid) < 0) {
+            PRLOGE("Invalid service UUID: %s", uuid);
+            return false;
+        }
+
+        service_filter_count++;
+    }
+
+    if (!service_filter_count) {
+        PRLOGE("No service UUID given");
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * print usage
  */
@@ -2088,16 +3109,28 @@ static void usage(void) {
 
     printf("Options:\n"
            "\t-i, --index <id>\t\tSpecify adapter index, e.g. hci0\n"
-           "\t-d, --dest <addr>\t\tSpecify the destination address\n"
+           "\t-d, --dest <addr>[=<name>]\tAdd a destination, may be repeated,\n"
+           "\t\t\t\t\tthe name is used in the MQTT topic\n"
            "\t-t, --type [random|public] \tSpecify the LE address type\n"
            "\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
            "\t-s, --security-level <sec> \tSet security level (low|"
            "medium|high)\n"
+           "\t-C, --cache <dir>\t\tKeep discovered services in <dir>,\n"
+           "\t\t\t\t\tone file per device address\n"
+           "\t-T, --trace <dir>\t\tWrite the ATT traces to <dir> on\n"
+           "\t\t\t\t\tdisconnect and SIGUSR1 (/tmp)\n"
+           "\t-e, --eatt <n>\t\t\tEATT bearers opened when the device\n"
+           "\t\t\t\t\tsupports it, 0 to 5 (2)\n"
+           "\t-S, --services <uuid,...>\tDiscover only these services,\n"
+           "\t\t\t\t\te.g. ffe0,180f (all)\n"
            "\t-v, --verbose\t\t\tEnable extra logging\n"
+           "\t-E\t\t\t\tRun MQTT on the event loop, no thread\n"
            "\t-h, --help\t\t\tDisplay help\n");
 
     printf("Example:\n"
-           "btgattclient -v -d C4:BE:84:70:29:04\n");
+           "btgattclient -v -d C4:BE:84:70:29:04\n"
+           "btgattclient -d C4:BE:84:70:29:04=load1 -d C4:BE:84:70:29:05=load2\n"
+           "btgattclient -S ffe0,180f -d C4:BE:84:70:29:04\n");
 }
 
 static struct option main_options[] = {
@@ -2106,6 +3139,10 @@ static struct option main_options[] = {
         {"type",           1, 0, 't'},
         {"mtu",            1, 0, 'm'},
         {"security-level", 1, 0, 's'},
+        {"cache",          1, 0, 'C'},
+        {"trace",          1, 0, 'T'},
+        {"eatt",           1, 0, 'e'},
+        {"services",       1, 0, 'S'},
         {"verbose",        0, 0, 'v'},
         {"help",           0, 0, 'h'},
         {}
@@ -2123,31 +3160,51 @@ extern char *hostname;
 
 int main(int argc, char *argv[]) {
     int opt;
-    int sec = BT_SECURITY_LOW;
-    uint16_t mtu = 0;
     uint8_t dst_type = BDADDR_LE_PUBLIC;
-    bool dst_addr_given = false;
-    bdaddr_t src_addr, dst_addr;
+    char **dests = NULL;
+    int dests_count = 0;
     int dev_id = -1;
-    int fd;
     sigset_t mask;
-    struct client *cli = NULL;
+    int i;
 
     daemon_log_upto(LOG_INFO);
 
-    while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:cH:D",
+    dests = alloca(argc * sizeof(*dests));
+
+    while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:cH:DEC:T:e:S:",
                               main_options, NULL)) != -1) {
         switch (opt) {
             case 'D':
                 daemon_log(LOG_INFO, "Disable mqtt");
                 disable_mqtt = true;
                 break;
+            case 'E':
+                mqtt_mainloop = true;
+                break;
             case 'H':
                 hostname = optarg;
                 break;
             case 'c':
                 disable_console = true;
                 break;
+            case 'C':
+                cache_dir = optarg;
+                break;
+            case 'T':
+                trace_dir = optarg;
+                break;
+            case 'e':
+                eatt_channels = atoi(optarg);
+                if (eatt_channels < 0 ||
+                    eatt_channels > CLIENT_EATT_CHANNELS_MAX) {
+                    PRLOGE("Invalid EATT bearer count: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                if (!parse_service_filter(optarg))
+                    return EXIT_FAILURE;
+                break;
             case 'h':
                 usage();
                 return EXIT_SUCCESS;
@@ -2156,11 +3213,11 @@ int main(int argc, char *argv[]) {
                 break;
             case 's':
                 if (strcmp(optarg, "low") == 0)
-                    sec = BT_SECURITY_LOW;
+                    sec_level = BT_SECURITY_LOW;
                 else if (strcmp(optarg, "medium") == 0)
-                    sec = BT_SECURITY_MEDIUM;
+                    sec_level = BT_SECURITY_MEDIUM;
                 else if (strcmp(optarg, "high") == 0)
-                    sec = BT_SECURITY_HIGH;
+                    sec_level = BT_SECURITY_HIGH;
                 else {
                     PRLOGE("Invalid security level");
                     return EXIT_FAILURE;
@@ -2180,7 +3237,7 @@ int main(int argc, char *argv[]) {
                     return EXIT_FAILURE;
                 }
 
-                mtu = (uint16_t) arg;
+                att_mtu = (uint16_t) arg;
                 break;
             }
             case 't':
@@ -2195,13 +3252,8 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'd':
-                if (str2ba(optarg, &dst_addr) < 0) {
-                    PRLOGE("Invalid remote address: %s",
-                           optarg);
-                    return EXIT_FAILURE;
-                }
-
-                dst_addr_given = true;
+                /* added once -t is known */
+                dests[dests_count++] = optarg;
                 break;
 
             case 'i':
@@ -2239,80 +3291,81 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    if (!dst_addr_given) {
+    if (!dests_count) {
         PRLOGE("Destination address required!");
         return EXIT_FAILURE;
     }
+
+    srandom((unsigned int) time(NULL) ^ (unsigned int) getpid());
+
+    clients = queue_new();
+    for (i = 0; i < dests_count; i++) {
+        if (!add_device(dests[i], dst_type)) {
+            queue_destroy(clients, free);
+            return EXIT_FAILURE;
+        }
+    }
+    console_cli = queue_peek_head(clients);
+
     if (!disable_mqtt) {
-        mosq_init("gatt");
+        queue_foreach(clients, client_register_mqtt, NULL);
+        mosq_init("gatt", mqtt_mainloop);
     }
-    /* create the mainloop resources */
 
-    while (!terminate) {
-        mainloop_init();
+    /* create the mainloop resources, one loop serves every device */
+    mainloop_init();
 
-        while (true) {
-            fd = l2cap_le_att_connect(&src_addr, &dst_addr, dst_type, sec);
-            if (fd >= 0)
-                break;
-            PRLOGE("Connection failed, try again...");
-            sleep(5);
-        }
+    if (!disable_mqtt) {
+        mosq_attach();
+    }
 
-        cli = client_create(fd, mtu);
-        if (!cli) {
-            close(fd);
+    hci_dev = bt_hci_open(dev_id >= 0 ? dev_id : hci_get_route(NULL));
+    if (!hci_dev)
+        PRLOGE("Failed to open HCI device, RSSI is not available");
+
+    queue_foreach(clients, client_start, NULL);
+
+    /* add input event from console */
+    if (!disable_console) {
+        if (mainloop_add_fd(fileno(stdin),
+                            EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
+                            prompt_read_cb, NULL, NULL) < 0) {
+            PRLOGE("Failed to initialize console");
             return EXIT_FAILURE;
         }
-        cli->hci_socket = hci_open_dev(hci_get_route(NULL));
-        get_l2cap_handle(cli->fd, &cli->hci_handle);
-        /* add input event from console */
-        if (!disable_console) {
-            if (mainloop_add_fd(fileno(stdin),
-                                EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
-                                prompt_read_cb, cli, NULL) < 0) {
-                PRLOGE("Failed to initialize console");
-                return EXIT_FAILURE;
-            }
-        }
+    }
 
-        sigemptyset(&mask);
-        sigaddset(&mask, SIGINT);
-        sigaddset(&mask, SIGTERM);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
 
-        /* add handler for process interrupted (SIGINT) or terminated (SIGTERM)*/
-        mainloop_set_signal(&mask, signal_cb, NULL, NULL);
+    /* add handler for process interrupted (SIGINT) or terminated (SIGTERM)*/
+    mainloop_set_signal(&mask, signal_cb, NULL, NULL);
 
-        print_prompt();
+    print_prompt();
 
-        /* epoll main loop call
-         *
-         * any further process is an epoll event processed in mainloop_run
-         *
-         */
-        if (mainloop_run() == EXIT_SUCCESS) {
-            daemon_log(LOG_INFO, "Main loop terminated with success");
-            if (!terminate) {
-                sleep(5);
-            }
-        }
-        hci_close_dev(cli->hci_socket);
-        if (batt_timer_fd != -1) {
-            mainloop_remove_timeout(batt_timer_fd);
-            batt_timer_fd = -1;
-        }
-        if (rssi_timer_fd != -1) {
-            mainloop_remove_timeout(rssi_timer_fd);
-            rssi_timer_fd = -1;
-        }
+    /* epoll main loop call
+     *
+     * any further process is an epoll event processed in mainloop_run
+     *
+     */
+    if (mainloop_run() == EXIT_SUCCESS) {
+        daemon_log(LOG_INFO, "Main loop terminated with success");
     }
+
     daemon_log(LOG_INFO, "Shutting down...");
 
-    client_destroy(cli);
+    queue_destroy(clients, client_destroy);
+    clients = NULL;
+    console_cli = NULL;
+
+    bt_hci_unref(hci_dev);
+    hci_dev = NULL;
 
     if (!disable_mqtt) {
         mosq_destroy();
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
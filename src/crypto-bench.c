@@ -0,0 +1,179 @@
+/**
+ * @file crypto-bench.c
+ * @brief AES and CMAC self test and signing benchmark
+ *
+ * Every AES block implementation this CPU can run, and the kernel AF_ALG
+ * path when the kernel has it, first goes through the FIPS-197 and
+ * RFC 4493 vectors of bt_crypto_selftest(), then signs ATT PDUs for a
+ * while: with a key schedule kept by the caller, the way a bearer signs,
+ * and with a fresh key every time.
+ *
+ * usage: crypto-bench [-t ms per run] [-l PDU length]
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crypto.h"
+
+/* the clock is read once per batch of signatures */
+#define BENCH_BATCH 256
+
+static const uint8_t bench_key[16] = {
+    0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
+    0xa6, 0xd2, 0xae, 0x28, 0x16, 0x15, 0x7e, 0x2b
+};
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * sign PDUs for a while
+ *
+ * @param crypto	crypto structure, userspace or AF_ALG
+ * @param cached	true to keep the key schedule, false to redo it per PDU
+ * @param pdu		PDU to sign
+ * @param len		PDU length
+ * @param ms		run time
+ * @return signatures per second, negative on a signing failure
+ */
+static double bench_sign(struct bt_crypto * crypto, bool cached,
+                         const uint8_t * pdu, uint16_t len, unsigned int ms) {
+    struct bt_crypto_key key;
+    uint8_t signature[12];
+    double start, end, elapsed;
+    uint32_t count = 0;
+    unsigned int i;
+    bool ok;
+
+    bt_crypto_key_init(&key, bench_key);
+
+    start = now_s();
+    end = start + ms / 1000.0;
+
+    do {
+        for (i = 0; i < BENCH_BATCH; i++, count++) {
+            if (cached)
+                ok = bt_crypto_sign_att_key(crypto, &key, pdu, len, count,
+                                            signature);
+            else
+                ok = bt_crypto_sign_att(crypto, bench_key, pdu, len, count,
+                                        signature);
+
+            if (!ok)
+                return -1;
+        }
+
+        elapsed = now_s();
+    } while (elapsed < end);
+
+    return count / (elapsed - start);
+}
+
+/**
+ * self test and benchmark of the path crypto is set to
+ *
+ * @return 0 success, 1 failure
+ */
+static int bench_run(struct bt_crypto * crypto, const char * name,
+                     const uint8_t * pdu, uint16_t len, unsigned int ms) {
+    double cached, fresh;
+    bool ok;
+
+    ok = bt_crypto_selftest(crypto);
+    cached = bench_sign(crypto, true, pdu, len, ms);
+    fresh = bench_sign(crypto, false, pdu, len, ms);
+
+    printf("%-10s %-6s %12.0f %12.0f\n", name, ok ? "ok" : "FAILED",
+           cached, fresh);
+
+    return !ok || cached < 0 || fresh < 0;
+}
+
+static void usage(void) {
+    printf("crypto-bench\n"
+           "Usage:\n\tcrypto-bench [options]\n"
+           "Options:\n"
+           "\t-t, --time <ms>\t\tRun time of every benchmark (500)\n"
+           "\t-l, --length <bytes>\tLength of the signed PDU (20)\n"
+           "\t-h, --help\t\tDisplay help\n");
+}
+
+static const struct option main_options[] = {
+    { "time", 1, 0, 't' },
+    { "length", 1, 0, 'l' },
+    { "help", 0, 0, 'h' },
+    { }
+};
+
+int main(int argc, char * argv[]) {
+    struct bt_crypto * crypto;
+    unsigned int ms = 500, i;
+    uint8_t pdu[512];
+    uint16_t len = 20;
+    const char * name;
+    int opt, failed = 0;
+
+    while ((opt = getopt_long(argc, argv, "t:l:h", main_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            len = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!ms || len > sizeof(pdu)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < len; i++)
+        pdu[i] = i;
+
+    crypto = bt_crypto_new();
+    if (!crypto) {
+        fprintf(stderr, "Failed to open the crypto context\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%u byte PDU, %u ms per run\n", len, ms);
+    printf("%-10s %-6s %12s %12s\n", "path", "vector", "sign/s", "new key/s");
+
+    for (i = 0; (name = bt_crypto_aes_impl_name(i)); i++) {
+        bt_crypto_set_aes_impl(name);
+        failed |= bench_run(crypto, name, pdu, len, ms);
+    }
+
+    if (bt_crypto_set_af_alg(crypto, true))
+        failed |= bench_run(crypto, "af_alg", pdu, len, ms);
+    else
+        printf("%-10s not available\n", "af_alg");
+
+    bt_crypto_unref(crypto);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -39,6 +39,14 @@
 #include <string.h>
 #include <sys/socket.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define CRYPTO_AES_NI
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#define CRYPTO_AES_ARMV8
+#endif
+
 #include "util.h"
 #include "crypto.h"
 
@@ -89,8 +97,56 @@ struct bt_crypto {
     int ecb_aes;
     int urandom;
     int cmac_aes;
+    /// true, AES and CMAC go through the kernel AF_ALG sockets
+    bool af_alg;
+};
+
+typedef void (*aes_encrypt_func_t)(const uint8_t rk[BT_CRYPTO_AES_RK_SIZE],
+                                   const uint8_t in[16], uint8_t out[16]);
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+    0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+    0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+    0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+    0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+    0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+    0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+    0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+    0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+    0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+    0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+    0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
 };
 
+/* SubBytes and MixColumns of one byte, column 0, built from the sbox */
+static uint32_t aes_te[256];
+
+static aes_encrypt_func_t aes_encrypt_block;
+static const char * aes_impl_name;
+
+static void aes_setup(void);
+
 /**
  * open the pseudo random os generator, returns the associated file descriptor
  *
@@ -159,30 +215,40 @@ struct bt_crypto * bt_crypto_new(void) {
     if (!crypto)
         return NULL;
 
-    crypto->ecb_aes = ecb_aes_setup();
-    if (crypto->ecb_aes < 0) {
-        free(crypto);
-        return NULL;
-    }
-
     crypto->urandom = urandom_setup();
     if (crypto->urandom < 0) {
-        close(crypto->ecb_aes);
         free(crypto);
         return NULL;
     }
 
+    /* AF_ALG is optional now, AES and CMAC run in userspace by default */
+    crypto->ecb_aes = ecb_aes_setup();
     crypto->cmac_aes = cmac_aes_setup();
-    if (crypto->cmac_aes < 0) {
-        close(crypto->urandom);
-        close(crypto->ecb_aes);
-        free(crypto);
-        return NULL;
-    }
+
+    aes_setup();
 
     return bt_crypto_ref(crypto);
 }
 
+/**
+ * run AES and CMAC through the kernel AF_ALG sockets instead of userspace
+ *
+ * @param crypto	crypto structure
+ * @param enable	true for AF_ALG, false for userspace
+ * @return			false if AF_ALG is not available
+ */
+bool bt_crypto_set_af_alg(struct bt_crypto * crypto, bool enable) {
+    if (!crypto)
+        return false;
+
+    if (enable && (crypto->ecb_aes < 0 || crypto->cmac_aes < 0))
+        return false;
+
+    crypto->af_alg = enable;
+
+    return true;
+}
+
 struct bt_crypto * bt_crypto_ref(struct bt_crypto * crypto) {
     if (!crypto)
         return NULL;
@@ -200,8 +266,10 @@ void bt_crypto_unref(struct bt_crypto * crypto) {
         return;
 
     close(crypto->urandom);
-    close(crypto->ecb_aes);
-    close(crypto->cmac_aes);
+    if (crypto->ecb_aes >= 0)
+        close(crypto->ecb_aes);
+    if (crypto->cmac_aes >= 0)
+        close(crypto->cmac_aes);
 
     free(crypto);
 }
@@ -273,48 +341,384 @@ static inline void swap_buf(const uint8_t * src, uint8_t * dst, uint16_t len) {
         dst[len - 1 - i] = src[i];
 }
 
-bool bt_crypto_sign_att(struct bt_crypto * crypto, const uint8_t key[16],
-                        const uint8_t * m, uint16_t m_len,
-                        uint32_t sign_cnt, uint8_t signature[12]) {
+static inline uint8_t aes_xtime(uint8_t x) {
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+static inline uint32_t aes_ror(uint32_t x, unsigned int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * AES-128 key expansion (FIPS-197 5.2), round keys kept as bytes so that
+ * every implementation can load them as they are
+ *
+ * @param key	cipher key, most significant octet first
+ * @param rk	returned round keys
+ */
+static void aes_expand_key(const uint8_t key[16],
+                           uint8_t rk[BT_CRYPTO_AES_RK_SIZE]) {
+    uint8_t rcon = 0x01, t[4];
+    int i, j;
+
+    memcpy(rk, key, 16);
+
+    for (i = 16; i < BT_CRYPTO_AES_RK_SIZE; i += 4) {
+        memcpy(t, rk + i - 4, 4);
+
+        if (!(i % 16)) {
+            uint8_t t0 = t[0];
+
+            t[0] = aes_sbox[t[1]] ^ rcon;
+            t[1] = aes_sbox[t[2]];
+            t[2] = aes_sbox[t[3]];
+            t[3] = aes_sbox[t0];
+            rcon = aes_xtime(rcon);
+        }
+
+        for (j = 0; j < 4; j++)
+            rk[i + j] = rk[i - 16 + j] ^ t[j];
+    }
+}
+
+/**
+ * portable AES-128 block encryption, one 1 KiB table and rotations
+ *
+ * @param rk	round keys from aes_expand_key()
+ * @param in	plain block
+ * @param out	encrypted block, may be in
+ */
+static void aes_encrypt_table(const uint8_t rk[BT_CRYPTO_AES_RK_SIZE],
+                              const uint8_t in[16], uint8_t out[16]) {
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int r;
+
+    s0 = get_be32(in) ^ get_be32(rk);
+    s1 = get_be32(in + 4) ^ get_be32(rk + 4);
+    s2 = get_be32(in + 8) ^ get_be32(rk + 8);
+    s3 = get_be32(in + 12) ^ get_be32(rk + 12);
+
+    for (r = 1; r < 10; r++) {
+        rk += 16;
+
+        t0 = aes_te[s0 >> 24] ^ aes_ror(aes_te[(s1 >> 16) & 0xff], 8) ^
+             aes_ror(aes_te[(s2 >> 8) & 0xff], 16) ^
+             aes_ror(aes_te[s3 & 0xff], 24) ^ get_be32(rk);
+        t1 = aes_te[s1 >> 24] ^ aes_ror(aes_te[(s2 >> 16) & 0xff], 8) ^
+             aes_ror(aes_te[(s3 >> 8) & 0xff], 16) ^
+             aes_ror(aes_te[s0 & 0xff], 24) ^ get_be32(rk + 4);
+        t2 = aes_te[s2 >> 24] ^ aes_ror(aes_te[(s3 >> 16) & 0xff], 8) ^
+             aes_ror(aes_te[(s0 >> 8) & 0xff], 16) ^
+             aes_ror(aes_te[s1 & 0xff], 24) ^ get_be32(rk + 8);
+        t3 = aes_te[s3 >> 24] ^ aes_ror(aes_te[(s0 >> 16) & 0xff], 8) ^
+             aes_ror(aes_te[(s1 >> 8) & 0xff], 16) ^
+             aes_ror(aes_te[s2 & 0xff], 24) ^ get_be32(rk + 12);
+
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    rk += 16;
+
+    /* last round has no MixColumns */
+    t0 = ((uint32_t) aes_sbox[s0 >> 24] << 24) |
+         ((uint32_t) aes_sbox[(s1 >> 16) & 0xff] << 16) |
+         ((uint32_t) aes_sbox[(s2 >> 8) & 0xff] << 8) | aes_sbox[s3 & 0xff];
+    t1 = ((uint32_t) aes_sbox[s1 >> 24] << 24) |
+         ((uint32_t) aes_sbox[(s2 >> 16) & 0xff] << 16) |
+         ((uint32_t) aes_sbox[(s3 >> 8) & 0xff] << 8) | aes_sbox[s0 & 0xff];
+    t2 = ((uint32_t) aes_sbox[s2 >> 24] << 24) |
+         ((uint32_t) aes_sbox[(s3 >> 16) & 0xff] << 16) |
+         ((uint32_t) aes_sbox[(s0 >> 8) & 0xff] << 8) | aes_sbox[s1 & 0xff];
+    t3 = ((uint32_t) aes_sbox[s3 >> 24] << 24) |
+         ((uint32_t) aes_sbox[(s0 >> 16) & 0xff] << 16) |
+         ((uint32_t) aes_sbox[(s1 >> 8) & 0xff] << 8) | aes_sbox[s2 & 0xff];
+
+    put_be32(t0 ^ get_be32(rk), out);
+    put_be32(t1 ^ get_be32(rk + 4), out + 4);
+    put_be32(t2 ^ get_be32(rk + 8), out + 8);
+    put_be32(t3 ^ get_be32(rk + 12), out + 12);
+}
+
+#ifdef CRYPTO_AES_NI
+__attribute__((target("aes,sse2")))
+static void aes_encrypt_ni(const uint8_t rk[BT_CRYPTO_AES_RK_SIZE],
+                           const uint8_t in[16], uint8_t out[16]) {
+    __m128i s;
+    int r;
+
+    s = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in),
+                      _mm_loadu_si128((const __m128i *) rk));
+
+    for (r = 1; r < 10; r++)
+        s = _mm_aesenc_si128(s, _mm_loadu_si128((const __m128i *)
+                                                (rk + 16 * r)));
+
+    s = _mm_aesenclast_si128(s, _mm_loadu_si128((const __m128i *)
+                                                 (rk + 160)));
+
+    _mm_storeu_si128((__m128i *) out, s);
+}
+#endif
+
+#ifdef CRYPTO_AES_ARMV8
+static void aes_encrypt_armv8(const uint8_t rk[BT_CRYPTO_AES_RK_SIZE],
+                              const uint8_t in[16], uint8_t out[16]) {
+    uint8x16_t s = vld1q_u8(in);
+    int r;
+
+    /* AESE does AddRoundKey first, so the last key is a plain xor */
+    for (r = 0; r < 9; r++)
+        s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(rk + 16 * r)));
+
+    s = vaeseq_u8(s, vld1q_u8(rk + 144));
+    s = veorq_u8(s, vld1q_u8(rk + 160));
+
+    vst1q_u8(out, s);
+}
+#endif
+
+static const struct {
+    const char * name;
+    aes_encrypt_func_t encrypt;
+} aes_impls[] = {
+    { "table", aes_encrypt_table },
+#ifdef CRYPTO_AES_NI
+    { "aes-ni", aes_encrypt_ni },
+#endif
+#ifdef CRYPTO_AES_ARMV8
+    { "armv8-ce", aes_encrypt_armv8 },
+#endif
+};
+
+#define AES_IMPLS (sizeof(aes_impls) / sizeof(aes_impls[0]))
+
+static bool aes_impl_supported(unsigned int idx) {
+#ifdef CRYPTO_AES_NI
+    if (aes_impls[idx].encrypt == aes_encrypt_ni) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("aes");
+    }
+#endif
+
+    return idx < AES_IMPLS;
+}
+
+/**
+ * pick the fastest AES block function of this CPU, build the table once
+ */
+static void aes_setup(void) {
+    unsigned int i;
+
+    if (aes_encrypt_block)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        uint8_t s = aes_sbox[i], s2 = aes_xtime(s);
+
+        aes_te[i] = ((uint32_t) s2 << 24) | ((uint32_t) s << 16) |
+                    ((uint32_t) s << 8) | (uint8_t)(s2 ^ s);
+    }
+
+    /* the table is first, the CPU instructions after it */
+    for (i = AES_IMPLS; i-- > 0;) {
+        if (aes_impl_supported(i))
+            break;
+    }
+
+    aes_encrypt_block = aes_impls[i].encrypt;
+    aes_impl_name = aes_impls[i].name;
+}
+
+const char * bt_crypto_aes_impl(void) {
+    aes_setup();
+
+    return aes_impl_name;
+}
+
+/**
+ * name of an AES block implementation this CPU can run
+ *
+ * @param idx	0 for the table, then the CPU instructions
+ * @return		implementation name, NULL past the last one
+ */
+const char * bt_crypto_aes_impl_name(unsigned int idx) {
+    unsigned int i;
+
+    for (i = 0; i < AES_IMPLS; i++) {
+        if (aes_impl_supported(i) && !idx--)
+            return aes_impls[i].name;
+    }
+
+    return NULL;
+}
+
+/**
+ * force the AES block implementation of the userspace AES and CMAC, for
+ * tests and benchmarks. Key schedules are the same for all of them.
+ *
+ * @param name	name from bt_crypto_aes_impl_name()
+ * @return		false if unknown or not supported by this CPU
+ */
+bool bt_crypto_set_aes_impl(const char * name) {
+    unsigned int i;
+
+    aes_setup();
+
+    for (i = 0; i < AES_IMPLS; i++) {
+        if (!strcmp(aes_impls[i].name, name) && aes_impl_supported(i)) {
+            aes_encrypt_block = aes_impls[i].encrypt;
+            aes_impl_name = aes_impls[i].name;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* RFC 4493 subkey doubling in GF(2^128) */
+static void cmac_double(const uint8_t in[16], uint8_t out[16]) {
+    uint8_t msb = in[0] & 0x80;
+    int i;
+
+    for (i = 0; i < 15; i++)
+        out[i] = (uint8_t)((in[i] << 1) | (in[i + 1] >> 7));
+
+    out[15] = (uint8_t)((in[15] << 1) ^ (msb ? 0x87 : 0x00));
+}
+
+/**
+ * expand a key once for the userspace AES and CMAC, keep it with the key
+ * owner to sign many PDUs without redoing the key schedule
+ *
+ * @param key	returned key schedule
+ * @param k		128-bit key, least significant octet first
+ */
+void bt_crypto_key_init(struct bt_crypto_key * key, const uint8_t k[16]) {
+    uint8_t l[16];
+
+    aes_setup();
+
+    swap_buf(k, key->key, 16);
+    aes_expand_key(key->key, key->rk);
+
+    memset(l, 0, 16);
+    aes_encrypt_block(key->rk, l, l);
+    cmac_double(l, key->k1);
+    cmac_double(key->k1, key->k2);
+}
+
+/**
+ * RFC 4493 AES-CMAC, message and result most significant octet first
+ *
+ * @param key	key schedule from bt_crypto_key_init()
+ * @param msg	message
+ * @param len	message length
+ * @param mac	returned 128-bit MAC
+ */
+static void cmac_aes_user(const struct bt_crypto_key * key,
+                          const uint8_t * msg, size_t len, uint8_t mac[16]) {
+    uint8_t x[16], last[16];
+    size_t n, rem, i;
+    int j;
+
+    n = len ? (len + 15) / 16 : 1;
+    rem = len - (n - 1) * 16;
+
+    memset(x, 0, 16);
+
+    for (i = 0; i < n - 1; i++, msg += 16) {
+        for (j = 0; j < 16; j++)
+            x[j] ^= msg[j];
+
+        aes_encrypt_block(key->rk, x, x);
+    }
+
+    if (rem == 16) {
+        for (j = 0; j < 16; j++)
+            last[j] = msg[j] ^ key->k1[j];
+    } else {
+        memset(last, 0, 16);
+        memcpy(last, msg, rem);
+        last[rem] = 0x80;
+
+        for (j = 0; j < 16; j++)
+            last[j] ^= key->k2[j];
+    }
+
+    for (j = 0; j < 16; j++)
+        x[j] ^= last[j];
+
+    aes_encrypt_block(key->rk, x, mac);
+}
+
+/**
+ * AES-CMAC through the kernel, message and result most significant
+ * octet first
+ *
+ * @param crypto	crypto structure with an open cmac(aes) socket
+ * @param key_msb	key, most significant octet first
+ * @param msg		message
+ * @param len		message length
+ * @param mac		returned 128-bit MAC
+ * @return			true if success
+ */
+static bool cmac_aes_alg(struct bt_crypto * crypto, const uint8_t key_msb[16],
+                         const uint8_t * msg, size_t len, uint8_t mac[16]) {
+    ssize_t ret;
     int fd;
-    int len;
+
+    fd = alg_new(crypto->cmac_aes, key_msb, 16);
+    if (fd < 0)
+        return false;
+
+    ret = send(fd, msg, len, 0);
+    if (ret < 0) {
+        close(fd);
+        return false;
+    }
+
+    ret = read(fd, mac, 16);
+    close(fd);
+
+    return ret == 16;
+}
+
+static bool cmac_aes(struct bt_crypto * crypto,
+                     const struct bt_crypto_key * key,
+                     const uint8_t * msg, size_t len, uint8_t mac[16]) {
+    if (crypto->af_alg)
+        return cmac_aes_alg(crypto, key->key, msg, len, mac);
+
+    cmac_aes_user(key, msg, len, mac);
+
+    return true;
+}
+
+bool bt_crypto_sign_att_key(struct bt_crypto * crypto,
+                            const struct bt_crypto_key * key,
+                            const uint8_t * m, uint16_t m_len,
+                            uint32_t sign_cnt, uint8_t signature[12]) {
     uint8_t tmp[16], out[16];
     uint16_t msg_len = m_len + sizeof(uint32_t);
     uint8_t msg[msg_len];
     uint8_t msg_s[msg_len];
 
-    if (!crypto)
+    if (!crypto || !key)
         return false;
 
-    memset(msg, 0, msg_len);
     memcpy(msg, m, m_len);
 
     /* Add sign_counter to the message */
     put_le32(sign_cnt, msg + m_len);
 
-    /* The most significant octet of key corresponds to key[0] */
-    swap_buf(key, tmp, 16);
-
-    fd = alg_new(crypto->cmac_aes, tmp, 16);
-    if (fd < 0)
-        return false;
-
     /* Swap msg before signing */
     swap_buf(msg, msg_s, msg_len);
 
-    len = send(fd, msg_s, msg_len, 0);
-    if (len < 0) {
-        close(fd);
+    if (!cmac_aes(crypto, key, msg_s, msg_len, out))
         return false;
-    }
-
-    len = read(fd, out, 16);
-    if (len < 0) {
-        close(fd);
-        return false;
-    }
-
-    close(fd);
 
     /*
      * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -332,6 +736,19 @@ bool bt_crypto_sign_att(struct bt_crypto * crypto, const uint8_t key[16],
 
     return true;
 }
+
+bool bt_crypto_sign_att(struct bt_crypto * crypto, const uint8_t key[16],
+                        const uint8_t * m, uint16_t m_len,
+                        uint32_t sign_cnt, uint8_t signature[12]) {
+    struct bt_crypto_key k;
+
+    if (!crypto)
+        return false;
+
+    bt_crypto_key_init(&k, key);
+
+    return bt_crypto_sign_att_key(crypto, &k, m, m_len, sign_cnt, signature);
+}
 /**
  * Security function e
  *
@@ -353,6 +770,19 @@ bool bt_crypto_e(struct bt_crypto * crypto, const uint8_t key[16],
     if (!crypto)
         return false;
 
+    if (!crypto->af_alg) {
+        uint8_t rk[BT_CRYPTO_AES_RK_SIZE];
+
+        swap_buf(key, tmp, 16);
+        aes_expand_key(tmp, rk);
+
+        swap_buf(plaintext, in, 16);
+        aes_encrypt_block(rk, in, out);
+        swap_buf(out, encrypted, 16);
+
+        return true;
+    }
+
     /* The most significant octet of key corresponds to key[0] */
     swap_buf(key, tmp, 16);
 
@@ -572,36 +1002,132 @@ bool bt_crypto_s1(struct bt_crypto * crypto, const uint8_t k[16],
     return bt_crypto_e(crypto, k, res, res);
 }
 
-static bool aes_cmac(struct bt_crypto * crypto, uint8_t key[16], uint8_t * msg,
-                     size_t msg_len, uint8_t res[16]) {
-    uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-    ssize_t len;
-    int fd;
+/* FIPS-197 appendix C.1, most significant octet first */
+static const uint8_t fips197_key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
 
-    if (msg_len > CMAC_MSG_MAX)
+static const uint8_t fips197_in[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+
+static const uint8_t fips197_out[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+    0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+/* RFC 4493 section 4, most significant octet first */
+static const uint8_t rfc4493_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+static const uint8_t rfc4493_k1[16] = {
+    0xfb, 0xee, 0xd6, 0x18, 0x35, 0x71, 0x33, 0x66,
+    0x7c, 0x85, 0xe0, 0x8f, 0x72, 0x36, 0xa8, 0xde
+};
+
+static const uint8_t rfc4493_k2[16] = {
+    0xf7, 0xdd, 0xac, 0x30, 0x6a, 0xe2, 0x66, 0xcc,
+    0xf9, 0x0b, 0xc1, 0x1e, 0xe4, 0x6d, 0x51, 0x3b
+};
+
+static const uint8_t rfc4493_msg[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+    0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+    0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+    0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+    0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+
+static const struct {
+    uint8_t len;
+    uint8_t mac[16];
+} rfc4493_macs[] = {
+    {
+        0, {
+            0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28,
+            0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46
+        }
+    }, {
+        16, {
+            0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44,
+            0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c
+        }
+    }, {
+        40, {
+            0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30,
+            0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27
+        }
+    }, {
+        64, {
+            0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92,
+            0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe
+        }
+    },
+};
+
+/**
+ * check AES against FIPS-197 and CMAC against RFC 4493 on the current
+ * path, the AES implementation set for userspace or AF_ALG
+ *
+ * @param crypto	crypto structure
+ * @return			true if all the vectors match
+ */
+bool bt_crypto_selftest(struct bt_crypto * crypto) {
+    uint8_t key[16], in[16], out[16];
+    struct bt_crypto_key k;
+    unsigned int i;
+
+    if (!crypto)
         return false;
 
-    swap_buf(key, key_msb, 16);
-    fd = alg_new(crypto->cmac_aes, key_msb, 16);
-    if (fd < 0)
+    /* bt_crypto_e takes and returns the least significant octet first */
+    swap_buf(fips197_key, key, 16);
+    swap_buf(fips197_in, in, 16);
+    if (!bt_crypto_e(crypto, key, in, out))
         return false;
 
-    swap_buf(msg, msg_msb, msg_len);
-    len = send(fd, msg_msb, msg_len, 0);
-    if (len < 0) {
-        close(fd);
+    swap_buf(out, in, 16);
+    if (memcmp(in, fips197_out, 16))
         return false;
-    }
 
-    len = read(fd, out, 16);
-    if (len < 0) {
-        close(fd);
+    swap_buf(rfc4493_key, key, 16);
+    bt_crypto_key_init(&k, key);
+    if (memcmp(k.k1, rfc4493_k1, 16) || memcmp(k.k2, rfc4493_k2, 16))
         return false;
+
+    for (i = 0; i < sizeof(rfc4493_macs) / sizeof(rfc4493_macs[0]); i++) {
+        if (!cmac_aes(crypto, &k, rfc4493_msg, rfc4493_macs[i].len, out))
+            return false;
+
+        if (memcmp(out, rfc4493_macs[i].mac, 16))
+            return false;
     }
 
-    swap_buf(out, res, 16);
+    return true;
+}
 
-    close(fd);
+static bool aes_cmac(struct bt_crypto * crypto, uint8_t key[16], uint8_t * msg,
+                     size_t msg_len, uint8_t res[16]) {
+    uint8_t out[16], msg_msb[CMAC_MSG_MAX];
+    struct bt_crypto_key k;
+
+    if (msg_len > CMAC_MSG_MAX)
+        return false;
+
+    bt_crypto_key_init(&k, key);
+
+    swap_buf(msg, msg_msb, msg_len);
+    if (!cmac_aes(crypto, &k, msg_msb, msg_len, out))
+        return false;
+
+    swap_buf(out, res, 16);
 
     return true;
 }
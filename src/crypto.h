@@ -24,9 +24,24 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define BT_CRYPTO_AES_RK_SIZE	176
+
 struct bt_crypto;
 
+/* AES-128 key schedule and CMAC subkeys, kept by the key owner */
+struct bt_crypto_key {
+    uint8_t key[16];
+    uint8_t rk[BT_CRYPTO_AES_RK_SIZE];
+    uint8_t k1[16];
+    uint8_t k2[16];
+};
+
 struct bt_crypto * bt_crypto_new(void);
+bool bt_crypto_set_af_alg(struct bt_crypto * crypto, bool enable);
+const char * bt_crypto_aes_impl(void);
+const char * bt_crypto_aes_impl_name(unsigned int idx);
+bool bt_crypto_set_aes_impl(const char * name);
+bool bt_crypto_selftest(struct bt_crypto * crypto);
 
 struct bt_crypto * bt_crypto_ref(struct bt_crypto * crypto);
 void bt_crypto_unref(struct bt_crypto * crypto);
@@ -59,3 +74,9 @@ bool bt_crypto_g2(struct bt_crypto * crypto, uint8_t u[32], uint8_t v[32],
 bool bt_crypto_sign_att(struct bt_crypto * crypto, const uint8_t key[16],
                         const uint8_t * m, uint16_t m_len,
                         uint32_t sign_cnt, uint8_t signature[12]);
+
+void bt_crypto_key_init(struct bt_crypto_key * key, const uint8_t k[16]);
+bool bt_crypto_sign_att_key(struct bt_crypto * crypto,
+                            const struct bt_crypto_key * key,
+                            const uint8_t * m, uint16_t m_len,
+                            uint32_t sign_cnt, uint8_t signature[12]);
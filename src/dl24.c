@@ -0,0 +1,226 @@
+/**
+* @file dl24.c
+* @author palich (y.palich.t@gmail.com)
+*
+* @brief Atorch DL24/DT24 report frame decoder
+*
+* Report frame, big endian fields, layout per device type (byte 3):
+*
+*      AC (0x01)          DC (0x02)          USB (0x03)
+*  4   V     3  0.1 V     V     3  0.1 V     V     3  0.01 V
+*  7   I     3  0.001 A   I     3  0.001 A   I     3  0.01 A
+*  10  P     3  0.1 W     C     3  0.01 Ah   C     3  0.001 Ah
+*  13  E     4  10 Wh     E     4  10 Wh     E     4  0.01 Wh
+*  17  price 3  0.01      price 3  0.01      D-    2  0.01 V
+*  19                                        D+    2  0.01 V
+*  20  F     2  0.1 Hz
+*  21                                        T     2  C
+*  22  PF    2  0.001
+*  23                                        h:m:s 2:1:1
+*  24  T     2  C         T     2  C
+*  26  h:m:s 2:1:1        h:m:s 2:1:1
+*  27                                        light 1  s
+*  30  light 1  s         light 1  s
+*  35  checksum
+*
+*  ff 55 01 02 00 01 08 00 0e f4 00 03 7a 00 00 00 17 00 00 34 00 00 00 00 00 14 00 03 14 37 3c 00 00 00 00 23
+*  ff 55 01 02 00 01 0e 00 4d c8 00 09 3c 00 00 00 3e 00 00 34 00 00 00 00 00 17 00 06 05 08 3c 00 00 00 00 23
+*
+*/
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "dl24.h"
+
+#define DL24_HEADER_0 0xff
+#define DL24_HEADER_1 0x55
+#define DL24_MSG_REPORT 0x01
+/* DT24P firmware sends a constant trailer instead of the checksum */
+#define DL24_REPORT_TRAILER 0x23
+
+/* bounds of a trailer frame, nothing protects its content */
+#define DL24_MAX_VOLTAGE_MV 200000
+#define DL24_MAX_CURRENT_MA 50000
+#define DL24_MAX_TEMPERATURE_C 150
+
+/**
+ * one field: value = (big endian width bytes at offset) * scale, added to
+ * the sample field so that h:m:s can be summed into runtime_s
+ */
+struct dl24_field {
+    uint8_t offset;
+    uint8_t width;
+    uint16_t field;
+    uint32_t scale;
+};
+
+#define DL24_FIELD(o, w, f, s) { o, w, offsetof(struct dl24_sample, f), s }
+
+static const struct dl24_field dl24_ac_fields[] = {
+    DL24_FIELD(4, 3, voltage_mv, 100),
+    DL24_FIELD(7, 3, current_ma, 1),
+    DL24_FIELD(10, 3, power_mw, 100),
+    DL24_FIELD(13, 4, energy_cwh, 1000),
+    DL24_FIELD(17, 3, price_cents, 1),
+    DL24_FIELD(20, 2, frequency_dhz, 1),
+    DL24_FIELD(22, 2, power_factor, 1),
+    DL24_FIELD(24, 2, temperature_c, 1),
+    DL24_FIELD(26, 2, runtime_s, 3600),
+    DL24_FIELD(28, 1, runtime_s, 60),
+    DL24_FIELD(29, 1, runtime_s, 1),
+    DL24_FIELD(30, 1, backlight_s, 1),
+    { }
+};
+
+static const struct dl24_field dl24_dc_fields[] = {
+    DL24_FIELD(4, 3, voltage_mv, 100),
+    DL24_FIELD(7, 3, current_ma, 1),
+    DL24_FIELD(10, 3, capacity_mah, 10),
+    DL24_FIELD(13, 4, energy_cwh, 1000),
+    DL24_FIELD(17, 3, price_cents, 1),
+    DL24_FIELD(24, 2, temperature_c, 1),
+    DL24_FIELD(26, 2, runtime_s, 3600),
+    DL24_FIELD(28, 1, runtime_s, 60),
+    DL24_FIELD(29, 1, runtime_s, 1),
+    DL24_FIELD(30, 1, backlight_s, 1),
+    { }
+};
+
+static const struct dl24_field dl24_usb_fields[] = {
+    DL24_FIELD(4, 3, voltage_mv, 10),
+    DL24_FIELD(7, 3, current_ma, 10),
+    DL24_FIELD(10, 3, capacity_mah, 1),
+    DL24_FIELD(13, 4, energy_cwh, 1),
+    DL24_FIELD(17, 2, dminus_mv, 10),
+    DL24_FIELD(19, 2, dplus_mv, 10),
+    DL24_FIELD(21, 2, temperature_c, 1),
+    DL24_FIELD(23, 2, runtime_s, 3600),
+    DL24_FIELD(25, 1, runtime_s, 60),
+    DL24_FIELD(26, 1, runtime_s, 1),
+    DL24_FIELD(27, 1, backlight_s, 1),
+    { }
+};
+
+static const struct {
+    const struct dl24_field * fields;
+    /* power is not in the frame, derive it from V and I */
+    uint8_t derive_power;
+    /* DT24P: DL24_REPORT_TRAILER may replace the checksum */
+    uint8_t trailer;
+    /* offset of the minutes byte, followed by the seconds byte */
+    uint8_t minutes;
+} dl24_variants[] = {
+    [DL24_DEVICE_AC] = { dl24_ac_fields, 0, 0, 28 },
+    [DL24_DEVICE_DC] = { dl24_dc_fields, 1, 1, 28 },
+    [DL24_DEVICE_USB] = { dl24_usb_fields, 1, 0, 25 },
+};
+
+static const uint32_t dl24_width_mask[] = {
+    0x00000000, 0x000000ff, 0x0000ffff, 0x00ffffff, 0xffffffff
+};
+
+static uint8_t dl24_checksum(const uint8_t * frame, uint16_t length) {
+    uint8_t sum = 0;
+    uint16_t i;
+
+    /* skip header and checksum */
+    for (i = 2; i < length - 1; i++)
+        sum += frame[i];
+
+    return sum ^ 0x44;
+}
+
+/**
+ * range check of a frame accepted on its trailer only
+ */
+static int dl24_plausible(const uint8_t * frame, const struct dl24_sample * sample) {
+    uint8_t minutes = dl24_variants[sample->type].minutes;
+
+    if (frame[minutes] >= 60 || frame[minutes + 1] >= 60)
+        return 0;
+
+    return sample->voltage_mv <= DL24_MAX_VOLTAGE_MV &&
+           sample->current_ma <= DL24_MAX_CURRENT_MA &&
+           sample->temperature_c <= DL24_MAX_TEMPERATURE_C;
+}
+
+static int dl24_reject(uint32_t * counter, int err) {
+    (*counter)++;
+
+    return err;
+}
+
+/**
+ * validate and decode a DL24 report frame in one pass
+ *
+ * @param frame		notification payload
+ * @param length	payload length
+ * @param sample	decoded values
+ * @param stats		counters updated with the outcome, may be NULL
+ * @return 0 success, -EINVAL not a report frame, -ENOTSUP unknown device
+ *         type, -EBADMSG checksum mismatch or out of range trailer frame
+ */
+int dl24_decode(const uint8_t * frame, uint16_t length, struct dl24_sample * sample,
+                struct dl24_stats * stats) {
+    const struct dl24_field * field;
+    uint8_t * out = (uint8_t *) sample;
+    struct dl24_stats dummy;
+    uint8_t type;
+    int trailer;
+
+    if (!stats)
+        stats = &dummy;
+
+    if (length != DL24_FRAME_LEN || frame[0] != DL24_HEADER_0 ||
+            frame[1] != DL24_HEADER_1 || frame[2] != DL24_MSG_REPORT)
+        return dl24_reject(&stats->invalid, -EINVAL);
+
+    type = frame[3];
+    if (type >= sizeof(dl24_variants) / sizeof(dl24_variants[0]) ||
+            !dl24_variants[type].fields)
+        return dl24_reject(&stats->unsupported, -ENOTSUP);
+
+    trailer = 0;
+    if (frame[length - 1] != dl24_checksum(frame, length)) {
+        if (!dl24_variants[type].trailer ||
+                frame[length - 1] != DL24_REPORT_TRAILER)
+            return dl24_reject(&stats->bad_checksum, -EBADMSG);
+
+        trailer = 1;
+    }
+
+    memset(sample, 0, sizeof(*sample));
+    sample->type = type;
+
+    /* every field is read as the 32 bit word ending on its last byte */
+    for (field = dl24_variants[type].fields; field->width; field++) {
+        uint32_t value = get_be32(frame + field->offset + field->width - 4) &
+                         dl24_width_mask[field->width];
+        uint32_t acc;
+
+        memcpy(&acc, out + field->field, sizeof(acc));
+        acc += value * field->scale;
+        memcpy(out + field->field, &acc, sizeof(acc));
+    }
+
+    if (dl24_variants[type].derive_power)
+        sample->power_mw = (uint64_t) sample->voltage_mv * sample->current_ma / 1000;
+
+    if (sample->current_ma)
+        sample->resistance_mohm = (uint64_t) sample->voltage_mv * 1000 / sample->current_ma;
+
+    if (trailer) {
+        if (!dl24_plausible(frame, sample))
+            return dl24_reject(&stats->implausible, -EBADMSG);
+
+        stats->trailer++;
+    }
+
+    stats->frames++;
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+/**
+* @file dl24.h
+* @author palich (y.palich.t@gmail.com)
+*
+* @brief Atorch DL24/DT24 report frame decoder
+*
+*/
+#ifndef SRC_DL24_H
+#define SRC_DL24_H
+
+#include <stdint.h>
+
+#define DL24_FRAME_LEN 36
+
+enum dl24_device_type {
+    DL24_DEVICE_AC = 0x01,
+    DL24_DEVICE_DC = 0x02,
+    DL24_DEVICE_USB = 0x03,
+};
+
+/**
+ * decoded report, fixed point, fields not sent by a meter type are 0
+ */
+struct dl24_sample {
+    uint32_t type;              /**< enum dl24_device_type */
+    uint32_t voltage_mv;        /**< mV */
+    uint32_t current_ma;        /**< mA */
+    uint32_t power_mw;          /**< mW, from the frame (AC) or V * I */
+    uint32_t resistance_mohm;   /**< mOhm, V / I, 0 without current */
+    uint32_t capacity_mah;      /**< mAh */
+    uint32_t energy_cwh;        /**< 0.01 Wh */
+    uint32_t price_cents;       /**< price per kWh, 0.01 */
+    uint32_t frequency_dhz;     /**< AC: 0.1 Hz */
+    uint32_t power_factor;      /**< AC: 0.001 */
+    uint32_t temperature_c;     /**< degree C */
+    uint32_t runtime_s;         /**< device runtime counter, seconds */
+    uint32_t backlight_s;       /**< backlight timeout, seconds */
+    uint32_t dminus_mv;         /**< USB: D- mV */
+    uint32_t dplus_mv;          /**< USB: D+ mV */
+} __attribute__((packed));
+
+/**
+ * decoder counters of one meter
+ */
+struct dl24_stats {
+    uint32_t frames;        /**< report frames decoded */
+    uint32_t trailer;       /**< of those, accepted on the DT24P trailer */
+    uint32_t invalid;       /**< rejected, not a report frame */
+    uint32_t unsupported;   /**< rejected, unknown device type */
+    uint32_t bad_checksum;  /**< rejected, checksum mismatch */
+    uint32_t implausible;   /**< rejected, trailer frame out of range */
+};
+
+int dl24_decode(const uint8_t * frame, uint16_t length, struct dl24_sample * sample,
+                struct dl24_stats * stats);
+
+#endif //SRC_DL24_H
@@ -0,0 +1,501 @@
+/**
+ * @file gatt-bench.c
+ * @brief primary, characteristic and descriptor discovery benchmark
+ *
+ * A fake ATT server on socketpairs answers the discovery of a GATT client
+ * after a fixed delay, the way a remote device does over the air. The fixed
+ * channel and the optional extra bearers (EATT) are socketpairs of their own.
+ * Each run times the discovery of the whole database for one discovery
+ * window, then the failure and the disconnect paths are checked: an error
+ * on the characteristics of one service and a server going away in the
+ * middle must both complete the client with a failure, once.
+ *
+ * Every service is a declaration, one characteristic with a CCC
+ * descriptor, 4 handles.
+ *
+ * usage: gatt-bench [-n services] [-l latency ms] [-b bearers]
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "mainloop.h"
+#include "att.h"
+#include "bluetooth.h"
+#include "uuid.h"
+#include "util.h"
+#include "queue.h"
+#include "gatt-db.h"
+#include "gatt-client.h"
+
+#define BENCH_BEARERS_MAX 8
+#define BENCH_SERVICES_MAX 1024
+#define BENCH_MTU BT_ATT_DEFAULT_LE_MTU
+#define BENCH_SVC_UUID 0xff00
+#define BENCH_CHRC_UUID 0xfe00
+#define BENCH_OP_CMD_MASK 0x40
+/* a client never ready ends its run after this long */
+#define BENCH_WATCHDOG_MS 30000
+
+enum bench_fault {
+    BENCH_FAULT_NONE,
+    BENCH_FAULT_ERROR,      ///< characteristics of the middle service fail
+    BENCH_FAULT_DISCONNECT, ///< the server goes away halfway
+};
+
+struct bench_server {
+    int fd[BENCH_BEARERS_MAX];      ///< server side of each bearer
+    unsigned int bearers;           ///< bearers in use
+    unsigned int services;          ///< services in the database
+    unsigned int latency;           ///< ms before a request is answered
+    enum bench_fault fault;         ///< failure to inject
+    unsigned int requests;          ///< requests received
+    unsigned int in_flight;         ///< requests not answered yet
+    unsigned int max_in_flight;     ///< highest in_flight seen
+};
+
+struct bench_request {
+    struct bench_server * server;
+    unsigned int bearer;
+    uint8_t pdu[BENCH_MTU];
+    ssize_t len;
+};
+
+struct bench_result {
+    bool done;          ///< ready handler called
+    unsigned int calls; ///< ready handler calls, must be 1
+    bool success;
+    uint8_t att_ecode;
+    long ms;            ///< time to ready
+};
+
+static struct timespec bench_start;
+
+static long elapsed_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - bench_start.tv_sec) * 1000 +
+           (now.tv_nsec - bench_start.tv_nsec) / 1000000;
+}
+
+static uint16_t svc_start(unsigned int idx) {
+    return 1 + 4 * idx;
+}
+
+static void server_send(struct bench_server * server, unsigned int bearer,
+                        const uint8_t * pdu, size_t len) {
+    if (server->fd[bearer] < 0)
+        return;
+
+    if (write(server->fd[bearer], pdu, len) < 0)
+        fprintf(stderr, "server write: %s\n", strerror(errno));
+}
+
+static void server_error(struct bench_server * server, unsigned int bearer,
+                         uint8_t opcode, uint16_t handle, uint8_t ecode) {
+    uint8_t pdu[5];
+
+    pdu[0] = BT_ATT_OP_ERROR_RSP;
+    pdu[1] = opcode;
+    put_le16(handle, pdu + 2);
+    pdu[4] = ecode;
+
+    server_send(server, bearer, pdu, sizeof(pdu));
+}
+
+/**
+ * answer one request out of the fixed database, anything but the
+ * discovery procedures gets Request Not Supported
+ */
+static void server_answer(struct bench_server * server, unsigned int bearer,
+                          const uint8_t * req, ssize_t len) {
+    uint16_t start, end, type;
+    uint8_t rsp[BENCH_MTU];
+    unsigned int i;
+    size_t n;
+
+    if (len < 5) {
+        if (len == 3 && req[0] == BT_ATT_OP_MTU_REQ) {
+            rsp[0] = BT_ATT_OP_MTU_RSP;
+            put_le16(BENCH_MTU, rsp + 1);
+            server_send(server, bearer, rsp, 3);
+            return;
+        }
+
+        server_error(server, bearer, req[0], 0,
+                     BT_ATT_ERROR_REQUEST_NOT_SUPPORTED);
+        return;
+    }
+
+    start = get_le16(req + 1);
+    end = get_le16(req + 3);
+    type = len >= 7 ? get_le16(req + 5) : 0;
+
+    switch (req[0]) {
+    case BT_ATT_OP_READ_BY_GRP_TYPE_REQ:
+        if (type != GATT_PRIM_SVC_UUID)
+            break;
+
+        rsp[0] = BT_ATT_OP_READ_BY_GRP_TYPE_RSP;
+        rsp[1] = 6;
+        n = 2;
+
+        for (i = 0; i < server->services && n + 6 <= sizeof(rsp); i++) {
+            if (svc_start(i) < start || svc_start(i) > end)
+                continue;
+
+            put_le16(svc_start(i), rsp + n);
+            put_le16(svc_start(i) + 3, rsp + n + 2);
+            put_le16(BENCH_SVC_UUID + i, rsp + n + 4);
+            n += 6;
+        }
+
+        if (n > 2) {
+            server_send(server, bearer, rsp, n);
+            return;
+        }
+
+        break;
+    case BT_ATT_OP_READ_BY_TYPE_REQ:
+        if (type != GATT_CHARAC_UUID)
+            break;
+
+        for (i = 0; i < server->services; i++) {
+            if (svc_start(i) + 1 < start || svc_start(i) + 1 > end)
+                continue;
+
+            if (server->fault == BENCH_FAULT_ERROR &&
+                    i == server->services / 2) {
+                server_error(server, bearer, req[0], start,
+                             BT_ATT_ERROR_AUTHORIZATION);
+                return;
+            }
+
+            rsp[0] = BT_ATT_OP_READ_BY_TYPE_RSP;
+            rsp[1] = 7;
+            put_le16(svc_start(i) + 1, rsp + 2);
+            rsp[4] = BT_GATT_CHRC_PROP_READ | BT_GATT_CHRC_PROP_NOTIFY;
+            put_le16(svc_start(i) + 2, rsp + 5);
+            put_le16(BENCH_CHRC_UUID + i, rsp + 7);
+            server_send(server, bearer, rsp, 9);
+            return;
+        }
+
+        break;
+    case BT_ATT_OP_FIND_INFO_REQ:
+        for (i = 0; i < server->services; i++) {
+            if (svc_start(i) + 3 < start || svc_start(i) + 3 > end)
+                continue;
+
+            rsp[0] = BT_ATT_OP_FIND_INFO_RSP;
+            rsp[1] = 0x01;
+            put_le16(svc_start(i) + 3, rsp + 2);
+            put_le16(GATT_CLIENT_CHARAC_CFG_UUID, rsp + 4);
+            server_send(server, bearer, rsp, 6);
+            return;
+        }
+
+        break;
+    default:
+        server_error(server, bearer, req[0], start,
+                     BT_ATT_ERROR_REQUEST_NOT_SUPPORTED);
+        return;
+    }
+
+    server_error(server, bearer, req[0], start,
+                 BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+}
+
+static void server_close(struct bench_server * server) {
+    unsigned int i;
+
+    for (i = 0; i < server->bearers; i++) {
+        if (server->fd[i] < 0)
+            continue;
+
+        mainloop_remove_fd(server->fd[i]);
+        close(server->fd[i]);
+        server->fd[i] = -1;
+    }
+}
+
+static void request_timeout_cb(int id, void * user_data) {
+    struct bench_request * req = user_data;
+    struct bench_server * server = req->server;
+
+    server->in_flight--;
+    server_answer(server, req->bearer, req->pdu, req->len);
+
+    /* frees req */
+    mainloop_remove_timeout(id);
+}
+
+static void server_read_cb(int fd, __attribute__((unused)) uint32_t events,
+                           void * user_data) {
+    struct bench_server * server = user_data;
+    struct bench_request * req;
+    unsigned int bearer;
+
+    for (bearer = 0; bearer < server->bearers; bearer++) {
+        if (server->fd[bearer] == fd)
+            break;
+    }
+
+    req = new0(struct bench_request, 1);
+    if (!req)
+        return;
+
+    req->server = server;
+    req->bearer = bearer;
+    req->len = read(fd, req->pdu, sizeof(req->pdu));
+    if (req->len <= 0) {
+        free(req);
+        mainloop_remove_fd(fd);
+        return;
+    }
+
+    /* commands and confirmations are not answered */
+    if (req->pdu[0] & BENCH_OP_CMD_MASK ||
+            req->pdu[0] == BT_ATT_OP_HANDLE_VAL_CONF) {
+        free(req);
+        return;
+    }
+
+    server->requests++;
+    if (server->fault == BENCH_FAULT_DISCONNECT &&
+            server->requests > server->services) {
+        free(req);
+        server_close(server);
+        return;
+    }
+
+    if (!server->latency) {
+        server_answer(server, bearer, req->pdu, req->len);
+        free(req);
+        return;
+    }
+
+    if (mainloop_add_timeout(server->latency, request_timeout_cb, req,
+                             free) < 0) {
+        free(req);
+        return;
+    }
+
+    if (++server->in_flight > server->max_in_flight)
+        server->max_in_flight = server->in_flight;
+}
+
+static void ready_cb(bool success, uint8_t att_ecode, void * user_data) {
+    struct bench_result * result = user_data;
+
+    if (result->calls++)
+        return;
+
+    result->done = true;
+    result->success = success;
+    result->att_ecode = att_ecode;
+    result->ms = elapsed_ms();
+
+    mainloop_quit();
+}
+
+static void watchdog_cb(__attribute__((unused)) int id,
+                        __attribute__((unused)) void * user_data) {
+    mainloop_quit();
+}
+
+static void count_service_cb(__attribute__((unused)) struct gatt_db_attribute * attr,
+                             void * user_data) {
+    int * count = user_data;
+
+    (*count)++;
+}
+
+/**
+ * run one discovery against a fresh server and client
+ *
+ * @param server	server settings, its state is reset
+ * @param window	discovery window, 0 for one job per bearer
+ * @param result	outcome of the discovery
+ * @return number of services in the client database
+ */
+static int bench_run(struct bench_server * server, unsigned int window,
+                     struct bench_result * result) {
+    struct bt_gatt_client * client = NULL;
+    struct gatt_db * db = NULL;
+    struct bt_att * att = NULL;
+    int sv[2], services = -1;
+    unsigned int i;
+
+    memset(result, 0, sizeof(*result));
+    server->requests = 0;
+    server->in_flight = 0;
+    server->max_in_flight = 0;
+    for (i = 0; i < BENCH_BEARERS_MAX; i++)
+        server->fd[i] = -1;
+
+    mainloop_init();
+
+    for (i = 0; i < server->bearers; i++) {
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+            perror("socketpair");
+            goto done;
+        }
+
+        server->fd[i] = sv[1];
+        mainloop_add_fd(sv[1], EPOLLIN, server_read_cb, server, NULL);
+
+        if (!i) {
+            att = bt_att_new(sv[0], false);
+            if (!att) {
+                close(sv[0]);
+                goto done;
+            }
+
+            bt_att_set_close_on_unref(att, true);
+        } else if (bt_att_attach_fd(att, sv[0]) < 0) {
+            close(sv[0]);
+            goto done;
+        }
+    }
+
+    db = gatt_db_new();
+    if (!db)
+        goto done;
+
+    clock_gettime(CLOCK_MONOTONIC, &bench_start);
+
+    client = bt_gatt_client_new(db, att, BENCH_MTU);
+    if (!client)
+        goto done;
+
+    bt_gatt_client_set_discovery_window(client, window);
+    bt_gatt_client_set_ready_handler(client, ready_cb, result, NULL);
+
+    mainloop_add_timeout(BENCH_WATCHDOG_MS, watchdog_cb, NULL, NULL);
+    mainloop_run();
+
+    services = 0;
+    gatt_db_foreach_service(db, NULL, count_service_cb, &services);
+
+done:
+    bt_gatt_client_unref(client);
+    gatt_db_unref(db);
+    bt_att_unref(att);
+
+    for (i = 0; i < server->bearers; i++) {
+        if (server->fd[i] >= 0)
+            close(server->fd[i]);
+    }
+
+    return services;
+}
+
+static void usage(void) {
+    printf("gatt-bench\n"
+           "Usage:\n\tgatt-bench [options]\n"
+           "Options:\n"
+           "\t-n, --services <count>\tServices in the database (16)\n"
+           "\t-l, --latency <ms>\tDelay of every response (10)\n"
+           "\t-b, --bearers <count>\tATT bearers, fixed one included (1)\n"
+           "\t-h, --help\t\tDisplay help\n");
+}
+
+static const struct option main_options[] = {
+    { "services", 1, 0, 'n' },
+    { "latency", 1, 0, 'l' },
+    { "bearers", 1, 0, 'b' },
+    { "help", 0, 0, 'h' },
+    { }
+};
+
+int main(int argc, char * argv[]) {
+    struct bench_server server;
+    struct bench_result result;
+    unsigned int window;
+    int opt, services, failed = 0;
+
+    memset(&server, 0, sizeof(server));
+    server.services = 16;
+    server.latency = 10;
+    server.bearers = 1;
+
+    while ((opt = getopt_long(argc, argv, "n:l:b:h", main_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            server.services = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            server.latency = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            server.bearers = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (server.services < 2 || server.services > BENCH_SERVICES_MAX ||
+            !server.bearers || server.bearers > BENCH_BEARERS_MAX) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    printf("%u services, %u ms latency, %u bearers\n", server.services,
+           server.latency, server.bearers);
+
+    /* 0 is the default, one job per bearer */
+    for (window = 0; window <= server.services;
+            window = window ? window * 2 : 1) {
+        services = bench_run(&server, window, &result);
+
+        printf("window %4u: %s in %5ld ms, %4u requests, %3u in flight\n",
+               window, result.success ? "ready" : "FAILED", result.ms,
+               server.requests, server.max_in_flight);
+
+        if (!result.success || result.calls != 1 ||
+                services != (int) server.services)
+            failed++;
+    }
+
+    server.fault = BENCH_FAULT_ERROR;
+    services = bench_run(&server, server.services, &result);
+    printf("att error:   %s, ecode 0x%02x, %u calls, %d services left\n",
+           result.done ? "done" : "STUCK", result.att_ecode, result.calls,
+           services);
+
+    if (result.success || result.calls != 1 ||
+            result.att_ecode != BT_ATT_ERROR_AUTHORIZATION)
+        failed++;
+
+    server.fault = BENCH_FAULT_DISCONNECT;
+    services = bench_run(&server, server.services, &result);
+    printf("disconnect:  %s, %u calls, %u requests\n",
+           result.done ? "done" : "STUCK", result.calls, server.requests);
+
+    if (result.success || result.calls != 1)
+        failed++;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
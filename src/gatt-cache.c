@@ -0,0 +1,433 @@
+/**
+ * @file gatt-cache.c
+ * @brief persistent gatt_db cache, one file per remote device
+ *
+ * The file is a fixed header followed by fixed size records, one per
+ * service, include, characteristic and descriptor declaration, in handle
+ * order inside each service. It is mapped read only on load and the db is
+ * rebuilt in two passes: the services first, so includes can point to any
+ * of them, then their attributes. The records carry the handles the server
+ * gave, a load fails as a whole if any of them can not be placed at the
+ * same handle, the caller then starts from an empty db.
+ *
+ * The Database Hash characteristic value read when the file was written is
+ * kept in the header, gatt-client compares it with the server one to skip
+ * the discovery.
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "att.h"
+#include "bluetooth.h"
+#include "uuid.h"
+#include "util.h"
+#include "queue.h"
+#include "gatt-db.h"
+#include "gatt-cache.h"
+
+#define GATT_CACHE_MAGIC	"GDB1"
+#define GATT_CACHE_VERSION	1
+
+enum gatt_cache_type {
+    GATT_CACHE_PRIMARY = 1,
+    GATT_CACHE_SECONDARY,
+    GATT_CACHE_INCLUDE,
+    GATT_CACHE_CHRC,
+    GATT_CACHE_DESC,
+};
+
+struct gatt_cache_hdr {
+    char magic[4];
+    uint8_t version;
+    uint8_t has_hash;
+    uint16_t count;                 /**< records following the header */
+    uint8_t hash[GATT_CACHE_HASH_SIZE];
+} __attribute__((packed));
+
+struct gatt_cache_rec {
+    uint8_t type;                   /**< enum gatt_cache_type */
+    uint8_t properties;             /**< characteristic properties */
+    uint16_t handle;                /**< declaration handle */
+    uint16_t handle2;               /**< service end, value or included start */
+    uint16_t handle3;               /**< included service end */
+    uint8_t uuid_len;               /**< 2, 4 or 16, little endian in uuid */
+    uint8_t reserved[3];
+    uint8_t uuid[16];
+} __attribute__((packed));
+
+struct save_data {
+    struct gatt_cache_rec * recs;
+    unsigned int count;
+    unsigned int size;
+    bool failed;
+};
+
+static struct gatt_cache_rec * save_rec(struct save_data * data,
+                                        uint8_t type, uint16_t handle,
+                                        const bt_uuid_t * uuid) {
+    struct gatt_cache_rec * rec;
+
+    if (data->failed)
+        return NULL;
+
+    if (data->count == data->size) {
+        unsigned int size = data->size ? data->size * 2 : 32;
+
+        /* the header count is 16 bit */
+        rec = size > UINT16_MAX ? NULL :
+              realloc(data->recs, size * sizeof(*rec));
+        if (!rec) {
+            data->failed = true;
+            return NULL;
+        }
+
+        data->recs = rec;
+        data->size = size;
+    }
+
+    rec = &data->recs[data->count++];
+    memset(rec, 0, sizeof(*rec));
+    rec->type = type;
+    rec->handle = htobs(handle);
+    if (uuid) {
+        rec->uuid_len = bt_uuid_len(uuid);
+        bt_uuid_to_le(uuid, rec->uuid);
+    }
+
+    return rec;
+}
+
+static void save_incl(struct gatt_db_attribute * attr, void * user_data) {
+    struct save_data * data = user_data;
+    struct gatt_cache_rec * rec;
+    uint16_t handle, start, end;
+
+    if (!gatt_db_attribute_get_incl_data(attr, &handle, &start, &end)) {
+        data->failed = true;
+        return;
+    }
+
+    rec = save_rec(data, GATT_CACHE_INCLUDE, handle, NULL);
+    if (!rec)
+        return;
+
+    rec->handle2 = htobs(start);
+    rec->handle3 = htobs(end);
+}
+
+static void save_desc(struct gatt_db_attribute * attr, void * user_data) {
+    save_rec(user_data, GATT_CACHE_DESC, gatt_db_attribute_get_handle(attr),
+             gatt_db_attribute_get_type(attr));
+}
+
+static void save_chrc(struct gatt_db_attribute * attr, void * user_data) {
+    struct save_data * data = user_data;
+    struct gatt_cache_rec * rec;
+    uint16_t handle, value_handle;
+    uint8_t properties;
+    bt_uuid_t uuid;
+
+    if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle,
+                                         &properties, &uuid)) {
+        data->failed = true;
+        return;
+    }
+
+    rec = save_rec(data, GATT_CACHE_CHRC, handle, &uuid);
+    if (!rec)
+        return;
+
+    rec->properties = properties;
+    rec->handle2 = htobs(value_handle);
+
+    gatt_db_service_foreach_desc(attr, save_desc, data);
+}
+
+static void save_service(struct gatt_db_attribute * attr, void * user_data) {
+    struct save_data * data = user_data;
+    struct gatt_cache_rec * rec;
+    uint16_t start, end;
+    bool primary;
+    bt_uuid_t uuid;
+
+    /* a service still being discovered is left out */
+    if (!gatt_db_service_get_active(attr))
+        return;
+
+    if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+                                            &uuid)) {
+        data->failed = true;
+        return;
+    }
+
+    rec = save_rec(data, primary ? GATT_CACHE_PRIMARY : GATT_CACHE_SECONDARY,
+                   start, &uuid);
+    if (!rec)
+        return;
+
+    rec->handle2 = htobs(end);
+
+    /* includes precede characteristics, each followed by its descriptors */
+    gatt_db_service_foreach_incl(attr, save_incl, data);
+    gatt_db_service_foreach_char(attr, save_chrc, data);
+}
+
+static int write_all(int fd, const void * buf, size_t len) {
+    const uint8_t * p = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        p += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * write the active services of a db, the file is replaced atomically
+ *
+ * @param db	database
+ * @param hash	Database Hash value or NULL if the server has none
+ * @param path	cache file
+ * @return 0 or -errno
+ */
+int gatt_cache_save(struct gatt_db * db, const uint8_t * hash,
+                    const char * path) {
+    struct save_data data;
+    struct gatt_cache_hdr hdr;
+    char * tmp;
+    int fd, err;
+
+    if (!db || !path)
+        return -EINVAL;
+
+    memset(&data, 0, sizeof(data));
+    gatt_db_foreach_service(db, NULL, save_service, &data);
+    if (data.failed) {
+        free(data.recs);
+        return -ENOMEM;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GATT_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = GATT_CACHE_VERSION;
+    hdr.count = htobs(data.count);
+    if (hash) {
+        hdr.has_hash = 1;
+        memcpy(hdr.hash, hash, GATT_CACHE_HASH_SIZE);
+    }
+
+    if (asprintf(&tmp, "%s.tmp", path) < 0) {
+        free(data.recs);
+        return -ENOMEM;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        err = -errno;
+        goto done;
+    }
+
+    err = write_all(fd, &hdr, sizeof(hdr));
+    if (!err)
+        err = write_all(fd, data.recs, data.count * sizeof(*data.recs));
+
+    if (close(fd) < 0 && !err)
+        err = -errno;
+
+    if (!err && rename(tmp, path) < 0)
+        err = -errno;
+
+    if (err)
+        unlink(tmp);
+
+done:
+    free(tmp);
+    free(data.recs);
+    return err;
+}
+
+static bool load_uuid(const struct gatt_cache_rec * rec, bt_uuid_t * uuid) {
+    uint128_t u128;
+
+    switch (rec->uuid_len) {
+        case 2:
+            bt_uuid16_create(uuid, get_le16(rec->uuid));
+            return true;
+        case 4:
+            bt_uuid32_create(uuid, get_le32(rec->uuid));
+            return true;
+        case 16:
+            bswap_128(rec->uuid, &u128);
+            bt_uuid128_create(uuid, u128);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool load_service(struct gatt_db * db,
+                         const struct gatt_cache_rec * rec) {
+    uint16_t start = btohs(rec->handle);
+    uint16_t end = btohs(rec->handle2);
+    bt_uuid_t uuid;
+
+    if (!start || end < start || !load_uuid(rec, &uuid))
+        return false;
+
+    return gatt_db_insert_service(db, start, &uuid,
+                                  rec->type == GATT_CACHE_PRIMARY,
+                                  end - start + 1) != NULL;
+}
+
+static bool load_attr(struct gatt_db * db, struct gatt_db_attribute * svc,
+                      const struct gatt_cache_rec * rec) {
+    struct gatt_db_attribute * attr;
+    uint16_t handle = btohs(rec->handle);
+    bt_uuid_t uuid;
+
+    switch (rec->type) {
+        case GATT_CACHE_INCLUDE:
+            attr = gatt_db_get_attribute(db, btohs(rec->handle2));
+            if (!attr)
+                return false;
+
+            attr = gatt_db_service_add_included(svc, attr);
+            break;
+        case GATT_CACHE_CHRC:
+            if (!load_uuid(rec, &uuid))
+                return false;
+
+            /* the value attribute is returned, one after the declaration */
+            attr = gatt_db_service_insert_characteristic(svc,
+                    btohs(rec->handle2), &uuid, 0,
+                    rec->properties, NULL, NULL, NULL);
+            handle = btohs(rec->handle2);
+            break;
+        case GATT_CACHE_DESC:
+            if (!load_uuid(rec, &uuid))
+                return false;
+
+            attr = gatt_db_service_insert_descriptor(svc, handle, &uuid, 0,
+                    NULL, NULL, NULL);
+            break;
+        default:
+            return false;
+    }
+
+    return attr && gatt_db_attribute_get_handle(attr) == handle;
+}
+
+static void activate_service(struct gatt_db_attribute * attr,
+                             __attribute__((unused)) void * user_data) {
+    gatt_db_service_set_active(attr, true);
+}
+
+/**
+ * rebuild a db from a cache file
+ *
+ * @param path		cache file
+ * @param hash		filled with the saved Database Hash
+ * @param has_hash	set if the file holds a Database Hash
+ * @return new db with every service active or NULL
+ */
+struct gatt_db * gatt_cache_load(const char * path, uint8_t * hash,
+                                 bool * has_hash) {
+    const struct gatt_cache_hdr * hdr;
+    const struct gatt_cache_rec * recs;
+    struct gatt_db_attribute * svc = NULL;
+    struct gatt_db * db = NULL;
+    struct stat st;
+    void * map;
+    unsigned int count, i;
+    int fd;
+
+    if (!path)
+        return NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = map;
+    recs = (const struct gatt_cache_rec *)(hdr + 1);
+    count = btohs(hdr->count);
+
+    if (memcmp(hdr->magic, GATT_CACHE_MAGIC, sizeof(hdr->magic)) ||
+            hdr->version != GATT_CACHE_VERSION ||
+            (size_t) st.st_size != sizeof(*hdr) + count * sizeof(*recs))
+        goto done;
+
+    db = gatt_db_new();
+    if (!db)
+        goto done;
+
+    for (i = 0; i < count; i++) {
+        if (recs[i].type != GATT_CACHE_PRIMARY &&
+                recs[i].type != GATT_CACHE_SECONDARY)
+            continue;
+
+        if (!load_service(db, &recs[i]))
+            goto fail;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (recs[i].type == GATT_CACHE_PRIMARY ||
+                recs[i].type == GATT_CACHE_SECONDARY) {
+            svc = gatt_db_get_attribute(db, btohs(recs[i].handle));
+            continue;
+        }
+
+        if (!svc || !load_attr(db, svc, &recs[i]))
+            goto fail;
+    }
+
+    gatt_db_foreach_service(db, NULL, activate_service, NULL);
+
+    if (has_hash)
+        *has_hash = hdr->has_hash;
+    if (hash && hdr->has_hash)
+        memcpy(hash, hdr->hash, GATT_CACHE_HASH_SIZE);
+
+    goto done;
+
+fail:
+    gatt_db_unref(db);
+    db = NULL;
+
+done:
+    munmap(map, st.st_size);
+    return db;
+}
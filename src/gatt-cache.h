@@ -0,0 +1,21 @@
+/**
+ * @file gatt-cache.h
+ * @brief persistent gatt_db cache, one file per remote device
+ * @see gatt-cache.c
+ */
+#ifndef SRC_GATT_CACHE_H
+#define SRC_GATT_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GATT_CACHE_HASH_SIZE	16
+
+struct gatt_db;
+
+int gatt_cache_save(struct gatt_db * db, const uint8_t * hash,
+                    const char * path);
+struct gatt_db * gatt_cache_load(const char * path, uint8_t * hash,
+                                 bool * has_hash);
+
+#endif //SRC_GATT_CACHE_H
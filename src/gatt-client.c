@@ -55,6 +55,8 @@
 
 #define GATT_SVC_UUID	0x1801
 #define SVC_CHNGD_UUID	0x2a05
+#define DB_HASH_UUID	0x2b2a
+#define DB_HASH_SIZE	16
 
 /**
  * @brief bluetooth GATT client structure
@@ -94,6 +96,10 @@ struct bt_gatt_client {
     struct queue * notify_list;
     /**< List of registered disconnect/notification/indication callbacks */
     struct queue * notify_chrcs;
+    struct notify_chrc ** notify_index;
+    /**< notify_chrcs by value handle, open addressing, linear probing */
+    unsigned int notify_index_size;
+    unsigned int notify_index_count;
     int next_reg_id;
     unsigned int disc_id;
     /**< Handle of the GATT Service
@@ -122,6 +128,16 @@ struct bt_gatt_client {
     unsigned int next_request_id;
     struct bt_gatt_request * discovery_req;
     unsigned int mtu_req_id;
+    uint8_t db_hash[DB_HASH_SIZE];
+    /**< Database Hash the cached db was saved with */
+    bool db_hash_valid;
+    struct queue * disc_jobs;
+    /**< Service ranges whose characteristics are being discovered */
+    unsigned int disc_window;
+    /**< Most disc_jobs in flight, 0 for one per ATT bearer */
+    bt_uuid_t * svc_filter;
+    /**< Primary services discovered, NULL to discover the whole server */
+    unsigned int svc_filter_count;
 };
 
 /**
@@ -194,6 +210,11 @@ struct notify_chrc {
     uint16_t properties;
     int notify_count;  /* Reference count of registered notify callbacks */
 
+    /* notify_data of client->notify_list registered for this value handle,
+     * a notification only walks this list
+     */
+    struct queue * notify_list;
+
     /* Pending calls to register_notify are queued here so that they can be
      * processed after a write that modifies the CCC descriptor.
      */
@@ -246,6 +267,138 @@ static void find_ccc(struct gatt_db_attribute * attr, void * user_data) {
     *ccc_ptr = attr;
 }
 
+#define NOTIFY_INDEX_MIN_SIZE	16
+
+static unsigned int notify_index_slot(struct bt_gatt_client * client,
+                                      uint16_t value_handle) {
+    /*
+     * Fibonacci hashing, the top bits of the product by 2^32 / phi spread
+     * the consecutive handles of a service over the table
+     */
+    return ((uint32_t) value_handle * 2654435769U) >>
+           (32 - __builtin_ctz(client->notify_index_size));
+}
+
+/**
+ * find the notify_chrc of a value handle
+ *
+ * @param client	client
+ * @param value_handle	characteristic value handle
+ * @return chrc or NULL
+ */
+static struct notify_chrc * notify_index_find(struct bt_gatt_client * client,
+        uint16_t value_handle) {
+    struct notify_chrc * chrc;
+    unsigned int i;
+
+    if (!client->notify_index_count)
+        return NULL;
+
+    i = notify_index_slot(client, value_handle);
+    while ((chrc = client->notify_index[i])) {
+        if (chrc->value_handle == value_handle)
+            return chrc;
+
+        i = (i + 1) & (client->notify_index_size - 1);
+    }
+
+    return NULL;
+}
+
+static void notify_index_insert(struct bt_gatt_client * client,
+                                struct notify_chrc * chrc) {
+    unsigned int i = notify_index_slot(client, chrc->value_handle);
+
+    while (client->notify_index[i])
+        i = (i + 1) & (client->notify_index_size - 1);
+
+    client->notify_index[i] = chrc;
+    client->notify_index_count++;
+}
+
+/**
+ * index a new notify_chrc, the table is kept at most half full
+ *
+ * @param client	client
+ * @param chrc		chrc not in the index yet
+ * @return false on allocation failure
+ */
+static bool notify_index_add(struct bt_gatt_client * client,
+                             struct notify_chrc * chrc) {
+    struct notify_chrc ** old = client->notify_index;
+    unsigned int old_size = client->notify_index_size;
+    unsigned int size, i;
+
+    if ((client->notify_index_count + 1) * 2 > old_size) {
+        size = old_size ? old_size * 2 : NOTIFY_INDEX_MIN_SIZE;
+        if (size > 2 * (UINT16_MAX + 1))
+            return false;
+
+        client->notify_index = new0(struct notify_chrc *, size);
+        if (!client->notify_index) {
+            client->notify_index = old;
+            return false;
+        }
+
+        client->notify_index_size = size;
+        client->notify_index_count = 0;
+
+        for (i = 0; i < old_size; i++) {
+            if (old[i])
+                notify_index_insert(client, old[i]);
+        }
+
+        free(old);
+    }
+
+    notify_index_insert(client, chrc);
+
+    return true;
+}
+
+static void notify_index_remove(struct bt_gatt_client * client,
+                                struct notify_chrc * chrc) {
+    unsigned int mask = client->notify_index_size - 1;
+    unsigned int i, j, home;
+
+    if (!client->notify_index_count)
+        return;
+
+    i = notify_index_slot(client, chrc->value_handle);
+    while (client->notify_index[i] != chrc) {
+        if (!client->notify_index[i])
+            return;
+
+        i = (i + 1) & mask;
+    }
+
+    /* backward shift: move up the entries of the run that probed past i */
+    j = i;
+    while (1) {
+        client->notify_index[i] = NULL;
+
+        while (1) {
+            j = (j + 1) & mask;
+            if (!client->notify_index[j])
+                goto done;
+
+            home = notify_index_slot(client,
+                                     client->notify_index[j]->value_handle);
+            /* keep it if its home slot lies cyclically in (i, j] */
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+                continue;
+
+            break;
+        }
+
+        client->notify_index[i] = client->notify_index[j];
+        i = j;
+    }
+
+done:
+    client->notify_index_count--;
+}
+
 static struct notify_chrc * notify_chrc_create(struct bt_gatt_client * client,
         uint16_t value_handle) {
     struct gatt_db_attribute * attr, *ccc;
@@ -276,6 +429,13 @@ static struct notify_chrc * notify_chrc_create(struct bt_gatt_client * client,
         return NULL;
     }
 
+    chrc->notify_list = queue_new();
+    if (!chrc->notify_list) {
+        queue_destroy(chrc->reg_notify_queue, NULL);
+        free(chrc);
+        return NULL;
+    }
+
     /*
      * Find the CCC characteristic. Some characteristics that allow
      * notifications may not have a CCC descriptor. We treat these as
@@ -289,6 +449,13 @@ static struct notify_chrc * notify_chrc_create(struct bt_gatt_client * client,
     chrc->value_handle = value_handle;
     chrc->properties = properties;
 
+    if (!notify_index_add(client, chrc)) {
+        queue_destroy(chrc->notify_list, NULL);
+        queue_destroy(chrc->reg_notify_queue, NULL);
+        free(chrc);
+        return NULL;
+    }
+
     queue_push_tail(client->notify_chrcs, chrc);
 
     return chrc;
@@ -297,10 +464,34 @@ static struct notify_chrc * notify_chrc_create(struct bt_gatt_client * client,
 static void notify_chrc_free(void * data) {
     struct notify_chrc * chrc = data;
 
+    queue_destroy(chrc->notify_list, NULL);
     queue_destroy(chrc->reg_notify_queue, notify_data_unref);
     free(chrc);
 }
 
+/**
+ * add a registration to the client list and to the list of its chrc
+ */
+static void notify_list_add(struct bt_gatt_client * client,
+                            struct notify_data * notify_data) {
+    queue_push_tail(client->notify_list, notify_data);
+    queue_push_tail(notify_data->chrc->notify_list, notify_data);
+}
+
+static void notify_list_remove(struct bt_gatt_client * client,
+                               struct notify_data * notify_data) {
+    queue_remove(client->notify_list, notify_data);
+    queue_remove(notify_data->chrc->notify_list, notify_data);
+}
+
+/* queue_remove_all destroy function of client->notify_list */
+static void notify_data_remove_unref(void * data) {
+    struct notify_data * notify_data = data;
+
+    queue_remove(notify_data->chrc->notify_list, notify_data);
+    notify_data_unref(notify_data);
+}
+
 static bool match_notify_data_id(const void * a, const void * b) {
     const struct notify_data * notify_data = a;
     unsigned int id = PTR_TO_UINT(b);
@@ -339,19 +530,23 @@ static void gatt_client_remove_all_notify_in_range(
     range.end = end_handle;
 
     queue_remove_all(client->notify_list, match_notify_data_handle_range,
-                     &range, notify_data_unref);
+                     &range, notify_data_remove_unref);
 }
 
 static void gatt_client_remove_notify_chrcs_in_range(
     struct bt_gatt_client * client,
     uint16_t start_handle, uint16_t end_handle) {
     struct handle_range range;
+    struct notify_chrc * chrc;
 
     range.start = start_handle;
     range.end = end_handle;
 
-    queue_remove_all(client->notify_chrcs, match_notify_chrc_handle_range,
-                     &range, notify_chrc_free);
+    while ((chrc = queue_remove_if(client->notify_chrcs,
+                                   match_notify_chrc_handle_range, &range))) {
+        notify_index_remove(client, chrc);
+        notify_chrc_free(chrc);
+    }
 }
 
 struct discovery_op;
@@ -364,12 +559,15 @@ typedef void (*discovery_op_fail_func_t)(struct discovery_op * op);
 struct discovery_op {
     struct bt_gatt_client * client;
     struct queue * pending_svcs;
-    struct queue * pending_chrcs;
     struct queue * tmp_queue;
     struct gatt_db_attribute * cur_svc;
+    unsigned int jobs;
+    /**< discovery_job of the op in flight */
     bool success;
     uint16_t start;
     uint16_t end;
+    unsigned int filter_idx;
+    /**< svc_filter entry looked up, filtered discovery only */
     int ref_count;
     discovery_op_complete_func_t complete_func;
     discovery_op_fail_func_t failure_func;
@@ -377,7 +575,6 @@ struct discovery_op {
 
 static void discovery_op_free(struct discovery_op * op) {
     queue_destroy(op->pending_svcs, NULL);
-    queue_destroy(op->pending_chrcs, free);
     queue_destroy(op->tmp_queue, NULL);
     free(op);
 }
@@ -396,10 +593,6 @@ static struct discovery_op * discovery_op_create(struct bt_gatt_client * client,
     if (!op->pending_svcs)
         goto fail;
 
-    op->pending_chrcs = queue_new();
-    if (!op->pending_chrcs)
-        goto fail;
-
     op->tmp_queue = queue_new();
     if (!op->tmp_queue)
         goto fail;
@@ -443,9 +636,7 @@ static void discovery_req_clear(struct bt_gatt_client * client) {
     client->discovery_req = NULL;
 }
 
-static void discover_chrcs_cb(bool success, uint8_t att_ecode,
-                              struct bt_gatt_result * result,
-                              void * user_data);
+static void discovery_schedule(struct discovery_op * op);
 
 static void discover_incl_cb(bool success, uint8_t att_ecode,
                              struct bt_gatt_result * result, void * user_data) {
@@ -529,28 +720,11 @@ next:
          * We have processed all include definitions. Move on to
          * characteristics.
          */
-        attr = queue_pop_head(op->pending_svcs);
-        if (!attr)
-            goto failed;
-
-        if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
+        if (queue_isempty(op->pending_svcs))
             goto failed;
 
-        op->cur_svc = attr;
-
-        client->discovery_req = bt_gatt_discover_characteristics(
-                                    client->att,
-                                    start, end,
-                                    discover_chrcs_cb,
-                                    discovery_op_ref(op),
-                                    discovery_op_unref);
-        if (client->discovery_req)
-            return;
-
-        util_debug(client->debug_callback, client->debug_data,
-                   "Failed to start characteristic discovery");
-        discovery_op_unref(op);
-        goto failed;
+        discovery_schedule(op);
+        return;
     }
 
     queue_push_tail(op->tmp_queue, attr);
@@ -586,20 +760,194 @@ struct chrc {
     bt_uuid_t uuid;
 };
 
-static void discover_descs_cb(bool success, uint8_t att_ecode,
+/**
+ * @brief characteristics and descriptors discovery of one service
+ *
+ * a discovery op runs up to a window of jobs at once, each one on its own
+ * service range, their results are merged into the db as they come
+ */
+struct discovery_job {
+    struct discovery_op * op;
+    /**< discovery the job belongs to, referenced */
+    struct gatt_db_attribute * svc;
+    /**< service being discovered */
+    struct queue * pending_chrcs;
+    /**< characteristics found, inserted as their descriptors are known */
+    struct bt_gatt_request * req;
+    /**< request in flight */
+};
+
+static void discovery_job_free(void * data) {
+    struct discovery_job * job = data;
+    struct discovery_op * op = job->op;
+
+    if (job->req) {
+        /* requests are already gone once the bearer is */
+        if (op->client->att)
+            bt_gatt_request_cancel(job->req);
+
+        bt_gatt_request_unref(job->req);
+    }
+
+    queue_destroy(job->pending_chrcs, free);
+    op->jobs--;
+    free(job);
+
+    discovery_op_unref(op);
+}
+
+static bool match_job_op(const void * a, const void * b) {
+    const struct discovery_job * job = a;
+
+    return job->op == b;
+}
+
+static void discovery_job_req_clear(struct discovery_job * job) {
+    if (!job->req)
+        return;
+
+    bt_gatt_request_unref(job->req);
+    job->req = NULL;
+}
+
+static void discover_chrcs_cb(bool success, uint8_t att_ecode,
                               struct bt_gatt_result * result,
                               void * user_data);
 
-static bool discover_descs(struct discovery_op * op, bool * discovering) {
+static bool discovery_job_start(struct discovery_op * op,
+                                struct gatt_db_attribute * attr,
+                                uint16_t start, uint16_t end) {
+    struct bt_gatt_client * client = op->client;
+    struct discovery_job * job;
+
+    job = new0(struct discovery_job, 1);
+    if (!job)
+        return false;
+
+    job->pending_chrcs = queue_new();
+    if (!job->pending_chrcs) {
+        free(job);
+        return false;
+    }
+
+    job->op = discovery_op_ref(op);
+    job->svc = attr;
+    op->jobs++;
+
+    job->req = bt_gatt_discover_characteristics(client->att, start, end,
+                                                discover_chrcs_cb, job,
+                                                NULL);
+    if (!job->req) {
+        util_debug(client->debug_callback, client->debug_data,
+                   "Failed to start characteristic discovery");
+        discovery_job_free(job);
+        return false;
+    }
+
+    queue_push_tail(client->disc_jobs, job);
+
+    return true;
+}
+
+static void discovery_fail(struct discovery_op * op, uint8_t att_ecode) {
     struct bt_gatt_client * client = op->client;
+
+    /* the jobs hold a reference, op may go away with the last one */
+    discovery_op_ref(op);
+
+    queue_remove_all(op->pending_svcs, NULL, NULL, NULL);
+    queue_remove_all(client->disc_jobs, match_job_op, op,
+                     discovery_job_free);
+
+    op->success = false;
+    op->complete_func(op, false, att_ecode);
+
+    discovery_op_unref(op);
+}
+
+/**
+ * start the characteristics discovery of the pending services, keeping up
+ * to the discovery window of them in flight, and complete op once all are
+ * done. The window defaults to one job per ATT bearer.
+ *
+ * @param op	discovery operation
+ */
+static void discovery_schedule(struct discovery_op * op) {
+    struct bt_gatt_client * client = op->client;
+    struct gatt_db_attribute * attr;
+    unsigned int window;
+    uint16_t start, end;
+
+    window = client->disc_window;
+    if (!window)
+        window = MAX(bt_att_get_channels(client->att), 1);
+
+    while (op->jobs < window &&
+            (attr = queue_pop_head(op->pending_svcs))) {
+        if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
+            goto failed;
+
+        if (start == end) {
+            gatt_db_service_set_active(attr, true);
+            continue;
+        }
+
+        if (!discovery_job_start(op, attr, start, end))
+            goto failed;
+    }
+
+    if (op->jobs)
+        return;
+
+    op->success = true;
+    op->complete_func(op, true, 0);
+    return;
+
+failed:
+    discovery_fail(op, 0);
+}
+
+/**
+ * the service of job is fully discovered, move on to the next one
+ */
+static void discovery_job_done(struct discovery_job * job) {
+    struct discovery_op * op = job->op;
+
+    gatt_db_service_set_active(job->svc, true);
+
+    discovery_op_ref(op);
+    queue_remove(op->client->disc_jobs, job);
+    discovery_job_free(job);
+
+    discovery_schedule(op);
+    discovery_op_unref(op);
+}
+
+static void discovery_job_fail(struct discovery_job * job, uint8_t att_ecode) {
+    struct discovery_op * op = job->op;
+
+    discovery_op_ref(op);
+    queue_remove(op->client->disc_jobs, job);
+    discovery_job_free(job);
+
+    discovery_fail(op, att_ecode);
+    discovery_op_unref(op);
+}
+
+static void discover_descs_cb(bool success, uint8_t att_ecode,
+                              struct bt_gatt_result * result,
+                              void * user_data);
+
+static bool discover_descs(struct discovery_job * job, bool * discovering) {
+    struct bt_gatt_client * client = job->op->client;
     struct gatt_db_attribute * attr;
     struct chrc * chrc_data;
     uint16_t desc_start;
 
     *discovering = false;
 
-    while ((chrc_data = queue_pop_head(op->pending_chrcs))) {
-        attr = gatt_db_service_insert_characteristic(op->cur_svc,
+    while ((chrc_data = queue_pop_head(job->pending_chrcs))) {
+        attr = gatt_db_service_insert_characteristic(job->svc,
                 chrc_data->value_handle,
                 &chrc_data->uuid, 0,
                 chrc_data->properties,
@@ -623,20 +971,17 @@ static bool discover_descs(struct discovery_op * op, bool * discovering) {
         }
         desc_start = chrc_data->value_handle + 1;
 
-        client->discovery_req = bt_gatt_discover_descriptors(
-                                    client->att, desc_start,
-                                    chrc_data->end_handle,
-                                    discover_descs_cb,
-                                    discovery_op_ref(op),
-                                    discovery_op_unref);
-        if (client->discovery_req) {
+        job->req = bt_gatt_discover_descriptors(client->att, desc_start,
+                                                chrc_data->end_handle,
+                                                discover_descs_cb, job,
+                                                NULL);
+        if (job->req) {
             *discovering = true;
             goto done;
         }
 
         util_debug(client->debug_callback, client->debug_data,
                    "Failed to start descriptor discovery");
-        discovery_op_unref(op);
 
         goto failed;
     }
@@ -653,24 +998,22 @@ failed:
 static void discover_descs_cb(bool success, uint8_t att_ecode,
                               struct bt_gatt_result * result,
                               void * user_data) {
-    struct discovery_op * op = user_data;
-    struct bt_gatt_client * client = op->client;
+    struct discovery_job * job = user_data;
+    struct bt_gatt_client * client = job->op->client;
     struct bt_gatt_iter iter;
     struct gatt_db_attribute * attr;
-    uint16_t handle, start, end;
+    uint16_t handle;
     uint128_t u128;
     bt_uuid_t uuid;
     char uuid_str[MAX_LEN_UUID_STR];
     unsigned int desc_count;
     bool discovering;
 
-    discovery_req_clear(client);
+    discovery_job_req_clear(job);
 
     if (!success) {
-        if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-            success = true;
+        if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
             goto next;
-        }
 
         goto done;
     }
@@ -694,7 +1037,7 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
                    "handle: 0x%04x, uuid: %s",
                    handle, uuid_str);
 
-        attr = gatt_db_service_insert_descriptor(op->cur_svc, handle,
+        attr = gatt_db_service_insert_descriptor(job->svc, handle,
                 &uuid, 0, NULL, NULL,
                 NULL);
         if (!attr)
@@ -705,55 +1048,29 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
     }
 
 next:
-    if (!discover_descs(op, &discovering))
+    if (!discover_descs(job, &discovering))
         goto failed;
 
     if (discovering)
         return;
 
     /* Done with the current service */
-    gatt_db_service_set_active(op->cur_svc, true);
-
-    attr = queue_pop_head(op->pending_svcs);
-    if (!attr)
-        goto done;
-
-    if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
-        goto failed;
-
-    if (start == end)
-        goto next;
-
-    /* Move on to the next service */
-    op->cur_svc = attr;
-
-    client->discovery_req = bt_gatt_discover_characteristics(client->att,
-                            start, end,
-                            discover_chrcs_cb,
-                            discovery_op_ref(op),
-                            discovery_op_unref);
-    if (client->discovery_req)
-        return;
-
-    util_debug(client->debug_callback, client->debug_data,
-               "Failed to start characteristic discovery");
-    discovery_op_unref(op);
+    discovery_job_done(job);
+    return;
 
 failed:
-    success = false;
+    att_ecode = 0;
 
 done:
-    op->success = success;
-    op->complete_func(op, success, att_ecode);
+    discovery_job_fail(job, att_ecode);
 }
 
 static void discover_chrcs_cb(bool success, uint8_t att_ecode,
                               struct bt_gatt_result * result,
                               void * user_data) {
-    struct discovery_op * op = user_data;
-    struct bt_gatt_client * client = op->client;
+    struct discovery_job * job = user_data;
+    struct bt_gatt_client * client = job->op->client;
     struct bt_gatt_iter iter;
-    struct gatt_db_attribute * attr;
     struct chrc * chrc_data;
     uint16_t start, end, value;
     uint8_t properties;
@@ -763,18 +1080,16 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
     unsigned int chrc_count;
     bool discovering;
 
-    discovery_req_clear(client);
+    discovery_job_req_clear(job);
 
     if (!success) {
-        if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-            success = true;
+        if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
             goto next;
-        }
 
         goto done;
     }
 
-    if (!op->cur_svc || !result || !bt_gatt_iter_init(&iter, result))
+    if (!result || !bt_gatt_iter_init(&iter, result))
         goto failed;
 
     chrc_count = bt_gatt_result_characteristic_count(result);
@@ -805,14 +1120,14 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
         chrc_data->properties = properties;
         chrc_data->uuid = uuid;
 
-        queue_push_tail(op->pending_chrcs, chrc_data);
+        queue_push_tail(job->pending_chrcs, chrc_data);
     }
 
     /*
      * Sequentially discover descriptors for each characteristic and insert
      * the characteristics into the database as we proceed.
      */
-    if (!discover_descs(op, &discovering))
+    if (!discover_descs(job, &discovering))
         goto failed;
 
     if (discovering)
@@ -820,39 +1135,14 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 
 next:
     /* Done with the current service */
-    gatt_db_service_set_active(op->cur_svc, true);
-
-    attr = queue_pop_head(op->pending_svcs);
-    if (!attr)
-        goto done;
-
-    if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
-        goto failed;
-
-    if (start == end)
-        goto next;
-
-    /* Move on to the next service */
-    op->cur_svc = attr;
-
-    client->discovery_req = bt_gatt_discover_characteristics(client->att,
-                            start, end,
-                            discover_chrcs_cb,
-                            discovery_op_ref(op),
-                            discovery_op_unref);
-    if (client->discovery_req)
-        return;
-
-    util_debug(client->debug_callback, client->debug_data,
-               "Failed to start characteristic discovery");
-    discovery_op_unref(op);
+    discovery_job_done(job);
+    return;
 
 failed:
-    success = false;
+    att_ecode = 0;
 
 done:
-    op->success = success;
-    op->complete_func(op, success, att_ecode);
+    discovery_job_fail(job, att_ecode);
 }
 
 static void discover_secondary_cb(bool success, uint8_t att_ecode,
@@ -916,53 +1206,278 @@ static void discover_secondary_cb(bool success, uint8_t att_ecode,
             }
         }
 
-        /* Skip if service already active */
-        if (!gatt_db_service_get_active(attr))
-            queue_push_tail(op->pending_svcs, attr);
-    }
+        /* Skip if service already active */
+        if (!gatt_db_service_get_active(attr))
+            queue_push_tail(op->pending_svcs, attr);
+    }
+
+next:
+    /* Sequentially discover included services */
+    attr = queue_pop_head(op->pending_svcs);
+
+    /* Complete with success if queue is empty */
+    if (!attr) {
+        success = true;
+        goto done;
+    }
+
+    /*
+     * Store the service in the tmp queue to be reused during
+     * characteristics discovery later.
+     */
+    queue_push_tail(op->tmp_queue, attr);
+    op->cur_svc = attr;
+
+    if (!gatt_db_attribute_get_service_handles(attr, &start, &end)) {
+        success = false;
+        goto done;
+    }
+
+    client->discovery_req = bt_gatt_discover_included_services(client->att,
+                            start, end,
+                            discover_incl_cb,
+                            discovery_op_ref(op),
+                            discovery_op_unref);
+    if (client->discovery_req)
+        return;
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Failed to start included services discovery");
+    discovery_op_unref(op);
+
+done:
+    op->success = success;
+    op->complete_func(op, success, att_ecode);
+}
+
+struct stale_svc_data {
+    struct bt_gatt_result * result;
+    struct queue * stale;
+};
+
+/**
+ * collect primary services of a restored db the server no longer lists
+ */
+static void find_stale_service(struct gatt_db_attribute * attr, void * user_data) {
+    struct stale_svc_data * data = user_data;
+    struct bt_gatt_iter iter;
+    uint16_t start, end, svc_start, svc_end;
+    uint128_t u128;
+    bool primary;
+
+    if (!gatt_db_attribute_get_service_data(attr, &svc_start, &svc_end,
+                                            &primary, NULL) || !primary)
+        return;
+
+    if (!bt_gatt_iter_init(&iter, data->result))
+        return;
+
+    while (bt_gatt_iter_next_service(&iter, &start, &end, u128.data)) {
+        if (start == svc_start && end == svc_end)
+            return;
+    }
+
+    queue_push_tail(data->stale, attr);
+}
+
+static void remove_stale_service(void * data, void * user_data) {
+    struct gatt_db_attribute * attr = data;
+    struct bt_gatt_client * client = user_data;
+    uint16_t start, end;
+
+    gatt_db_attribute_get_service_handles(attr, &start, &end);
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Removing stale service: start: 0x%04x, end: 0x%04x",
+               start, end);
+
+    gatt_db_remove_service(client->db, attr);
+}
+
+/**
+ * drop the primary services of a restored db that are not in result, the
+ * changed ones are replaced by discover_primary_cb itself
+ */
+static void remove_stale_services(struct bt_gatt_client * client,
+                                  struct bt_gatt_result * result) {
+    struct stale_svc_data data;
+
+    data.result = result;
+    data.stale = queue_new();
+    if (!data.stale)
+        return;
+
+    gatt_db_foreach_service(client->db, NULL, find_stale_service, &data);
+    queue_foreach(data.stale, remove_stale_service, client);
+    queue_destroy(data.stale, NULL);
+}
+
+static void discover_primary_cb(bool success, uint8_t att_ecode,
+                                struct bt_gatt_result * result,
+                                void * user_data) {
+    struct discovery_op * op = user_data;
+    struct bt_gatt_client * client = op->client;
+    struct bt_gatt_iter iter;
+    struct gatt_db_attribute * attr;
+    uint16_t start, end;
+    uint128_t u128;
+    bt_uuid_t uuid;
+    char uuid_str[MAX_LEN_UUID_STR];
+
+    discovery_req_clear(client);
+
+    if (!success) {
+        util_debug(client->debug_callback, client->debug_data,
+                   "Primary service discovery failed."
+                   " ATT ECODE: 0x%02x", att_ecode);
+        goto secondary;
+    }
+
+    if (!result || !bt_gatt_iter_init(&iter, result)) {
+        success = false;
+        goto done;
+    }
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Primary services found: %u",
+               bt_gatt_result_service_count(result));
+
+    /* a full discovery over a restored db: forget what is gone */
+    if (op->start == 0x0001 && op->end == 0xffff &&
+            !gatt_db_isempty(client->db))
+        remove_stale_services(client, result);
+
+    while (bt_gatt_iter_next_service(&iter, &start, &end, u128.data)) {
+        bt_uuid128_create(&uuid, u128);
+
+        /* Log debug message. */
+        bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+        util_debug(client->debug_callback, client->debug_data,
+                   "start: 0x%04x, end: 0x%04x, uuid: %s",
+                   start, end, uuid_str);
+
+        attr = gatt_db_insert_service(client->db, start, &uuid, true,
+                                      end - start + 1);
+        if (!attr) {
+            gatt_db_clear_range(client->db, start, end);
+            attr = gatt_db_insert_service(client->db, start, &uuid,
+                                          true, end - start + 1);
+            if (!attr) {
+                util_debug(client->debug_callback,
+                           client->debug_data,
+                           "Failed to store service");
+                success = false;
+                goto done;
+            }
+        }
+
+        /* Skip if service already active */
+        if (!gatt_db_service_get_active(attr))
+            queue_push_tail(op->pending_svcs, attr);
+    }
+
+secondary:
+    /*
+     * Version 4.2 [Vol 1, Part A] page 101:
+     * A secondary service is a service that provides auxiliary
+     * functionality of a device and is referenced from at least one
+     * primary service on the device.
+     */
+    if (queue_isempty(op->pending_svcs))
+        goto done;
+
+    /* Discover secondary services */
+    client->discovery_req = bt_gatt_discover_secondary_services(client->att,
+                            NULL, op->start, op->end,
+                            discover_secondary_cb,
+                            discovery_op_ref(op),
+                            discovery_op_unref);
+    if (client->discovery_req)
+        return;
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Failed to start secondary service discovery");
+    discovery_op_unref(op);
+    success = false;
+
+done:
+    op->success = success;
+    op->complete_func(op, success, att_ecode);
+}
+
+static void notify_client_ready(struct bt_gatt_client * client, bool success,
+                                uint8_t att_ecode) {
+    if (!client->ready_callback || client->ready)
+        return;
+
+    bt_gatt_client_ref(client);
+    client->ready = success;
+    client->ready_callback(success, att_ecode, client->ready_data);
+    bt_gatt_client_unref(client);
+}
+
+/**
+ * start a full primary service discovery, with a restored db only the
+ * services that changed are discovered further
+ *
+ * @param op	init discovery operation
+ * @return true if the request was sent
+ */
+static bool discover_all_primary(struct discovery_op * op) {
+    struct bt_gatt_client * client = op->client;
+
+    client->discovery_req = bt_gatt_discover_all_primary_services(
+                                client->att, NULL,
+                                discover_primary_cb,
+                                discovery_op_ref(op),
+                                discovery_op_unref);
+    if (client->discovery_req)
+        return true;
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Failed to initiate primary service discovery");
+
+    discovery_op_unref(op);
+
+    return false;
+}
 
-next:
-    /* Sequentially discover included services */
-    attr = queue_pop_head(op->pending_svcs);
+struct unlisted_svc_data {
+    struct queue * listed;
+    struct queue * stale;
+};
 
-    /* Complete with success if queue is empty */
-    if (!attr) {
-        success = true;
-        goto done;
-    }
+static void find_unlisted_service(struct gatt_db_attribute * attr,
+                                  void * user_data) {
+    struct unlisted_svc_data * data = user_data;
 
-    /*
-     * Store the service in the tmp queue to be reused during
-     * characteristics discovery later.
-     */
-    queue_push_tail(op->tmp_queue, attr);
-    op->cur_svc = attr;
+    if (!queue_find(data->listed, NULL, attr))
+        queue_push_tail(data->stale, attr);
+}
 
-    if (!gatt_db_attribute_get_service_handles(attr, &start, &end)) {
-        success = false;
-        goto done;
-    }
+/**
+ * drop the services of a restored db a filtered discovery did not report,
+ * services outside the filter included
+ */
+static void remove_unlisted_services(struct bt_gatt_client * client,
+                                     struct queue * listed) {
+    struct unlisted_svc_data data;
 
-    client->discovery_req = bt_gatt_discover_included_services(client->att,
-                            start, end,
-                            discover_incl_cb,
-                            discovery_op_ref(op),
-                            discovery_op_unref);
-    if (client->discovery_req)
+    data.listed = listed;
+    data.stale = queue_new();
+    if (!data.stale)
         return;
 
-    util_debug(client->debug_callback, client->debug_data,
-               "Failed to start included services discovery");
-    discovery_op_unref(op);
-
-done:
-    op->success = success;
-    op->complete_func(op, success, att_ecode);
+    gatt_db_foreach_service(client->db, NULL, find_unlisted_service, &data);
+    queue_foreach(data.stale, remove_stale_service, client);
+    queue_destroy(data.stale, NULL);
 }
 
-static void discover_primary_cb(bool success, uint8_t att_ecode,
-                                struct bt_gatt_result * result,
-                                void * user_data) {
+static bool discover_filtered_next(struct discovery_op * op);
+
+static void discover_filtered_cb(bool success, uint8_t att_ecode,
+                                 struct bt_gatt_result * result,
+                                 void * user_data) {
     struct discovery_op * op = user_data;
     struct bt_gatt_client * client = op->client;
     struct bt_gatt_iter iter;
@@ -975,20 +1490,19 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
     discovery_req_clear(client);
 
     if (!success) {
+        if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
+            success = true;
+            goto next;
+        }
+
         util_debug(client->debug_callback, client->debug_data,
                    "Primary service discovery failed."
                    " ATT ECODE: 0x%02x", att_ecode);
-        goto secondary;
-    }
-
-    if (!result || !bt_gatt_iter_init(&iter, result)) {
-        success = false;
         goto done;
     }
 
-    util_debug(client->debug_callback, client->debug_data,
-               "Primary services found: %u",
-               bt_gatt_result_service_count(result));
+    if (!result || !bt_gatt_iter_init(&iter, result))
+        goto failed;
 
     while (bt_gatt_iter_next_service(&iter, &start, &end, u128.data)) {
         bt_uuid128_create(&uuid, u128);
@@ -1009,54 +1523,151 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
                 util_debug(client->debug_callback,
                            client->debug_data,
                            "Failed to store service");
-                success = false;
-                goto done;
+                goto failed;
             }
         }
 
+        queue_push_tail(op->tmp_queue, attr);
+
         /* Skip if service already active */
         if (!gatt_db_service_get_active(attr))
             queue_push_tail(op->pending_svcs, attr);
     }
 
-secondary:
+next:
+    if (++op->filter_idx < client->svc_filter_count) {
+        if (discover_filtered_next(op))
+            return;
+
+        goto failed;
+    }
+
+    util_debug(client->debug_callback, client->debug_data,
+               "Filtered services found: %u",
+               queue_length(op->tmp_queue));
+
+    if (op->start == 0x0001 && op->end == 0xffff)
+        remove_unlisted_services(client, op->tmp_queue);
+
     /*
-     * Version 4.2 [Vol 1, Part A] page 101:
-     * A secondary service is a service that provides auxiliary
-     * functionality of a device and is referenced from at least one
-     * primary service on the device.
+     * Included and secondary services are not looked up, the
+     * characteristics of the listed services are discovered right away.
      */
-    if (queue_isempty(op->pending_svcs))
-        goto done;
+    discovery_schedule(op);
+    return;
 
-    /* Discover secondary services */
-    client->discovery_req = bt_gatt_discover_secondary_services(client->att,
-                            NULL, op->start, op->end,
-                            discover_secondary_cb,
+failed:
+    success = false;
+
+done:
+    op->success = success;
+    op->complete_func(op, success, att_ecode);
+}
+
+/**
+ * look up the primary services of the current filter entry within the
+ * range of op with a Find By Type Value request
+ *
+ * @param op	discovery operation
+ * @return true if the request was sent
+ */
+static bool discover_filtered_next(struct discovery_op * op) {
+    struct bt_gatt_client * client = op->client;
+
+    client->discovery_req = bt_gatt_discover_primary_services(client->att,
+                            &client->svc_filter[op->filter_idx],
+                            op->start, op->end,
+                            discover_filtered_cb,
                             discovery_op_ref(op),
                             discovery_op_unref);
     if (client->discovery_req)
-        return;
+        return true;
 
     util_debug(client->debug_callback, client->debug_data,
-               "Failed to start secondary service discovery");
+               "Failed to initiate filtered service discovery");
+
     discovery_op_unref(op);
-    success = false;
 
-done:
-    op->success = success;
-    op->complete_func(op, success, att_ecode);
+    return false;
 }
 
-static void notify_client_ready(struct bt_gatt_client * client, bool success,
-                                uint8_t att_ecode) {
-    if (!client->ready_callback || client->ready)
+/**
+ * start the discovery of op, restricted to the services of the filter
+ * when one is set
+ *
+ * @param op	discovery operation
+ * @return true if the request was sent
+ */
+static bool discover_primary(struct discovery_op * op) {
+    if (!op->client->svc_filter)
+        return discover_all_primary(op);
+
+    op->filter_idx = 0;
+
+    return discover_filtered_next(op);
+}
+
+static void db_hash_read_cb(bool success, __attribute__((unused)) uint8_t att_ecode,
+                            struct bt_gatt_result * result, void * user_data) {
+    struct discovery_op * op = user_data;
+    struct bt_gatt_client * client = op->client;
+    struct bt_gatt_iter iter;
+    const uint8_t * value;
+    uint16_t handle, length;
+
+    discovery_req_clear(client);
+
+    if (success && result && bt_gatt_iter_init(&iter, result) &&
+            bt_gatt_iter_next_read_by_type(&iter, &handle, &length, &value) &&
+            length == DB_HASH_SIZE &&
+            !memcmp(value, client->db_hash, DB_HASH_SIZE)) {
+        util_debug(client->debug_callback, client->debug_data,
+                   "Database Hash unchanged, using cached services");
+        op->success = true;
+        op->complete_func(op, true, 0);
         return;
+    }
 
-    bt_gatt_client_ref(client);
-    client->ready = success;
-    client->ready_callback(success, att_ecode, client->ready_data);
-    bt_gatt_client_unref(client);
+    /*
+     * Services restored with the same range and UUID would be found active
+     * again and keep their stale characteristics, so drop the whole cache
+     * and discover the server from scratch.
+     */
+    util_debug(client->debug_callback, client->debug_data,
+               "Database Hash changed or not available, dropping cache");
+
+    gatt_db_clear(client->db);
+
+    if (discover_primary(op))
+        return;
+
+    op->success = false;
+    op->complete_func(op, false, 0);
+}
+
+/**
+ * read the server Database Hash, if it matches the one the db was cached
+ * with the whole discovery is skipped
+ *
+ * @param op	init discovery operation
+ * @return true if the request was sent
+ */
+static bool read_db_hash(struct discovery_op * op) {
+    struct bt_gatt_client * client = op->client;
+    bt_uuid_t uuid;
+
+    bt_uuid16_create(&uuid, DB_HASH_UUID);
+
+    client->discovery_req = bt_gatt_read_by_type(client->att, 0x0001, 0xffff,
+                            &uuid, db_hash_read_cb,
+                            discovery_op_ref(op),
+                            discovery_op_unref);
+    if (client->discovery_req)
+        return true;
+
+    discovery_op_unref(op);
+
+    return false;
 }
 
 static void exchange_mtu_cb(bool success, uint8_t att_ecode, void * user_data) {
@@ -1091,21 +1702,15 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void * user_data) {
                bt_att_get_mtu(client->att));
 
 discover:
-    client->discovery_req = bt_gatt_discover_all_primary_services(
-                                client->att, NULL,
-                                discover_primary_cb,
-                                discovery_op_ref(op),
-                                discovery_op_unref);
-    if (client->discovery_req)
+    if (client->db_hash_valid && !gatt_db_isempty(client->db) &&
+            read_db_hash(op))
         return;
 
-    util_debug(client->debug_callback, client->debug_data,
-               "Failed to initiate primary service discovery");
+    if (discover_primary(op))
+        return;
 
     client->in_init = false;
     notify_client_ready(client, false, att_ecode);
-
-    discovery_op_unref(op);
 }
 
 struct service_changed_op {
@@ -1190,7 +1795,7 @@ static void enable_ccc_callback(uint8_t opcode, const void * pdu,
          * the next one in the queue. If there was an error sending the
          * write request, then just move on to the next queued entry.
          */
-        queue_remove(notify_data->client->notify_list, notify_data);
+        notify_list_remove(notify_data->client, notify_data);
         notify_data->callback(att_ecode, notify_data->user_data);
 
         while ((notify_data = queue_pop_head(
@@ -1214,13 +1819,6 @@ static void enable_ccc_callback(uint8_t opcode, const void * pdu,
     bt_gatt_client_unref(notify_data->client);
 }
 
-static bool match_notify_chrc_value_handle(const void * a, const void * b) {
-    const struct notify_chrc * chrc = a;
-    uint16_t value_handle = PTR_TO_UINT(b);
-
-    return chrc->value_handle == value_handle;
-}
-
 static unsigned int register_notify(struct bt_gatt_client * client,
                                     uint16_t handle,
                                     bt_gatt_client_register_callback_t callback,
@@ -1231,8 +1829,7 @@ static unsigned int register_notify(struct bt_gatt_client * client,
     struct notify_chrc * chrc = NULL;
 
     /* Check if a characteristic ref count has been started already */
-    chrc = queue_find(client->notify_chrcs, match_notify_chrc_value_handle,
-                      UINT_TO_PTR(handle));
+    chrc = notify_index_find(client, handle);
 
     if (!chrc) {
         /*
@@ -1261,7 +1858,7 @@ static unsigned int register_notify(struct bt_gatt_client * client,
     notify_data->destroy = destroy;
 
     /* Add the handler to the bt_gatt_client's general list */
-    queue_push_tail(client->notify_list, notify_data);
+    notify_list_add(client, notify_data);
 
     /* Assign an ID to the handler. */
     if (client->next_reg_id < 1)
@@ -1288,7 +1885,7 @@ static unsigned int register_notify(struct bt_gatt_client * client,
 
     /* Write to the CCC descriptor */
     if (!notify_data_write_ccc(notify_data, true, enable_ccc_callback)) {
-        queue_remove(client->notify_list, notify_data);
+        notify_list_remove(client, notify_data);
         free(notify_data);
         return 0;
     }
@@ -1422,6 +2019,15 @@ static void process_service_changed(struct bt_gatt_client * client,
     if (!op)
         goto fail;
 
+    /* op is released by discover_primary when the request fails */
+    if (client->svc_filter) {
+        if (!discover_primary(op))
+            goto fail;
+
+        client->in_svc_chngd = true;
+        return;
+    }
+
     client->discovery_req = bt_gatt_discover_primary_services(client->att,
                             NULL, start_handle, end_handle,
                             discover_primary_cb,
@@ -1593,9 +2199,6 @@ static void notify_handler(void * data, void * user_data) {
 
     value_handle = get_le16(pdu_data->pdu);
 
-    if (notify_data->chrc->value_handle != value_handle)
-        return;
-
     if (pdu_data->length > 2)
         value = pdu_data->pdu + 2;
 
@@ -1611,6 +2214,7 @@ static void notify_handler(void * data, void * user_data) {
 static void notify_cb(uint8_t opcode, const void * pdu, uint16_t length,
                       void * user_data) {
     struct bt_gatt_client * client = user_data;
+    struct notify_chrc * chrc;
     struct pdu_data pdu_data;
 
     bt_gatt_client_ref(client);
@@ -1619,7 +2223,10 @@ static void notify_cb(uint8_t opcode, const void * pdu, uint16_t length,
     pdu_data.pdu = pdu;
     pdu_data.length = length;
 
-    queue_foreach(client->notify_list, notify_handler, &pdu_data);
+    /* one lookup, then only the handlers of that value handle */
+    chrc = length >= 2 ? notify_index_find(client, get_le16(pdu)) : NULL;
+    if (chrc)
+        queue_foreach(chrc->notify_list, notify_handler, &pdu_data);
 
     if (opcode == BT_ATT_OP_HANDLE_VAL_IND)
         bt_att_send(client->att, BT_ATT_OP_HANDLE_VAL_CONF, NULL, 0,
@@ -1660,7 +2267,10 @@ static void bt_gatt_client_free(struct bt_gatt_client * client) {
     queue_destroy(client->svc_chngd_queue, free);
     queue_destroy(client->long_write_queue, request_unref);
     queue_destroy(client->notify_chrcs, notify_chrc_free);
+    free(client->notify_index);
     queue_destroy(client->pending_requests, request_unref);
+    queue_destroy(client->disc_jobs, discovery_job_free);
+    free(client->svc_filter);
 
     free(client);
 }
@@ -1674,6 +2284,10 @@ static void att_disconnect_cb(__attribute__((unused)) int err, void * user_data)
     bt_att_unref(client->att);
     client->att = NULL;
 
+    /* cancel_all skips a client without att, drop the request here */
+    discovery_req_clear(client);
+    queue_remove_all(client->disc_jobs, NULL, NULL, discovery_job_free);
+
     client->in_init = false;
     client->ready = false;
 
@@ -1718,6 +2332,10 @@ struct bt_gatt_client * bt_gatt_client_new(struct gatt_db * db,
     if (!client->pending_requests)
         goto fail;
 
+    client->disc_jobs = queue_new();
+    if (!client->disc_jobs)
+        goto fail;
+
     client->notify_id = bt_att_register(att, BT_ATT_OP_HANDLE_VAL_NOT,
                                         notify_cb, client, NULL);
     if (!client->notify_id)
@@ -1781,6 +2399,95 @@ bool bt_gatt_client_set_ready_handler(struct bt_gatt_client * client,
     return true;
 }
 
+/**
+ * set the Database Hash a restored db was saved with, call it right after
+ * bt_gatt_client_new with a non empty db
+ *
+ * @param client	client
+ * @param hash		Database Hash characteristic value
+ * @return true on success
+ */
+bool bt_gatt_client_set_db_hash(struct bt_gatt_client * client,
+                                const uint8_t hash[16]) {
+    if (!client || !hash)
+        return false;
+
+    memcpy(client->db_hash, hash, DB_HASH_SIZE);
+    client->db_hash_valid = true;
+
+    return true;
+}
+
+/**
+ * restrict the discovery to the primary services of the listed UUIDs, only
+ * their characteristics and descriptors are looked up and included or
+ * secondary services are skipped. The GATT service is always added so that
+ * Service Changed keeps working. Call it right after bt_gatt_client_new,
+ * before the MTU exchange completes
+ *
+ * @param client	client
+ * @param uuids		service UUIDs
+ * @param count		number of uuids, 0 to discover the whole server again
+ * @return true on success
+ */
+bool bt_gatt_client_set_service_filter(struct bt_gatt_client * client,
+                                       const bt_uuid_t * uuids,
+                                       unsigned int count) {
+    bt_uuid_t * filter;
+    bt_uuid_t gatt_uuid;
+    unsigned int i;
+
+    if (!client || (count && !uuids))
+        return false;
+
+    /* discovery already started */
+    if (!client->mtu_req_id)
+        return false;
+
+    filter = NULL;
+
+    if (count) {
+        filter = new0(bt_uuid_t, count + 1);
+        if (!filter)
+            return false;
+
+        memcpy(filter, uuids, count * sizeof(*filter));
+
+        bt_uuid16_create(&gatt_uuid, GATT_SVC_UUID);
+        for (i = 0; i < count; i++) {
+            if (!bt_uuid_cmp(&filter[i], &gatt_uuid))
+                break;
+        }
+
+        if (i == count)
+            filter[count++] = gatt_uuid;
+    }
+
+    free(client->svc_filter);
+    client->svc_filter = filter;
+    client->svc_filter_count = count;
+
+    return true;
+}
+
+/**
+ * set how many services have their characteristics and descriptors
+ * discovered at once, the requests spread over the ATT bearers
+ *
+ * @param client	client
+ * @param window	services in flight, 0 for one per ATT bearer
+ * @return true on success
+ */
+bool bt_gatt_client_set_discovery_window(struct bt_gatt_client * client,
+                                         unsigned int window) {
+    if (!client)
+        return false;
+
+    client->disc_window = window;
+
+    return true;
+}
+
 bool bt_gatt_client_set_service_changed(struct bt_gatt_client * client,
                                         bt_gatt_client_service_changed_callback_t callback,
                                         void * user_data,
@@ -1925,6 +2632,8 @@ bool bt_gatt_client_cancel_all(struct bt_gatt_client * client) {
         client->discovery_req = NULL;
     }
 
+    queue_remove_all(client->disc_jobs, NULL, NULL, discovery_job_free);
+
     if (client->mtu_req_id)
         bt_att_cancel(client->att, client->mtu_req_id);
 
@@ -2112,10 +2821,18 @@ struct read_long_op {
     int ref_count;
     uint16_t value_handle;
     uint16_t offset;
-    struct iovec iov;
+    /**< offset of the next Read Blob */
+    uint16_t len;
+    /**< bytes of value received */
+    uint16_t max_len;
+    /**< size of value, what is left of BT_ATT_MAX_VALUE_LEN past the
+     * first offset
+     */
     bt_gatt_client_read_callback_t callback;
     void * user_data;
     bt_gatt_client_destroy_func_t destroy;
+    uint8_t value[];
+    /**< allocated with the op, handed to callback as is */
 };
 
 static void destroy_read_long_op(void * data) {
@@ -2124,37 +2841,15 @@ static void destroy_read_long_op(void * data) {
     if (op->destroy)
         op->destroy(op->user_data);
 
-    free(op->iov.iov_base);
     free(op);
 }
 
-static bool append_chunk(struct read_long_op * op, const uint8_t * data,
-                         uint16_t len) {
-    void * buf;
-
-    /* Truncate if the data would exceed maximum length */
-    if (op->offset + len > BT_ATT_MAX_VALUE_LEN)
-        len = BT_ATT_MAX_VALUE_LEN - op->offset;
-
-    buf = realloc(op->iov.iov_base, op->iov.iov_len + len);
-    if (!buf)
-        return false;
-
-    op->iov.iov_base = buf;
-
-    memcpy(op->iov.iov_base + op->iov.iov_len, data, len);
-
-    op->iov.iov_len += len;
-    op->offset += len;
-
-    return true;
-}
-
 static void read_long_cb(uint8_t opcode, const void * pdu,
                          uint16_t length, void * user_data) {
     struct request * req = user_data;
     struct read_long_op * op = req->data;
     bool success;
+    bool more;
     uint8_t att_ecode = 0;
 
     if (opcode == BT_ATT_OP_ERROR_RSP) {
@@ -2171,41 +2866,48 @@ static void read_long_cb(uint8_t opcode, const void * pdu,
     if (!length)
         goto success;
 
-    if (!append_chunk(op, pdu, length)) {
-        success = false;
-        goto done;
-    }
+    /* Truncate if the data would exceed maximum length */
+    if (length > op->max_len - op->len)
+        length = op->max_len - op->len;
 
-    if (op->offset >= BT_ATT_MAX_VALUE_LEN)
-        goto success;
+    /* a full chunk, the value may go on */
+    more = op->len + length < op->max_len &&
+           length >= bt_att_get_mtu(op->client->att) - 1;
 
-    if (length >= bt_att_get_mtu(op->client->att) - 1) {
-        uint8_t pdu[4];
+    /* the next Read Blob is queued before this chunk is copied out */
+    if (more) {
+        uint8_t blob_pdu[4];
 
-        put_le16(op->value_handle, pdu);
-        put_le16(op->offset, pdu + 2);
+        put_le16(op->value_handle, blob_pdu);
+        put_le16(op->offset + length, blob_pdu + 2);
 
         req->att_id = bt_att_send(op->client->att,
                                   BT_ATT_OP_READ_BLOB_REQ,
-                                  pdu, sizeof(pdu),
+                                  blob_pdu, sizeof(blob_pdu),
                                   read_long_cb,
                                   request_ref(req),
                                   request_unref);
-        if (req->att_id)
-            return;
-
-        request_unref(req);
-        success = false;
-        goto done;
+        if (!req->att_id) {
+            request_unref(req);
+            success = false;
+            goto done;
+        }
     }
 
+    memcpy(op->value + op->len, pdu, length);
+    op->len += length;
+    op->offset += length;
+
+    if (more)
+        return;
+
 success:
     success = true;
 
 done:
     if (op->callback)
-        op->callback(success, att_ecode, op->iov.iov_base,
-                     op->iov.iov_len, op->user_data);
+        op->callback(success, att_ecode, op->value, op->len,
+                     op->user_data);
 }
 
 unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client * client,
@@ -2215,15 +2917,22 @@ unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client * client,
         bt_gatt_client_destroy_func_t destroy) {
     struct request * req;
     struct read_long_op * op;
+    uint16_t max_len;
     uint8_t pdu[4];
 
     if (!client)
         return 0;
 
-    op = new0(struct read_long_op, 1);
+    max_len = offset < BT_ATT_MAX_VALUE_LEN ?
+              BT_ATT_MAX_VALUE_LEN - offset : 0;
+
+    /* the whole value is allocated up front, no realloc per Read Blob */
+    op = malloc(sizeof(*op) + max_len);
     if (!op)
         return 0;
 
+    memset(op, 0, sizeof(*op));
+
     req = request_create(client);
     if (!req) {
         free(op);
@@ -2233,6 +2942,7 @@ unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client * client,
     op->client = client;
     op->value_handle = value_handle;
     op->offset = offset;
+    op->max_len = max_len;
     op->callback = callback;
     op->user_data = user_data;
     op->destroy = destroy;
@@ -2958,6 +3668,8 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client * client,
     if (!notify_data)
         return false;
 
+    queue_remove(notify_data->chrc->notify_list, notify_data);
+
     assert(notify_data->chrc->notify_count > 0);
     assert(!notify_data->chrc->ccc_write_id);
 
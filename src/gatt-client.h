@@ -60,6 +60,13 @@ bool bt_gatt_client_set_ready_handler(struct bt_gatt_client * client,
                                       bt_gatt_client_callback_t callback,
                                       void * user_data,
                                       bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_set_db_hash(struct bt_gatt_client * client,
+                                const uint8_t hash[16]);
+bool bt_gatt_client_set_service_filter(struct bt_gatt_client * client,
+                                       const bt_uuid_t * uuids,
+                                       unsigned int count);
+bool bt_gatt_client_set_discovery_window(struct bt_gatt_client * client,
+                                         unsigned int window);
 bool bt_gatt_client_set_service_changed(struct bt_gatt_client * client,
                                         bt_gatt_client_service_changed_callback_t callback,
                                         void * user_data,
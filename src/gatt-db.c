@@ -49,6 +49,11 @@
 #define MAX_INCLUDED_VALUE_LEN 6
 #define ATTRIBUTE_TIMEOUT 5000
 
+/* handle index: 256 pages of 256 handles, a page is allocated on first use */
+#define HANDLE_PAGE_BITS 8
+#define HANDLE_PAGE_SIZE (1 << HANDLE_PAGE_BITS)
+#define HANDLE_PAGES (0x10000 >> HANDLE_PAGE_BITS)
+
 static const bt_uuid_t primary_service_uuid = { .type = BT_UUID16,
                                                 .value.u16 = GATT_PRIM_SVC_UUID
                                               };
@@ -67,6 +72,16 @@ struct gatt_db {
     uint16_t next_handle;
     struct queue * services;
 
+    /* services sorted by handle, the ranges do not overlap so the end
+     * handles are sorted too, range queries start with a binary search
+     */
+    struct gatt_db_service ** svc_index;
+    unsigned int svc_count;
+    unsigned int svc_size;
+
+    /* attribute of every handle */
+    struct gatt_db_attribute ** handle_index[HANDLE_PAGES];
+
     struct queue * notify_list;
     unsigned int next_notify_id;
 };
@@ -122,6 +137,116 @@ struct gatt_db_service {
     struct gatt_db_attribute ** attributes;
 };
 
+static void gatt_db_service_get_handles(const struct gatt_db_service * service,
+                                        uint16_t * start_handle,
+                                        uint16_t * end_handle);
+
+/**
+ * @brief position of the first service of the db ending at or after handle
+ *
+ * @param db		database
+ * @param handle	handle
+ * @return index in svc_index, svc_count if every service ends before
+ */
+static unsigned int service_index_lower(struct gatt_db * db,
+                                        uint16_t handle) {
+    unsigned int lo = 0, hi = db->svc_count, mid;
+    uint16_t end;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        gatt_db_service_get_handles(db->svc_index[mid], NULL, &end);
+        if (end < handle)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static bool service_index_add(struct gatt_db * db,
+                              struct gatt_db_service * service) {
+    struct gatt_db_service ** svc_index;
+    uint16_t start;
+    unsigned int i;
+
+    if (db->svc_count == db->svc_size) {
+        unsigned int size = db->svc_size ? db->svc_size * 2 : 16;
+
+        svc_index = realloc(db->svc_index, size * sizeof(*svc_index));
+        if (!svc_index)
+            return false;
+
+        db->svc_index = svc_index;
+        db->svc_size = size;
+    }
+
+    gatt_db_service_get_handles(service, &start, NULL);
+    i = service_index_lower(db, start);
+
+    memmove(&db->svc_index[i + 1], &db->svc_index[i],
+            (db->svc_count - i) * sizeof(*db->svc_index));
+    db->svc_index[i] = service;
+    db->svc_count++;
+
+    return true;
+}
+
+static void service_index_remove(struct gatt_db * db,
+                                 struct gatt_db_service * service) {
+    uint16_t start;
+    unsigned int i;
+
+    gatt_db_service_get_handles(service, &start, NULL);
+    i = service_index_lower(db, start);
+
+    if (i == db->svc_count || db->svc_index[i] != service)
+        return;
+
+    db->svc_count--;
+    memmove(&db->svc_index[i], &db->svc_index[i + 1],
+            (db->svc_count - i) * sizeof(*db->svc_index));
+}
+
+/**
+ * @brief record the handle of an attribute of a service already in the db
+ *
+ * @param attribute	attribute with its final handle
+ * @return false if the page of the handle could not be allocated
+ */
+static bool handle_index_add(struct gatt_db_attribute * attribute) {
+    struct gatt_db * db = attribute->service->db;
+    struct gatt_db_attribute *** page;
+
+    if (!db || !attribute->handle)
+        return true;
+
+    page = &db->handle_index[attribute->handle >> HANDLE_PAGE_BITS];
+    if (!*page) {
+        *page = new0(struct gatt_db_attribute *, HANDLE_PAGE_SIZE);
+        if (!*page)
+            return false;
+    }
+
+    (*page)[attribute->handle & (HANDLE_PAGE_SIZE - 1)] = attribute;
+
+    return true;
+}
+
+static void handle_index_remove(struct gatt_db_attribute * attribute) {
+    struct gatt_db * db = attribute->service->db;
+    struct gatt_db_attribute ** page;
+
+    if (!db)
+        return;
+
+    page = db->handle_index[attribute->handle >> HANDLE_PAGE_BITS];
+    if (page && page[attribute->handle & (HANDLE_PAGE_SIZE - 1)] == attribute)
+        page[attribute->handle & (HANDLE_PAGE_SIZE - 1)] = NULL;
+}
+
 static void pending_read_result(struct pending_read * p, int err,
                                 const uint8_t * data, size_t length) {
     if (p->timeout_id > 0)
@@ -293,14 +418,24 @@ static void gatt_db_service_destroy(void * data) {
     if (service->active)
         notify_service_changed(service->db, service, false);
 
-    for (i = 0; i < service->num_handles; i++)
+    if (service->db)
+        service_index_remove(service->db, service);
+
+    for (i = 0; i < service->num_handles; i++) {
+        if (!service->attributes[i])
+            continue;
+
+        handle_index_remove(service->attributes[i]);
         attribute_destroy(service->attributes[i]);
+    }
 
     free(service->attributes);
     free(service);
 }
 
 static void gatt_db_destroy(struct gatt_db * db) {
+    unsigned int i;
+
     if (!db)
         return;
 
@@ -312,6 +447,11 @@ static void gatt_db_destroy(struct gatt_db * db) {
     db->notify_list = NULL;
 
     queue_destroy(db->services, gatt_db_service_destroy);
+
+    for (i = 0; i < HANDLE_PAGES; i++)
+        free(db->handle_index[i]);
+
+    free(db->svc_index);
     free(db);
 }
 
@@ -478,33 +618,24 @@ bool gatt_db_clear_range(struct gatt_db * db, uint16_t start_handle,
 static struct gatt_db_service * find_insert_loc(struct gatt_db * db,
         uint16_t start, uint16_t end,
         struct gatt_db_service ** after) {
-    const struct queue_entry * services_entry;
     struct gatt_db_service * service;
-    uint16_t cur_start, cur_end;
-
-    *after = NULL;
+    uint16_t cur_start;
+    unsigned int i;
 
-    services_entry = queue_get_entries(db->services);
+    i = service_index_lower(db, start);
 
-    while (services_entry) {
-        service = services_entry->data;
+    *after = i ? db->svc_index[i - 1] : NULL;
 
-        gatt_db_service_get_handles(service, &cur_start, &cur_end);
-
-        if (start >= cur_start && start <= cur_end)
-            return service;
-
-        if (end >= cur_start && end <= cur_end)
-            return service;
-
-        if (end < cur_start)
-            return NULL;
+    if (i == db->svc_count)
+        return NULL;
 
-        *after = service;
-        services_entry = services_entry->next;
-    }
+    /* first service ending at or after start, overlapping unless it
+     * begins after end
+     */
+    service = db->svc_index[i];
+    gatt_db_service_get_handles(service, &cur_start, NULL);
 
-    return NULL;
+    return cur_start <= end ? service : NULL;
 }
 
 struct gatt_db_attribute * gatt_db_insert_service(struct gatt_db * db,
@@ -561,6 +692,19 @@ struct gatt_db_attribute * gatt_db_insert_service(struct gatt_db * db,
     service->attributes[0]->handle = handle;
     service->num_handles = num_handles;
 
+    if (!service_index_add(db, service)) {
+        queue_remove(db->services, service);
+        service->db = NULL;
+        goto fail;
+    }
+
+    if (!handle_index_add(service->attributes[0])) {
+        service_index_remove(db, service);
+        queue_remove(db->services, service);
+        service->db = NULL;
+        goto fail;
+    }
+
     /* Fast-forward next_handle if the new service was added to the end */
     db->next_handle = MAX(handle + num_handles, db->next_handle);
 
@@ -654,6 +798,12 @@ attribute_update(struct gatt_db_service * service, int index) {
     previous_handle = service->attributes[index - 1]->handle;
     service->attributes[index]->handle = previous_handle + 1;
 
+    if (!handle_index_add(service->attributes[index])) {
+        attribute_destroy(service->attributes[index]);
+        service->attributes[index] = NULL;
+        return NULL;
+    }
+
     return service->attributes[index];
 }
 
@@ -721,15 +871,26 @@ service_insert_characteristic(struct gatt_db_service * service,
     i++;
 
     service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-    if (!service->attributes[i]) {
-        free(service->attributes[i - 1]);
-        return NULL;
-    }
+    if (!service->attributes[i])
+        goto fail;
 
     set_attribute_data(service->attributes[i], read_func, write_func,
                        permissions, user_data);
 
+    if (!handle_index_add(service->attributes[i - 1]) ||
+            !handle_index_add(service->attributes[i])) {
+        handle_index_remove(service->attributes[i - 1]);
+        attribute_destroy(service->attributes[i]);
+        service->attributes[i] = NULL;
+        goto fail;
+    }
+
     return service->attributes[i];
+
+fail:
+    attribute_destroy(service->attributes[i - 1]);
+    service->attributes[i - 1] = NULL;
+    return NULL;
 }
 
 struct gatt_db_attribute *
@@ -795,6 +956,12 @@ service_insert_descriptor(struct gatt_db_service * service,
     set_attribute_data(service->attributes[i], read_func, write_func,
                        permissions, user_data);
 
+    if (!handle_index_add(service->attributes[i])) {
+        attribute_destroy(service->attributes[i]);
+        service->attributes[i] = NULL;
+        return NULL;
+    }
+
     return service->attributes[i];
 }
 
@@ -925,35 +1092,71 @@ bool gatt_db_service_get_claimed(struct gatt_db_attribute * attrib) {
     return attrib->service->claimed;
 }
 
+/**
+ * @brief call func for every service overlapping a handle range, in handle
+ * order, func may remove services
+ *
+ * @param db		database
+ * @param start		first handle
+ * @param end		last handle
+ * @param func		called with the service and user_data
+ * @param user_data	passed to func
+ */
+static void foreach_service_overlapping(struct gatt_db * db, uint16_t start,
+                                        uint16_t end,
+                                        queue_foreach_func_t func,
+                                        void * user_data) {
+    struct gatt_db_service * service;
+    uint16_t svc_start, svc_end;
+    unsigned int i;
+
+    while (start <= end) {
+        i = service_index_lower(db, start);
+        if (i == db->svc_count)
+            return;
+
+        service = db->svc_index[i];
+        gatt_db_service_get_handles(service, &svc_start, &svc_end);
+        if (svc_start > end)
+            return;
+
+        func(service, user_data);
+
+        if (svc_end >= end)
+            return;
+
+        start = svc_end + 1;
+    }
+}
+
 void gatt_db_read_by_group_type(struct gatt_db * db, uint16_t start_handle,
                                 uint16_t end_handle,
                                 const bt_uuid_t type,
                                 struct queue * queue) {
-    const struct queue_entry * services_entry;
     struct gatt_db_service * service;
     uint16_t grp_start, grp_end, uuid_size;
+    unsigned int i;
 
     uuid_size = 0;
 
-    services_entry = queue_get_entries(db->services);
-
-    while (services_entry) {
-        service = services_entry->data;
-
-        if (!service->active)
-            goto next_service;
-
-        if (bt_uuid_cmp(&type, &service->attributes[0]->uuid))
-            goto next_service;
+    for (i = service_index_lower(db, start_handle); i < db->svc_count; i++) {
+        service = db->svc_index[i];
 
         grp_start = service->attributes[0]->handle;
         grp_end = grp_start + service->num_handles - 1;
 
-        if (grp_end < start_handle || grp_start > end_handle)
-            goto next_service;
+        /* sorted, nothing further is in range */
+        if (grp_start > end_handle)
+            return;
 
-        if (grp_start < start_handle || grp_start > end_handle)
-            goto next_service;
+        if (grp_end < start_handle || grp_start < start_handle)
+            continue;
+
+        if (!service->active)
+            continue;
+
+        if (bt_uuid_cmp(&type, &service->attributes[0]->uuid))
+            continue;
 
         if (!uuid_size)
             uuid_size = service->attributes[0]->value_len;
@@ -961,9 +1164,6 @@ void gatt_db_read_by_group_type(struct gatt_db * db, uint16_t start_handle,
             return;
 
         queue_push_tail(queue, service->attributes[0]);
-
-next_service:
-        services_entry = services_entry->next;
     }
 }
 
@@ -1026,7 +1226,8 @@ unsigned int gatt_db_find_by_type(struct gatt_db * db, uint16_t start_handle,
     data.func = func;
     data.user_data = user_data;
 
-    queue_foreach(db->services, find_by_type, &data);
+    foreach_service_overlapping(db, start_handle, end_handle, find_by_type,
+                                &data);
 
     return data.num_of_res;
 }
@@ -1049,7 +1250,8 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db * db,
     data.value = value;
     data.value_len = value_len;
 
-    queue_foreach(db->services, find_by_type, &data);
+    foreach_service_overlapping(db, start_handle, end_handle, find_by_type,
+                                &data);
 
     return data.num_of_res;
 }
@@ -1098,7 +1300,8 @@ void gatt_db_read_by_type(struct gatt_db * db, uint16_t start_handle,
     data.end_handle = end_handle;
     data.queue = queue;
 
-    queue_foreach(db->services, read_by_type, &data);
+    foreach_service_overlapping(db, start_handle, end_handle, read_by_type,
+                                &data);
 }
 
 
@@ -1146,7 +1349,8 @@ void gatt_db_find_information(struct gatt_db * db, uint16_t start_handle,
     data.end_handle = end_handle;
     data.queue = queue;
 
-    queue_foreach(db->services, find_information, &data);
+    foreach_service_overlapping(db, start_handle, end_handle,
+                                find_information, &data);
 }
 
 void gatt_db_foreach_service(struct gatt_db * db, const bt_uuid_t * uuid,
@@ -1201,7 +1405,8 @@ void gatt_db_foreach_service_in_range(struct gatt_db * db,
     data.start = start_handle;
     data.end = end_handle;
 
-    queue_foreach(db->services, foreach_service_in_range, &data);
+    foreach_service_overlapping(db, start_handle, end_handle,
+                                foreach_service_in_range, &data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute * attrib,
@@ -1280,38 +1485,18 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute * attrib,
                             user_data);
 }
 
-static bool find_service_for_handle(const void * data, const void * user_data) {
-    const struct gatt_db_service * service = data;
-    uint16_t handle = PTR_TO_UINT(user_data);
-    uint16_t start, end;
-
-    gatt_db_service_get_handles(service, &start, &end);
-
-    return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute * gatt_db_get_attribute(struct gatt_db * db,
         uint16_t handle) {
-    struct gatt_db_service * service;
-    int i;
+    struct gatt_db_attribute ** page;
 
     if (!db || !handle)
         return NULL;
 
-    service = queue_find(db->services, find_service_for_handle,
-                         UINT_TO_PTR(handle));
-    if (!service)
+    page = db->handle_index[handle >> HANDLE_PAGE_BITS];
+    if (!page)
         return NULL;
 
-    for (i = 0; i < service->num_handles; i++) {
-        if (!service->attributes[i])
-            continue;
-
-        if (service->attributes[i]->handle == handle)
-            return service->attributes[i];
-    }
-
-    return NULL;
+    return page[handle & (HANDLE_PAGE_SIZE - 1)];
 }
 
 static bool find_service_with_uuid(const void * data, const void * user_data) {
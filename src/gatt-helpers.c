@@ -46,6 +46,13 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define RESULT_ARENA_SIZE	1024	/* bytes of an arena chunk */
+#define RESULT_ARENA_ALIGN	8
+
 struct bt_gatt_result {
     uint8_t opcode;
     void * pdu;
@@ -57,42 +64,26 @@ struct bt_gatt_result {
     struct bt_gatt_result * next;
 };
 
-static struct bt_gatt_result * result_create(uint8_t opcode, const void * pdu,
-        uint16_t pdu_len,
-        uint16_t data_len,
-        void * op) {
-    struct bt_gatt_result * result;
-
-    result = new0(struct bt_gatt_result, 1);
-    if (!result)
-        return NULL;
-
-    result->pdu = malloc(pdu_len);
-    if (!result->pdu) {
-        free(result);
-        return NULL;
-    }
-
-    result->opcode = opcode;
-    result->pdu_len = pdu_len;
-    result->data_len = data_len;
-    result->op = op;
-
-    memcpy(result->pdu, pdu, pdu_len);
-
-    return result;
-}
-
-static void result_destroy(struct bt_gatt_result * result) {
-    struct bt_gatt_result * next;
-
-    while (result) {
-        next = result->next;
+/**
+ * @brief chunk of a request arena
+ *
+ * the result nodes, their PDU copies and the included services read state
+ * of a request are carved out of its chunks and all freed with the request
+ */
+struct result_arena {
+    struct result_arena * next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
 
-        free(result->pdu);
-        free(result);
+static void result_arena_free(struct result_arena * arena) {
+    struct result_arena * next;
 
-        result = next;
+    while (arena) {
+        next = arena->next;
+        free(arena);
+        arena = next;
     }
 }
 
@@ -219,21 +210,66 @@ struct bt_gatt_request {
     uint16_t service_type;
     struct bt_gatt_result * result_head;
     struct bt_gatt_result * result_tail;
+    struct result_arena * arena;
+    /**< owns result_head..result_tail, newest chunk first */
     bt_gatt_request_callback_t callback;
     void * user_data;
     bt_gatt_destroy_func_t destroy;
 };
 
+/**
+ * bump allocate from the arena of a request, a new chunk is started when
+ * the current one is full
+ *
+ * @param op	request owning the memory
+ * @param len	bytes needed
+ * @return uninitialized memory living until the request is freed
+ */
+static void * result_arena_alloc(struct bt_gatt_request * op, size_t len) {
+    struct result_arena * arena = op->arena;
+    void * ptr;
+
+    len = (len + RESULT_ARENA_ALIGN - 1) & ~(size_t)(RESULT_ARENA_ALIGN - 1);
+
+    if (!arena || arena->size - arena->used < len) {
+        size_t size = MAX(len, RESULT_ARENA_SIZE);
+
+        arena = malloc(sizeof(*arena) + size);
+        if (!arena)
+            return NULL;
+
+        arena->next = op->arena;
+        arena->size = size;
+        arena->used = 0;
+        op->arena = arena;
+    }
+
+    ptr = arena->data + arena->used;
+    arena->used += len;
+
+    return ptr;
+}
+
 static struct bt_gatt_result * result_append(uint8_t opcode, const void * pdu,
         uint16_t pdu_len,
         uint16_t data_len,
         struct bt_gatt_request * op) {
     struct bt_gatt_result * result;
 
-    result = result_create(opcode, pdu, pdu_len, data_len, op);
+    /* the PDU copy follows its node */
+    result = result_arena_alloc(op, sizeof(*result) + pdu_len);
     if (!result)
         return NULL;
 
+    result->opcode = opcode;
+    result->pdu = result + 1;
+    result->pdu_len = pdu_len;
+    result->data_len = data_len;
+    result->op = op;
+    result->next = NULL;
+
+    memcpy(result->pdu, pdu, pdu_len);
+
     if (!op->result_head)
         op->result_head = op->result_tail = result;
     else {
@@ -620,7 +656,7 @@ void bt_gatt_request_unref(struct bt_gatt_request * req) {
     if (req->destroy)
         req->destroy(req->user_data);
 
-    result_destroy(req->result_head);
+    result_arena_free(req->arena);
 
     free(req);
 }
@@ -819,7 +855,8 @@ static void find_by_type_val_cb(uint8_t opcode, const void * pdu,
         goto done;
     }
 
-    success = false;
+    /* the last service found reaches the end of the range */
+    success = true;
 
 done:
     discovery_op_complete(op, success, att_ecode);
@@ -934,10 +971,13 @@ struct read_incl_data {
 static struct read_incl_data * new_read_included(struct bt_gatt_result * res) {
     struct read_incl_data * data;
 
-    data = new0(struct read_incl_data, 1);
+    /* lives in the arena, the reference it holds keeps the request */
+    data = result_arena_alloc(res->op, sizeof(*data));
     if (!data)
         return NULL;
 
+    memset(data, 0, sizeof(*data));
+
     data->op = bt_gatt_request_ref(res->op);
     data->result = res;
 
@@ -956,9 +996,8 @@ static void read_included_unref(void * data) {
     if (__sync_sub_and_fetch(&read_data->ref_count, 1))
         return;
 
+    /* read_data goes away with the arena of the request */
     async_req_unref(read_data->op);
-
-    free(read_data);
 }
 
 static void discover_included_cb(uint8_t opcode, const void * pdu,
@@ -1377,20 +1416,21 @@ done:
     discovery_op_complete(op, success, att_ecode);
 }
 
-bool bt_gatt_read_by_type(struct bt_att * att, uint16_t start, uint16_t end,
-                          const bt_uuid_t * uuid,
-                          bt_gatt_request_callback_t callback,
-                          void * user_data,
-                          bt_gatt_destroy_func_t destroy) {
+struct bt_gatt_request * bt_gatt_read_by_type(struct bt_att * att,
+        uint16_t start, uint16_t end,
+        const bt_uuid_t * uuid,
+        bt_gatt_request_callback_t callback,
+        void * user_data,
+        bt_gatt_destroy_func_t destroy) {
     struct bt_gatt_request * op;
     uint8_t pdu[4 + get_uuid_len(uuid)];
 
     if (!att || !uuid || uuid->type == BT_UUID_UNSPEC)
-        return false;
+        return NULL;
 
     op = new0(struct bt_gatt_request, 1);
     if (!op)
-        return false;
+        return NULL;
 
     op->att = att;
     op->callback = callback;
@@ -1409,10 +1449,10 @@ bool bt_gatt_read_by_type(struct bt_att * att, uint16_t start, uint16_t end,
                          bt_gatt_request_ref(op),
                          async_req_unref);
     if (op->id)
-        return true;
+        return bt_gatt_request_ref(op);
 
     free(op);
-    return false;
+    return NULL;
 }
 
 static void discover_descs_cb(uint8_t opcode, const void * pdu,
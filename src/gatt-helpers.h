@@ -109,8 +109,9 @@ struct bt_gatt_request * bt_gatt_discover_descriptors(struct bt_att * att,
         void * user_data,
         bt_gatt_destroy_func_t destroy);
 
-bool bt_gatt_read_by_type(struct bt_att * att, uint16_t start, uint16_t end,
-                          const bt_uuid_t * uuid,
-                          bt_gatt_request_callback_t callback,
-                          void * user_data,
-                          bt_gatt_destroy_func_t destroy);
+struct bt_gatt_request * bt_gatt_read_by_type(struct bt_att * att,
+        uint16_t start, uint16_t end,
+        const bt_uuid_t * uuid,
+        bt_gatt_request_callback_t callback,
+        void * user_data,
+        bt_gatt_destroy_func_t destroy);
@@ -0,0 +1,862 @@
+/**
+ * @file hci-engine.c
+ * @brief asynchronous HCI command/event engine on the mainloop
+ *
+ * One raw HCI socket is watched by the mainloop. Commands are written
+ * right away and kept in a pending queue until the matching Command
+ * Complete, Command Status or completion event arrives, so several
+ * commands (RSSI reads, connection updates, white list changes) can be
+ * outstanding without the loop ever waiting on the controller. This
+ * replaces the hci_send_req() pattern of swapping the socket filter and
+ * polling for the answer.
+ *
+ * Commands with the same opcode complete in the order they were sent,
+ * every pending command has its own timeout, and a longer one once the
+ * Command Status said the completion event is on its way. A command that
+ * timed out or was cancelled after it was written stays in a late list for
+ * a while, so that its answer, if it still comes, is dropped instead of
+ * completing the next command with the same opcode. The socket is non
+ * blocking, a command the controller cannot take yet waits in a send queue
+ * that is flushed when the socket is writable again.
+ *
+ * @see hci.c for the blocking helpers
+ */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ */
+
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "io.h"
+#include "queue.h"
+#include "util.h"
+#include "timeout.h"
+#include "bluetooth.h"
+#include "hci.h"
+#include "hci_lib.h"
+#include "hci-engine.h"
+
+#define HCI_CMD_TIMEOUT		2000  /* 2000 ms */
+#define HCI_EVT_TIMEOUT		10000 /* 10 s, Command Status to completion event */
+#define HCI_LATE_TIMEOUT	5000  /* 5 s, answers to abandoned commands dropped */
+
+struct bt_hci {
+    int ref_count;
+    int fd;
+    struct io * io;
+    bool in_event;
+    unsigned int next_cmd_id;
+    unsigned int next_evt_id;
+    /* written, waiting for the controller */
+    struct queue * cmd_pending;
+    /* not written yet, the socket was full */
+    struct queue * cmd_queue;
+    /* timed out or cancelled once written, their answers are dropped */
+    struct queue * cmd_late;
+    bool writer_active;
+    struct queue * evt_list;
+};
+
+struct hci_cmd {
+    unsigned int id;
+    struct bt_hci * hci;
+    uint16_t opcode;
+    uint16_t event;
+    /* Command Status seen, waiting for the completion event */
+    bool status_done;
+    /* abandoned, in cmd_late */
+    bool late;
+    unsigned int timeout_id;
+    /* ms from the Command Status to the completion event */
+    unsigned int event_timeout;
+    /* parameters, kept until the command is written */
+    void * data;
+    uint8_t size;
+    bt_hci_callback_func_t callback;
+    bt_hci_destroy_func_t destroy;
+    void * user_data;
+};
+
+struct hci_evt {
+    unsigned int id;
+    uint8_t event;
+    bool removed;
+    bt_hci_event_func_t callback;
+    bt_hci_destroy_func_t destroy;
+    void * user_data;
+};
+
+static void cmd_free(void * data) {
+    struct hci_cmd * cmd = data;
+
+    if (cmd->timeout_id)
+        timeout_remove(cmd->timeout_id);
+
+    if (cmd->destroy)
+        cmd->destroy(cmd->user_data);
+
+    free(cmd->data);
+    free(cmd);
+}
+
+static void evt_free(void * data) {
+    struct hci_evt * evt = data;
+
+    if (evt->destroy)
+        evt->destroy(evt->user_data);
+
+    free(evt);
+}
+
+/**
+ * complete a command: unlink it first so that the callback may queue or
+ * cancel other commands
+ */
+static void cmd_complete(struct hci_cmd * cmd, int err, const void * data,
+                         uint8_t size) {
+    if (!queue_remove(cmd->hci->cmd_pending, cmd))
+        queue_remove(cmd->hci->cmd_queue, cmd);
+
+    if (cmd->callback)
+        cmd->callback(err, data, size, cmd->user_data);
+
+    cmd_free(cmd);
+}
+
+static bool cmd_timeout_cb(void * user_data);
+
+/**
+ * give up on a command: the callback is called with err, a command already
+ * written moves to the late list where its answer is waited for and dropped
+ */
+static void cmd_abandon(struct hci_cmd * cmd, int err) {
+    struct bt_hci * hci = cmd->hci;
+    bt_hci_callback_func_t callback = cmd->callback;
+    bt_hci_destroy_func_t destroy = cmd->destroy;
+    void * user_data = cmd->user_data;
+
+    if (!queue_remove(hci->cmd_pending, cmd)) {
+        cmd_complete(cmd, err, NULL, 0);
+        return;
+    }
+
+    if (cmd->timeout_id)
+        timeout_remove(cmd->timeout_id);
+
+    cmd->late = true;
+    cmd->callback = NULL;
+    cmd->destroy = NULL;
+    cmd->user_data = NULL;
+    cmd->timeout_id = timeout_add(HCI_LATE_TIMEOUT, cmd_timeout_cb, cmd, NULL);
+
+    if (!cmd->timeout_id || !queue_push_tail(hci->cmd_late, cmd)) {
+        if (cmd->timeout_id)
+            timeout_remove(cmd->timeout_id);
+        free(cmd->data);
+        free(cmd);
+    }
+
+    bt_hci_ref(hci);
+
+    if (callback)
+        callback(err, NULL, 0, user_data);
+
+    if (destroy)
+        destroy(user_data);
+
+    bt_hci_unref(hci);
+}
+
+static void cmd_late_done(struct hci_cmd * cmd) {
+    queue_remove(cmd->hci->cmd_late, cmd);
+    cmd_free(cmd);
+}
+
+static bool cmd_timeout_cb(void * user_data) {
+    struct hci_cmd * cmd = user_data;
+
+    cmd->timeout_id = 0;
+
+    if (cmd->late)
+        cmd_late_done(cmd);
+    else
+        cmd_abandon(cmd, -ETIMEDOUT);
+
+    return false;
+}
+
+static bool match_cmd_opcode(const void * a, const void * b) {
+    const struct hci_cmd * cmd = a;
+    uint16_t opcode = PTR_TO_UINT(b);
+
+    return cmd->opcode == opcode && !cmd->status_done;
+}
+
+static bool match_cmd_event(const void * a, const void * b) {
+    const struct hci_cmd * cmd = a;
+    uint16_t event = PTR_TO_UINT(b);
+
+    return cmd->event == event && cmd->status_done;
+}
+
+static bool match_cmd_id(const void * a, const void * b) {
+    const struct hci_cmd * cmd = a;
+    unsigned int id = PTR_TO_UINT(b);
+
+    return cmd->id == id;
+}
+
+static bool match_evt_id(const void * a, const void * b) {
+    const struct hci_evt * evt = a;
+    unsigned int id = PTR_TO_UINT(b);
+
+    return evt->id == id;
+}
+
+static bool match_evt_removed(const void * a, __attribute__((unused)) const void * b) {
+    const struct hci_evt * evt = a;
+
+    return evt->removed;
+}
+
+static void handle_cmd_complete(struct bt_hci * hci, const uint8_t * data,
+                                uint8_t size) {
+    const evt_cmd_complete * cc = (const void *) data;
+    struct hci_cmd * cmd;
+
+    if (size < EVT_CMD_COMPLETE_SIZE)
+        return;
+
+    cmd = queue_find(hci->cmd_late, match_cmd_opcode,
+                     UINT_TO_PTR(btohs(cc->opcode)));
+    if (cmd) {
+        cmd_late_done(cmd);
+        return;
+    }
+
+    cmd = queue_find(hci->cmd_pending, match_cmd_opcode,
+                     UINT_TO_PTR(btohs(cc->opcode)));
+    if (!cmd || cmd->event)
+        return;
+
+    cmd_complete(cmd, 0, data + EVT_CMD_COMPLETE_SIZE,
+                 size - EVT_CMD_COMPLETE_SIZE);
+}
+
+static void handle_cmd_status(struct bt_hci * hci, const uint8_t * data,
+                              uint8_t size) {
+    const evt_cmd_status * cs = (const void *) data;
+    struct hci_cmd * cmd;
+
+    if (size < EVT_CMD_STATUS_SIZE)
+        return;
+
+    cmd = queue_find(hci->cmd_late, match_cmd_opcode,
+                     UINT_TO_PTR(btohs(cs->opcode)));
+    if (cmd) {
+        /* its completion event is still to be dropped */
+        if (!cs->status && cmd->event)
+            cmd->status_done = true;
+        else
+            cmd_late_done(cmd);
+        return;
+    }
+
+    cmd = queue_find(hci->cmd_pending, match_cmd_opcode,
+                     UINT_TO_PTR(btohs(cs->opcode)));
+    if (!cmd)
+        return;
+
+    /* accepted, the result comes with the completion event */
+    if (!cs->status && cmd->event) {
+        cmd->status_done = true;
+
+        if (cmd->timeout_id)
+            timeout_remove(cmd->timeout_id);
+
+        cmd->timeout_id = timeout_add(cmd->event_timeout, cmd_timeout_cb,
+                                      cmd, NULL);
+        return;
+    }
+
+    cmd_complete(cmd, 0, &cs->status, 1);
+}
+
+static void handle_completion_event(struct bt_hci * hci, uint16_t event,
+                                    const uint8_t * data, uint8_t size) {
+    struct hci_cmd * cmd;
+
+    cmd = queue_find(hci->cmd_late, match_cmd_event, UINT_TO_PTR(event));
+    if (cmd) {
+        cmd_late_done(cmd);
+        return;
+    }
+
+    cmd = queue_find(hci->cmd_pending, match_cmd_event, UINT_TO_PTR(event));
+    if (cmd)
+        cmd_complete(cmd, 0, data, size);
+}
+
+static void handle_event(struct bt_hci * hci, uint8_t event,
+                         const uint8_t * data, uint8_t size) {
+    const struct queue_entry * entry;
+
+    switch (event) {
+        case EVT_CMD_COMPLETE:
+            handle_cmd_complete(hci, data, size);
+            break;
+        case EVT_CMD_STATUS:
+            handle_cmd_status(hci, data, size);
+            break;
+        case EVT_LE_META_EVENT:
+            if (size >= EVT_LE_META_EVENT_SIZE)
+                handle_completion_event(hci, BT_HCI_LE_EVENT(data[0]),
+                                        data + EVT_LE_META_EVENT_SIZE,
+                                        size - EVT_LE_META_EVENT_SIZE);
+            break;
+        default:
+            handle_completion_event(hci, event, data, size);
+            break;
+    }
+
+    hci->in_event = true;
+
+    for (entry = queue_get_entries(hci->evt_list); entry;
+            entry = entry->next) {
+        struct hci_evt * evt = entry->data;
+
+        if (evt->removed || evt->event != event)
+            continue;
+
+        evt->callback(data, size, evt->user_data);
+    }
+
+    hci->in_event = false;
+
+    queue_remove_all(hci->evt_list, match_evt_removed, NULL, evt_free);
+}
+
+static bool can_read_data(struct io * io, void * user_data) {
+    struct bt_hci * hci = user_data;
+    uint8_t buf[HCI_MAX_EVENT_SIZE];
+    const hci_event_hdr * hdr;
+    ssize_t len;
+
+    len = read(io_get_fd(io), buf, sizeof(buf));
+    if (len < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT)
+        return true;
+
+    hdr = (const void *) (buf + 1);
+    if (len < 1 + HCI_EVENT_HDR_SIZE + hdr->plen)
+        return true;
+
+    bt_hci_ref(hci);
+    handle_event(hci, hdr->evt, buf + 1 + HCI_EVENT_HDR_SIZE, hdr->plen);
+    bt_hci_unref(hci);
+
+    return true;
+}
+
+/**
+ * write a command to the socket
+ *
+ * @return 0, -EAGAIN if the socket is full, else the write error
+ */
+static int cmd_write(struct bt_hci * hci, struct hci_cmd * cmd) {
+    uint8_t type = HCI_COMMAND_PKT;
+    hci_command_hdr hdr;
+    struct iovec iov[3];
+    int iovcnt = 2;
+
+    hdr.opcode = htobs(cmd->opcode);
+    hdr.plen = cmd->size;
+
+    iov[0].iov_base = &type;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = &hdr;
+    iov[1].iov_len = HCI_COMMAND_HDR_SIZE;
+    if (cmd->size) {
+        iov[2].iov_base = cmd->data;
+        iov[2].iov_len = cmd->size;
+        iovcnt = 3;
+    }
+
+    while (writev(hci->fd, iov, iovcnt) < 0) {
+        if (errno == EINTR)
+            continue;
+
+        return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+    }
+
+    return 0;
+}
+
+static bool can_write_data(__attribute__((unused)) struct io * io,
+                           void * user_data) {
+    struct bt_hci * hci = user_data;
+    struct hci_cmd * cmd;
+    bool more;
+    int err;
+
+    while ((cmd = queue_peek_head(hci->cmd_queue))) {
+        err = cmd_write(hci, cmd);
+        if (err == -EAGAIN)
+            return true;
+
+        queue_remove(hci->cmd_queue, cmd);
+
+        if (err < 0) {
+            bt_hci_ref(hci);
+            cmd_complete(cmd, err, NULL, 0);
+            more = !queue_isempty(hci->cmd_queue);
+            bt_hci_unref(hci);
+            return more;
+        }
+
+        queue_push_tail(hci->cmd_pending, cmd);
+    }
+
+    return false;
+}
+
+static void write_watch_destroy(void * user_data) {
+    struct bt_hci * hci = user_data;
+
+    hci->writer_active = false;
+}
+
+static void wakeup_writer(struct bt_hci * hci) {
+    if (hci->writer_active)
+        return;
+
+    if (!io_set_write_handler(hci->io, can_write_data, hci,
+                              write_watch_destroy))
+        return;
+
+    hci->writer_active = true;
+}
+
+/**
+ * attach an engine to a raw HCI socket, the socket is closed on the last
+ * unref and must not be used with hci_send_req() any more
+ *
+ * @param fd	raw HCI socket (hci_open_dev)
+ * @return engine or NULL
+ */
+struct bt_hci * bt_hci_new(int fd) {
+    struct bt_hci * hci;
+    struct hci_filter flt;
+    int flags;
+
+    if (fd < 0)
+        return NULL;
+
+    hci_filter_clear(&flt);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &flt);
+    hci_filter_all_events(&flt);
+    if (setsockopt(fd, SOL_HCI, HCI_FILTER, &flt, sizeof(flt)) < 0)
+        return NULL;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return NULL;
+
+    hci = new0(struct bt_hci, 1);
+    if (!hci)
+        return NULL;
+
+    hci->fd = fd;
+    hci->next_cmd_id = 1;
+    hci->next_evt_id = 1;
+
+    hci->io = io_new(fd);
+    if (!hci->io)
+        goto fail;
+
+    hci->cmd_pending = queue_new();
+    if (!hci->cmd_pending)
+        goto fail;
+
+    hci->cmd_queue = queue_new();
+    if (!hci->cmd_queue)
+        goto fail;
+
+    hci->cmd_late = queue_new();
+    if (!hci->cmd_late)
+        goto fail;
+
+    hci->evt_list = queue_new();
+    if (!hci->evt_list)
+        goto fail;
+
+    if (!io_set_read_handler(hci->io, can_read_data, hci, NULL))
+        goto fail;
+
+    io_set_close_on_destroy(hci->io, true);
+
+    return bt_hci_ref(hci);
+
+fail:
+    queue_destroy(hci->evt_list, NULL);
+    queue_destroy(hci->cmd_late, NULL);
+    queue_destroy(hci->cmd_queue, NULL);
+    queue_destroy(hci->cmd_pending, NULL);
+    io_destroy(hci->io);
+    free(hci);
+    return NULL;
+}
+
+/**
+ * open an adapter and attach an engine to it
+ *
+ * @param dev_id	adapter index
+ * @return engine or NULL
+ */
+struct bt_hci * bt_hci_open(int dev_id) {
+    struct bt_hci * hci;
+    int fd;
+
+    fd = hci_open_dev(dev_id);
+    if (fd < 0)
+        return NULL;
+
+    hci = bt_hci_new(fd);
+    if (!hci)
+        close(fd);
+
+    return hci;
+}
+
+struct bt_hci * bt_hci_ref(struct bt_hci * hci) {
+    if (!hci)
+        return NULL;
+
+    __sync_fetch_and_add(&hci->ref_count, 1);
+
+    return hci;
+}
+
+void bt_hci_unref(struct bt_hci * hci) {
+    if (!hci)
+        return;
+
+    if (__sync_sub_and_fetch(&hci->ref_count, 1))
+        return;
+
+    queue_destroy(hci->evt_list, evt_free);
+    queue_destroy(hci->cmd_late, cmd_free);
+    queue_destroy(hci->cmd_queue, cmd_free);
+    queue_destroy(hci->cmd_pending, cmd_free);
+    io_destroy(hci->io);
+    free(hci);
+}
+
+/**
+ * send a command without waiting for the controller, a command the socket
+ * cannot take right now is queued and written once it is writable
+ *
+ * @param hci		engine
+ * @param opcode	command opcode (cmd_opcode_pack)
+ * @param event		0 to complete on Command Complete, else the event
+ *					(or BT_HCI_LE_EVENT(subevent)) that carries the result
+ *					once the Command Status is received
+ * @param data		command parameters
+ * @param size		parameters length
+ * @param callback	completion
+ * @param user_data	user pointer
+ * @param destroy	user pointer cleanup
+ * @return command id or 0 on error
+ */
+unsigned int bt_hci_send(struct bt_hci * hci, uint16_t opcode, uint16_t event,
+                         const void * data, uint8_t size,
+                         bt_hci_callback_func_t callback,
+                         void * user_data, bt_hci_destroy_func_t destroy) {
+    return bt_hci_send_timeout(hci, opcode, event, HCI_EVT_TIMEOUT, data, size,
+                               callback, user_data, destroy);
+}
+
+/**
+ * bt_hci_send() with the time the completion event may take
+ *
+ * @param event_timeout	ms from the Command Status to the completion event,
+ *						0 for the default
+ */
+unsigned int bt_hci_send_timeout(struct bt_hci * hci, uint16_t opcode,
+                                 uint16_t event, unsigned int event_timeout,
+                                 const void * data, uint8_t size,
+                                 bt_hci_callback_func_t callback,
+                                 void * user_data,
+                                 bt_hci_destroy_func_t destroy) {
+    struct queue * queue;
+    struct hci_cmd * cmd;
+    int err;
+
+    if (!hci)
+        return 0;
+
+    cmd = new0(struct hci_cmd, 1);
+    if (!cmd)
+        return 0;
+
+    cmd->hci = hci;
+    cmd->opcode = opcode;
+    cmd->event = event;
+    cmd->event_timeout = event_timeout ? event_timeout : HCI_EVT_TIMEOUT;
+
+    if (size) {
+        cmd->data = malloc(size);
+        if (!cmd->data) {
+            free(cmd);
+            return 0;
+        }
+
+        memcpy(cmd->data, data, size);
+        cmd->size = size;
+    }
+
+    /* behind queued commands, the order of the same opcode must hold */
+    err = queue_isempty(hci->cmd_queue) ? cmd_write(hci, cmd) : -EAGAIN;
+    if (err < 0 && err != -EAGAIN) {
+        cmd_free(cmd);
+        return 0;
+    }
+
+    queue = err ? hci->cmd_queue : hci->cmd_pending;
+    if (!queue_push_tail(queue, cmd)) {
+        cmd_free(cmd);
+        return 0;
+    }
+
+    if (hci->next_cmd_id < 1)
+        hci->next_cmd_id = 1;
+
+    cmd->id = hci->next_cmd_id++;
+    cmd->callback = callback;
+    cmd->destroy = destroy;
+    cmd->user_data = user_data;
+    cmd->timeout_id = timeout_add(HCI_CMD_TIMEOUT, cmd_timeout_cb, cmd, NULL);
+
+    if (err)
+        wakeup_writer(hci);
+
+    return cmd->id;
+}
+
+/**
+ * cancel a pending command, its callback is called with -ECANCELED
+ *
+ * @param hci	engine
+ * @param id	command id
+ * @return true if the command was pending
+ */
+bool bt_hci_cancel(struct bt_hci * hci, unsigned int id) {
+    struct hci_cmd * cmd;
+
+    if (!hci || !id)
+        return false;
+
+    cmd = queue_find(hci->cmd_pending, match_cmd_id, UINT_TO_PTR(id));
+    if (!cmd)
+        cmd = queue_find(hci->cmd_queue, match_cmd_id, UINT_TO_PTR(id));
+    if (!cmd)
+        return false;
+
+    cmd_abandon(cmd, -ECANCELED);
+
+    return true;
+}
+
+bool bt_hci_cancel_all(struct bt_hci * hci) {
+    struct hci_cmd * cmd;
+
+    if (!hci)
+        return false;
+
+    while ((cmd = queue_peek_head(hci->cmd_pending)))
+        cmd_abandon(cmd, -ECANCELED);
+
+    while ((cmd = queue_peek_head(hci->cmd_queue)))
+        cmd_complete(cmd, -ECANCELED, NULL, 0);
+
+    return true;
+}
+
+/**
+ * subscribe to an HCI event
+ *
+ * @param hci		engine
+ * @param event		event code
+ * @param callback	called with the event parameters
+ * @param user_data	user pointer
+ * @param destroy	user pointer cleanup
+ * @return registration id or 0 on error
+ */
+unsigned int bt_hci_register(struct bt_hci * hci, uint8_t event,
+                             bt_hci_event_func_t callback,
+                             void * user_data, bt_hci_destroy_func_t destroy) {
+    struct hci_evt * evt;
+
+    if (!hci || !callback)
+        return 0;
+
+    evt = new0(struct hci_evt, 1);
+    if (!evt)
+        return 0;
+
+    if (hci->next_evt_id < 1)
+        hci->next_evt_id = 1;
+
+    evt->id = hci->next_evt_id++;
+    evt->event = event;
+    evt->callback = callback;
+    evt->destroy = destroy;
+    evt->user_data = user_data;
+
+    if (!queue_push_tail(hci->evt_list, evt)) {
+        free(evt);
+        return 0;
+    }
+
+    return evt->id;
+}
+
+bool bt_hci_unregister(struct bt_hci * hci, unsigned int id) {
+    struct hci_evt * evt;
+
+    if (!hci || !id)
+        return false;
+
+    if (hci->in_event) {
+        evt = queue_find(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
+        if (!evt)
+            return false;
+
+        evt->removed = true;
+        return true;
+    }
+
+    evt = queue_remove_if(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
+    if (!evt)
+        return false;
+
+    evt_free(evt);
+
+    return true;
+}
+
+/**
+ * read the RSSI of a connection, the result is a read_rssi_rp
+ */
+unsigned int bt_hci_read_rssi(struct bt_hci * hci, uint16_t handle,
+                              bt_hci_callback_func_t callback,
+                              void * user_data, bt_hci_destroy_func_t destroy) {
+    uint16_t cp = htobs(handle);
+
+    return bt_hci_send(hci, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI),
+                       0, &cp, sizeof(cp), callback, user_data, destroy);
+}
+
+/**
+ * update LE connection parameters, the result is an
+ * evt_le_connection_update_complete or the failed status byte. The event
+ * comes at the instant, at least 6 connection events away, and a link that
+ * goes quiet may take the supervision timeout to report it
+ */
+unsigned int bt_hci_le_conn_update(struct bt_hci * hci, uint16_t handle,
+                                   uint16_t min_interval, uint16_t max_interval,
+                                   uint16_t latency, uint16_t supervision_timeout,
+                                   bt_hci_callback_func_t callback,
+                                   void * user_data, bt_hci_destroy_func_t destroy) {
+    le_connection_update_cp cp;
+    unsigned int event_timeout;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.handle = htobs(handle);
+    cp.min_interval = htobs(min_interval);
+    cp.max_interval = htobs(max_interval);
+    cp.latency = htobs(latency);
+    cp.supervision_timeout = htobs(supervision_timeout);
+    cp.min_ce_length = htobs(0x0001);
+    cp.max_ce_length = htobs(0x0001);
+
+    /* 1.25 ms interval and 10 ms supervision timeout units */
+    event_timeout = supervision_timeout * 10 + 7 * max_interval * 5 / 4;
+    if (event_timeout < HCI_EVT_TIMEOUT)
+        event_timeout = HCI_EVT_TIMEOUT;
+
+    return bt_hci_send_timeout(hci,
+                               cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CONN_UPDATE),
+                               BT_HCI_LE_EVENT(EVT_LE_CONN_UPDATE_COMPLETE),
+                               event_timeout, &cp, LE_CONN_UPDATE_CP_SIZE,
+                               callback, user_data, destroy);
+}
+
+/**
+ * add a device to the white list, the result is the status byte
+ */
+unsigned int bt_hci_le_add_white_list(struct bt_hci * hci, const bdaddr_t * bdaddr,
+                                      uint8_t type, bt_hci_callback_func_t callback,
+                                      void * user_data, bt_hci_destroy_func_t destroy) {
+    le_add_device_to_white_list_cp cp;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.bdaddr_type = type;
+    bacpy(&cp.bdaddr, bdaddr);
+
+    return bt_hci_send(hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST),
+                       0, &cp, LE_ADD_DEVICE_TO_WHITE_LIST_CP_SIZE,
+                       callback, user_data, destroy);
+}
+
+/**
+ * remove a device from the white list, the result is the status byte
+ */
+unsigned int bt_hci_le_rm_white_list(struct bt_hci * hci, const bdaddr_t * bdaddr,
+                                     uint8_t type, bt_hci_callback_func_t callback,
+                                     void * user_data, bt_hci_destroy_func_t destroy) {
+    le_remove_device_from_white_list_cp cp;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.bdaddr_type = type;
+    bacpy(&cp.bdaddr, bdaddr);
+
+    return bt_hci_send(hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_REMOVE_DEVICE_FROM_WHITE_LIST),
+                       0, &cp, LE_REMOVE_DEVICE_FROM_WHITE_LIST_CP_SIZE,
+                       callback, user_data, destroy);
+}
+
+/**
+ * clear the white list, the result is the status byte
+ */
+unsigned int bt_hci_le_clear_white_list(struct bt_hci * hci,
+                                        bt_hci_callback_func_t callback,
+                                        void * user_data, bt_hci_destroy_func_t destroy) {
+    return bt_hci_send(hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST),
+                       0, NULL, 0, callback, user_data, destroy);
+}
@@ -0,0 +1,93 @@
+/**
+ * @file hci-engine.h
+ * @brief asynchronous HCI command/event engine on the mainloop
+ * @see hci-engine.c
+ */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SRC_HCI_ENGINE_H
+#define SRC_HCI_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bluetooth.h"
+
+/* complete a command on an LE meta sub event instead of Command Complete */
+#define BT_HCI_LE_EVENT(subevent)	(0x100 | (subevent))
+
+struct bt_hci;
+
+/**
+ * command completion
+ *
+ * @param err		0, -ETIMEDOUT or -ECANCELED (data is NULL then)
+ * @param data		Command Complete return parameters (status first),
+ *					the Command Status status byte on failure or the
+ *					completion event parameters
+ * @param size		data length
+ * @param user_data	user pointer
+ */
+typedef void (*bt_hci_callback_func_t)(int err, const void * data,
+                                       uint8_t size, void * user_data);
+typedef void (*bt_hci_event_func_t)(const void * data, uint8_t size,
+                                    void * user_data);
+typedef void (*bt_hci_destroy_func_t)(void * user_data);
+
+struct bt_hci * bt_hci_new(int fd);
+struct bt_hci * bt_hci_open(int dev_id);
+
+struct bt_hci * bt_hci_ref(struct bt_hci * hci);
+void bt_hci_unref(struct bt_hci * hci);
+
+unsigned int bt_hci_send(struct bt_hci * hci, uint16_t opcode, uint16_t event,
+                         const void * data, uint8_t size,
+                         bt_hci_callback_func_t callback,
+                         void * user_data, bt_hci_destroy_func_t destroy);
+unsigned int bt_hci_send_timeout(struct bt_hci * hci, uint16_t opcode,
+                                 uint16_t event, unsigned int event_timeout,
+                                 const void * data, uint8_t size,
+                                 bt_hci_callback_func_t callback,
+                                 void * user_data,
+                                 bt_hci_destroy_func_t destroy);
+bool bt_hci_cancel(struct bt_hci * hci, unsigned int id);
+bool bt_hci_cancel_all(struct bt_hci * hci);
+
+unsigned int bt_hci_register(struct bt_hci * hci, uint8_t event,
+                             bt_hci_event_func_t callback,
+                             void * user_data, bt_hci_destroy_func_t destroy);
+bool bt_hci_unregister(struct bt_hci * hci, unsigned int id);
+
+unsigned int bt_hci_read_rssi(struct bt_hci * hci, uint16_t handle,
+                              bt_hci_callback_func_t callback,
+                              void * user_data, bt_hci_destroy_func_t destroy);
+unsigned int bt_hci_le_conn_update(struct bt_hci * hci, uint16_t handle,
+                                   uint16_t min_interval, uint16_t max_interval,
+                                   uint16_t latency, uint16_t supervision_timeout,
+                                   bt_hci_callback_func_t callback,
+                                   void * user_data, bt_hci_destroy_func_t destroy);
+unsigned int bt_hci_le_add_white_list(struct bt_hci * hci, const bdaddr_t * bdaddr,
+                                      uint8_t type, bt_hci_callback_func_t callback,
+                                      void * user_data, bt_hci_destroy_func_t destroy);
+unsigned int bt_hci_le_rm_white_list(struct bt_hci * hci, const bdaddr_t * bdaddr,
+                                     uint8_t type, bt_hci_callback_func_t callback,
+                                     void * user_data, bt_hci_destroy_func_t destroy);
+unsigned int bt_hci_le_clear_white_list(struct bt_hci * hci,
+                                        bt_hci_callback_func_t callback,
+                                        void * user_data, bt_hci_destroy_func_t destroy);
+
+#endif //SRC_HCI_ENGINE_H
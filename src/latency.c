@@ -0,0 +1,97 @@
+/**
+ * @file latency.c
+ * @brief log-linear latency histogram, HDR style, fixed memory
+ *
+ * Adding a value is a count leading zeros and an increment, no allocation
+ * and no floating point. The whole uint32_t range fits in LATENCY_BUCKETS
+ * counters, with microseconds that is over an hour at a relative error of
+ * at most 1/16. Percentiles report the highest value of their bucket,
+ * capped to the largest value seen.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "latency.h"
+
+static unsigned int bucket_index(uint32_t value) {
+    unsigned int msb, shift;
+
+    if (value < LATENCY_LINEAR)
+        return value;
+
+    msb = 31 - __builtin_clz(value);
+    shift = msb - LATENCY_SUB_BITS;
+
+    /* value >> shift keeps the msb and SUB_BITS bits below it */
+    return LATENCY_LINEAR + (msb - LATENCY_SUB_BITS - 1) * LATENCY_SUB_COUNT +
+           (value >> shift) - LATENCY_SUB_COUNT;
+}
+
+static uint32_t bucket_highest(unsigned int index) {
+    unsigned int group, shift;
+    uint64_t mantissa;
+
+    if (index < LATENCY_LINEAR)
+        return index;
+
+    group = (index - LATENCY_LINEAR) / LATENCY_SUB_COUNT;
+    shift = group + 1;
+    mantissa = LATENCY_SUB_COUNT + (index - LATENCY_LINEAR) % LATENCY_SUB_COUNT;
+
+    return (uint32_t)(((mantissa + 1) << shift) - 1);
+}
+
+void latency_hist_reset(struct latency_hist * hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void latency_hist_add(struct latency_hist * hist, uint32_t value) {
+    if (!hist->count || value < hist->min)
+        hist->min = value;
+
+    if (value > hist->max)
+        hist->max = value;
+
+    hist->count++;
+    hist->sum += value;
+    hist->buckets[bucket_index(value)]++;
+}
+
+/**
+ * value below which a share of the samples falls
+ *
+ * @param hist		histogram
+ * @param permille	share in 1/1000, 500 is the median, 1000 the maximum
+ * @return value or 0 if the histogram is empty
+ */
+uint32_t latency_hist_percentile(const struct latency_hist * hist,
+                                 unsigned int permille) {
+    uint64_t rank, seen = 0;
+    unsigned int i;
+    uint32_t value;
+
+    if (!hist->count)
+        return 0;
+
+    if (permille >= 1000)
+        return hist->max;
+
+    /* smallest rank covering permille of the samples, at least 1 */
+    rank = (hist->count * permille + 999) / 1000;
+    if (!rank)
+        rank = 1;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+
+    value = bucket_highest(i);
+
+    return value < hist->max ? value : hist->max;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file latency.h
+ * @brief log-linear latency histogram, HDR style, fixed memory
+ * @see latency.c
+ */
+#ifndef SRC_LATENCY_H
+#define SRC_LATENCY_H
+
+#include <stdint.h>
+
+/* values below 2^(LATENCY_SUB_BITS + 1) are exact, then 2^SUB_BITS buckets
+ * per power of two, a reported value is within 1/16 of the real one */
+#define LATENCY_SUB_BITS	4
+#define LATENCY_SUB_COUNT	(1 << LATENCY_SUB_BITS)
+#define LATENCY_LINEAR		(2 * LATENCY_SUB_COUNT)
+#define LATENCY_BUCKETS		(LATENCY_LINEAR + \
+                             (31 - LATENCY_SUB_BITS) * LATENCY_SUB_COUNT)
+
+struct latency_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+void latency_hist_reset(struct latency_hist * hist);
+void latency_hist_add(struct latency_hist * hist, uint32_t value);
+uint32_t latency_hist_percentile(const struct latency_hist * hist,
+                                 unsigned int permille);
+
+#endif //SRC_LATENCY_H
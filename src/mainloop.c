@@ -37,19 +37,24 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 #include <signal.h>
 
 #include "mainloop.h"
 
-#define MAX_EPOLL_EVENTS 10
+/* epoll_wait batch: starts small, doubles whenever a wakeup fills it */
+#define MIN_EPOLL_EVENTS 16
+#define MAX_EPOLL_EVENTS 1024
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -69,14 +74,28 @@ struct mainloop_data {
     mainloop_destroy_func destroy;
     /// pointer to a user specific data structure
     void * user_data;
+    /// next entry removed during the current dispatch
+    struct mainloop_data * next;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+/* initial mainloop_list size, the table doubles to fit the highest fd */
+#define MIN_MAINLOOP_ENTRIES 128
 
 /**
- * @brief array of file descriptor event stub
+ * @brief array of file descriptor event stub, indexed by fd
  */
-static struct mainloop_data * mainloop_list[MAX_MAINLOOP_ENTRIES];
+static struct mainloop_data ** mainloop_list;
+/// allocated entries in mainloop_list
+static unsigned int mainloop_list_size;
+/// registered entries in mainloop_list
+static unsigned int mainloop_list_count;
+/// highest registered fd + 1, bounds the teardown scan
+static unsigned int mainloop_list_max;
+
+/// set while the events of an epoll_wait batch are dispatched
+static int mainloop_dispatching;
+/// entries removed during the dispatch, the batch may still point at them
+static struct mainloop_data * mainloop_removed;
 
 struct timeout_data {
     int fd;
@@ -95,18 +114,94 @@ struct signal_data {
 
 static struct signal_data * signal_data;
 
+/**
+ * @brief task handed to the mainloop by mainloop_post
+ */
+struct post_data {
+    mainloop_post_func callback;
+    void * user_data;
+    struct post_data * next;
+    /// next free pool entry, index + 1, 0 ends the free list
+    uint32_t free_next;
+};
+
+/* posted tasks come from this pool, malloc only runs when it is dry */
+#define POST_POOL_SIZE 64
+
+/// eventfd waking the mainloop when post_list becomes non empty
+static int post_fd = -1;
+/// lock free LIFO of posted tasks, producers push, the mainloop takes all
+static struct post_data * post_list;
+static struct post_data post_pool[POST_POOL_SIZE];
+/// free pool entries, first index + 1 in the low half, ABA tag in the high
+static uint64_t post_free;
+
+/**
+ * grow mainloop_list so that fd can be used as an index
+ *
+ * @param fd	file descriptor to fit
+ * @return 0 success else -ENOMEM
+ */
+static int mainloop_list_grow(int fd) {
+    struct mainloop_data ** list;
+    unsigned int size = mainloop_list_size ? mainloop_list_size :
+                        MIN_MAINLOOP_ENTRIES;
+
+    while (size <= (unsigned int) fd)
+        size *= 2;
+
+    if (size == mainloop_list_size)
+        return 0;
+
+    list = realloc(mainloop_list, size * sizeof(*list));
+    if (!list)
+        return -ENOMEM;
+
+    memset(list + mainloop_list_size, 0,
+           (size - mainloop_list_size) * sizeof(*list));
+
+    mainloop_list = list;
+    mainloop_list_size = size;
+
+    return 0;
+}
+
+/**
+ * return the mainloop_list entry of fd or NULL
+ *
+ * @param fd	file descriptor
+ */
+static inline struct mainloop_data * mainloop_list_get(int fd) {
+    if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+        return NULL;
+
+    return mainloop_list[fd];
+}
+
 /**
  * create the epoll resource (epoll_fd global variable)
  * initialize mainloop_list (global variable) event table
  * set epoll_terminate to 0 (mainloop_run looping)
  */
 void mainloop_init(void) {
-    unsigned int i;
-
     epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-    for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-        mainloop_list[i] = NULL;
+    /* kept across mainloop_run calls so other threads can always post */
+    if (post_fd < 0) {
+        unsigned int i;
+
+        for (i = 0; i < POST_POOL_SIZE; i++)
+            post_pool[i].free_next = i + 1 < POST_POOL_SIZE ? i + 2 : 0;
+
+        post_free = 1;
+        post_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    if (mainloop_list)
+        memset(mainloop_list, 0, mainloop_list_size * sizeof(*mainloop_list));
+
+    mainloop_list_count = 0;
+    mainloop_list_max = 0;
 
     epoll_terminate = 0;
 }
@@ -160,6 +255,97 @@ static void signal_callback(int fd, uint32_t events, void * user_data) {
         data->callback(si.ssi_signo, data->user_data);
 }
 
+/**
+ * take a post_data from the pool, any thread. The tag changes with every
+ * pop and push so an entry popped and pushed back under a concurrent pop
+ * fails its compare and swap.
+ *
+ * @return entry, NULL if the pool is empty and malloc failed
+ */
+static struct post_data * post_data_get(void) {
+    uint64_t head, next;
+    uint32_t idx;
+
+    head = __atomic_load_n(&post_free, __ATOMIC_ACQUIRE);
+    do {
+        idx = (uint32_t) head;
+        if (!idx)
+            return malloc(sizeof(struct post_data));
+
+        next = (((head >> 32) + 1) << 32) |
+               __atomic_load_n(&post_pool[idx - 1].free_next,
+                               __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&post_free, &head, next, true,
+                                          __ATOMIC_ACQUIRE,
+                                          __ATOMIC_ACQUIRE));
+
+    return &post_pool[idx - 1];
+}
+
+/**
+ * give a post_data back once its task ran, mainloop thread
+ */
+static void post_data_put(struct post_data * data) {
+    uint64_t head, next;
+    uint32_t idx;
+
+    if (data < post_pool || data >= post_pool + POST_POOL_SIZE) {
+        free(data);
+        return;
+    }
+
+    idx = data - post_pool + 1;
+
+    head = __atomic_load_n(&post_free, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&data->free_next, (uint32_t) head,
+                         __ATOMIC_RELAXED);
+        next = (((head >> 32) + 1) << 32) | idx;
+    } while (!__atomic_compare_exchange_n(&post_free, &head, next, true,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+/**
+ * run every posted task, oldest first
+ *
+ * @param fd		post_fd
+ * @param events	epoll events
+ * @param user_data	unused
+ */
+static void post_callback(int fd, uint32_t events,
+                          __attribute__((unused)) void * user_data) {
+    struct post_data * list, * reversed = NULL;
+    uint64_t count;
+
+    if (events & (EPOLLERR | EPOLLHUP))
+        return;
+
+    /* reset the eventfd before taking the list, a task pushed after the
+     * exchange then wakes us up again */
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return;
+
+    list = __atomic_exchange_n(&post_list, NULL, __ATOMIC_ACQUIRE);
+
+    while (list) {
+        struct post_data * next = list->next;
+
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+
+    while (reversed) {
+        struct post_data * data = reversed;
+
+        reversed = data->next;
+
+        data->callback(data->user_data);
+        post_data_put(data);
+    }
+}
+
 /**
  * main loop wait for epoll events
  * to exit the loop, set epoll_terminate to a <>0 value
@@ -169,6 +355,8 @@ static void signal_callback(int fd, uint32_t events, void * user_data) {
  * @return exit_status EXIT_SUCCESS or EXIT_FAILURE
  */
 int mainloop_run(void) {
+    struct epoll_event * events;
+    int max_events = MIN_EPOLL_EVENTS;
     unsigned int i;
 
     if (signal_data) {
@@ -187,24 +375,63 @@ int mainloop_run(void) {
         }
     }
 
+    if (post_fd >= 0 && mainloop_add_fd(post_fd, EPOLLIN, post_callback,
+                                        NULL, NULL) < 0)
+        return EXIT_FAILURE;
+
+    events = malloc(max_events * sizeof(*events));
+    if (!events)
+        return EXIT_FAILURE;
+
     exit_status = EXIT_SUCCESS;
 
     while (!epoll_terminate) {
-        struct epoll_event events[MAX_EPOLL_EVENTS];
         int n, nfds;
 
-        nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        nfds = epoll_wait(epoll_fd, events, max_events, -1);
         if (nfds < 0)
             continue;
 
+        mainloop_dispatching = 1;
+
         for (n = 0; n < nfds; n++) {
             struct mainloop_data * data = events[n].data.ptr;
 
+            /* removed by an earlier callback of this batch */
+            if (!data->callback)
+                continue;
+
             data->callback(data->fd, events[n].events,
                            data->user_data);
         }
+
+        mainloop_dispatching = 0;
+
+        while (mainloop_removed) {
+            struct mainloop_data * data = mainloop_removed;
+
+            mainloop_removed = data->next;
+            free(data);
+        }
+
+        /* a full batch means more fds were ready: drain more next time */
+        if (nfds == max_events && max_events < MAX_EPOLL_EVENTS) {
+            struct epoll_event * bigger;
+
+            bigger = realloc(events, 2 * max_events * sizeof(*events));
+            if (bigger) {
+                events = bigger;
+                max_events *= 2;
+            }
+        }
     }
 
+    free(events);
+
+    /* tasks still queued are run by the next mainloop_run */
+    if (post_fd >= 0)
+        mainloop_remove_fd(post_fd);
+
     if (signal_data) {
         mainloop_remove_fd(signal_data->fd);
         close(signal_data->fd);
@@ -213,12 +440,13 @@ int mainloop_run(void) {
             signal_data->destroy(signal_data->user_data);
     }
 
-    for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+    for (i = 0; i < mainloop_list_max && mainloop_list_count; i++) {
         struct mainloop_data * data = mainloop_list[i];
 
-        mainloop_list[i] = NULL;
-
         if (data) {
+            mainloop_list[i] = NULL;
+            mainloop_list_count--;
+
             epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
             if (data->destroy)
@@ -228,6 +456,8 @@ int mainloop_run(void) {
         }
     }
 
+    mainloop_list_max = 0;
+
     close(epoll_fd);
     epoll_fd = 0;
 
@@ -251,9 +481,12 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
     struct epoll_event ev;
     int err;
 
-    if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+    if (fd < 0 || !callback)
         return -EINVAL;
 
+    if (mainloop_list_grow(fd) < 0)
+        return -ENOMEM;
+
     data = malloc(sizeof(*data));
     if (!data)
         return -ENOMEM;
@@ -276,6 +509,10 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
     }
 
     mainloop_list[fd] = data;
+    mainloop_list_count++;
+
+    if ((unsigned int) fd >= mainloop_list_max)
+        mainloop_list_max = fd + 1;
 
     return 0;
 }
@@ -293,10 +530,10 @@ int mainloop_modify_fd(int fd, uint32_t events) {
     struct epoll_event ev;
     int err;
 
-    if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+    if (fd < 0)
         return -EINVAL;
 
-    data = mainloop_list[fd];
+    data = mainloop_list_get(fd);
     if (!data)
         return -ENXIO;
 
@@ -317,21 +554,27 @@ int mainloop_remove_fd(int fd) {
     struct mainloop_data * data;
     int err;
 
-    if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+    if (fd < 0)
         return -EINVAL;
 
-    data = mainloop_list[fd];
+    data = mainloop_list_get(fd);
     if (!data)
         return -ENXIO;
 
     mainloop_list[fd] = NULL;
+    mainloop_list_count--;
 
     err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
     if (data->destroy)
         data->destroy(data->user_data);
 
-    free(data);
+    if (mainloop_dispatching) {
+        data->callback = NULL;
+        data->next = mainloop_removed;
+        mainloop_removed = data;
+    } else
+        free(data);
 
     return err;
 }
@@ -344,6 +587,8 @@ static void timeout_destroy(void * user_data) {
 
     if (data->destroy)
         data->destroy(data->user_data);
+
+    free(data);
 }
 
 static void timeout_callback(__attribute__((unused)) int fd, uint32_t events, void * user_data) {
@@ -370,7 +615,7 @@ static inline int timeout_set(int fd, unsigned int msec) {
     itimer.it_interval.tv_sec = 0;
     itimer.it_interval.tv_nsec = 0;
     itimer.it_value.tv_sec = sec;
-    itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000;
+    itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000000;
 
     return timerfd_settime(fd, 0, &itimer, NULL);
 }
@@ -431,6 +676,52 @@ int mainloop_remove_timeout(int id) {
     return mainloop_remove_fd(id);
 }
 
+/**
+ * schedule callback(user_data) on the mainloop thread
+ * can be called from any thread, the push is lock free and the eventfd is
+ * only written when the queue was empty, so a burst of posts costs one
+ * syscall and is run in one batch
+ *
+ * @param callback	function to run from mainloop_run
+ * @param user_data	callback argument
+ * @return 0 success else <0 error
+ */
+int mainloop_post(mainloop_post_func callback, void * user_data) {
+    struct post_data * data;
+    struct post_data * head;
+    uint64_t one = 1;
+
+    if (!callback)
+        return -EINVAL;
+
+    if (post_fd < 0)
+        return -ENOTCONN;
+
+    data = post_data_get();
+    if (!data)
+        return -ENOMEM;
+
+    data->callback = callback;
+    data->user_data = user_data;
+
+    head = __atomic_load_n(&post_list, __ATOMIC_RELAXED);
+    do {
+        data->next = head;
+    } while (!__atomic_compare_exchange_n(&post_list, &head, data, true,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+
+    /* only the first task of a batch wakes the mainloop up. Once pushed
+     * the task belongs to the queue, a failed write only delays it */
+    if (!head) {
+        ssize_t result = write(post_fd, &one, sizeof(one));
+
+        (void) result;
+    }
+
+    return 0;
+}
+
 /**
  * set mainloop signal handler (signal_data) usally SIGINT and SIGTERM handler
  * signal_data is a global variable
@@ -27,6 +27,8 @@
 #include "dlog.h"
 #include "dfork.h"
 #include "dmem.h"
+#include "mainloop.h"
+#include "spsc-ring.h"
 
 #define HOSTNAME_SIZE 256
 
@@ -35,11 +37,39 @@
 #define MQTT_LWT_TOPIC "tele/%s/LWT"
 #define MQTT_SENSOR_TOPIC "tele/%s/SENSOR"
 #define MQTT_STATE_TOPIC "tele/%s/STATE"
+#define MQTT_DEVICE_LWT_TOPIC "tele/%s/%s/LWT"
+#define MQTT_DEVICE_STATE_TOPIC "tele/%s/%s/STATE"
 #define ONLINE "Online"
 #define OFFLINE "Offline"
 
 #define STATE_PUBLISH_INTERVAL 10000   // 10 sec
 
+#define MOSQ_MISC_INTERVAL 1000        // keepalive housekeeping, 1 sec
+#define MOSQ_BACKOFF_MIN 1000          // first reconnect delay, 1 sec
+#define MOSQ_BACKOFF_MAX 60000         // reconnect delay cap, 60 sec
+#define MOSQ_FLUSH_TIMEOUT 2000        // time given to the offline LWTs on exit, 2 sec
+
+#define MOSQ_SAMPLE_RING_SIZE 1024     // samples buffered between BLE and MQTT
+#define MOSQ_LATENCY_MAX 8             // ATT opcodes published per device
+
+/**
+ * per meter publisher state, only touched on the publisher side but for
+ * state, written by the BLE side
+ */
+struct mosq_device {
+    char * name;
+    /* change count << 1 | online, never dropped unlike the ring samples */
+    unsigned int state;
+    /* state last published */
+    unsigned int published_state;
+    uint64_t total_current;
+    uint64_t total_voltage;
+    unsigned int total_count;
+    /* last ATT latency snapshot per opcode, cleared when offline */
+    struct mosq_latency latency[MOSQ_LATENCY_MAX];
+    unsigned int latency_count;
+};
+
 typedef struct _client_info_t {
     struct mosquitto * m;
     bool do_exit;
@@ -57,6 +87,22 @@ char * hostname = "main-batt";
 static t_client_info client_info = {0};
 static int thermal_zone = 0;
 
+/* mainloop mode: mosquitto i/o is driven by epoll instead of mosq_th */
+static bool mosq_use_mainloop = false;
+static int mosq_fd = -1;
+static int mosq_misc_timer = -1;
+static int mosq_reconnect_timer = -1;
+static unsigned int mosq_backoff = 0;
+
+/* BLE notifications (producer) -> MQTT publisher thread (consumer) */
+static struct spsc_ring * sample_ring = NULL;
+
+/* fixed once mosq_init runs */
+static struct mosq_device * devices = NULL;
+static unsigned int devices_count = 0;
+
+static void mosq_watch_update(void);
+
 uint64_t timeMillis(void) {
     struct timeval time;
     gettimeofday(&time, NULL);
@@ -69,6 +115,12 @@ static const char * create_topic(const char * template) {
     return buf;
 }
 
+static const char * create_device_topic(const char * template, const struct mosq_device * dev) {
+    static __thread char buf[255] = {0};
+    snprintf(buf, sizeof(buf) - 1, template, hostname, dev->name);
+    return buf;
+}
+
 static void mqtt_publish_lwt(bool online) {
     const char * msg = online ? ONLINE : OFFLINE;
     int res;
@@ -77,6 +129,7 @@ static void mqtt_publish_lwt(bool online) {
     if ((res = mosquitto_publish(mosq, NULL, topic, (int) strlen(msg), msg, 0, true)) != 0) {
         DLOG_ERR("Can't publish to Mosquitto server %s", mosquitto_strerror(res));
     }
+    mosq_watch_update();
 }
 
 static void on_log(struct mosquitto * UNUSED(mosq),
@@ -104,7 +157,58 @@ static void mosq_sleep(t_client_info * info, int secs) {
     }
 }
 
-static bool mosq_publish_state(double current, double voltage) {
+static void mqtt_publish_device_lwt(const struct mosq_device * dev, bool online) {
+    const char * msg = online ? ONLINE : OFFLINE;
+    int res;
+    const char * topic = create_device_topic(MQTT_DEVICE_LWT_TOPIC, dev);
+    daemon_log(LOG_INFO, "publish %s: %s", topic, msg);
+    if ((res = mosquitto_publish(mosq, NULL, topic, (int) strlen(msg), msg, 0, true)) != 0) {
+        DLOG_ERR("Can't publish to Mosquitto server %s", mosquitto_strerror(res));
+    }
+    mosq_watch_update();
+}
+
+/**
+ * publish the averaged readings of one meter and reset its accumulators
+ *
+ * @param dev		meter publisher state
+ * @param tm_buffer	time stamp shared with the host state
+ */
+static void mosq_publish_device(struct mosq_device * dev, const char * tm_buffer) {
+    double current = dev->total_current * 0.001 / dev->total_count;
+    double voltage = dev->total_voltage * 0.001 / dev->total_count;
+    const char * topic = create_device_topic(MQTT_DEVICE_STATE_TOPIC, dev);
+    char buf[1024] = {};
+    size_t len;
+    int res;
+
+    len = snprintf(buf, sizeof(buf) - 1,
+                   "{\"Time\":\"%s\", \"Current\":%0.2f, \"Voltage\":%0.2f, \"Power\":%0.2f, \"Samples\":%u",
+                   tm_buffer, current, voltage, current * voltage, dev->total_count);
+    for (unsigned int i = 0; i < dev->latency_count && len < sizeof(buf) - 1; i++) {
+        const struct mosq_latency * lat = &dev->latency[i];
+
+        len += snprintf(buf + len, sizeof(buf) - 1 - len,
+                        "%s\"0x%02x\":{\"N\":%u, \"P50\":%u, \"P99\":%u, \"Max\":%u, \"WaitP99\":%u}",
+                        i ? ", " : ", \"AttLatency\":{", lat->opcode, lat->count, lat->p50_us,
+                        lat->p99_us, lat->max_us, lat->wait_p99_us);
+    }
+    if (len < sizeof(buf) - 1) {
+        snprintf(buf + len, sizeof(buf) - 1 - len, "%s}", dev->latency_count ? "}" : "");
+    }
+    daemon_log(LOG_INFO, "%s %s", topic, buf);
+
+    if ((res = mosquitto_publish(mosq, NULL, topic, (int) strlen(buf), buf, 0, false)) != 0) {
+        daemon_log(LOG_ERR, "Can't publish to Mosquitto server %s", mosquitto_strerror(res));
+    }
+    mosq_watch_update();
+
+    dev->total_current = 0;
+    dev->total_voltage = 0;
+    dev->total_count = 0;
+}
+
+static bool mosq_publish_state(void) {
 
     static uint64_t timer_publish_state = 0;
     static uint64_t last_timeMillis = 0;
@@ -122,7 +226,9 @@ static bool mosq_publish_state(double current, double voltage) {
 
     time_t timer;
     char tm_buffer[26] = {};
-    char buf[255] = {};
+    char buf[512] = {};
+    struct spsc_ring_stats stats = {0};
+    int len;
     struct tm * tm_info;
     struct sysinfo info;
     int res;
@@ -146,34 +252,120 @@ static bool mosq_publish_state(double current, double voltage) {
         FREE(f_name);
         int temp_C = atoi(buf) / 1000;
         const char * topic = create_topic(MQTT_STATE_TOPIC);
-        if (isnan(voltage) || isnan(current)) {
-            snprintf(buf, sizeof(buf) - 1,
-                     "{\"Time\":\"%s\", \"Uptime\": %ld, \"LoadAverage\":%.2f, \"CPUTemp\":%d}",
-                     tm_buffer, info.uptime / 3600, info.loads[0] / 65536.0, temp_C);
-        } else {
-            snprintf(buf, sizeof(buf) - 1,
-                     "{\"Time\":\"%s\", \"Uptime\": %ld, \"LoadAverage\":%.2f, \"CPUTemp\":%d, \"Current\":%0.2f, \"Voltage\":%0.2f, \"Power\":%0.2f}",
-                     tm_buffer, info.uptime / 3600, info.loads[0] / 65536.0, temp_C, current, voltage,
-                     current * voltage);
+        len = snprintf(buf, sizeof(buf) - 1,
+                       "{\"Time\":\"%s\", \"Uptime\": %ld, \"LoadAverage\":%.2f, \"CPUTemp\":%d",
+                       tm_buffer, info.uptime / 3600, info.loads[0] / 65536.0, temp_C);
+        if (sample_ring) {
+            spsc_ring_get_stats(sample_ring, &stats);
         }
+        snprintf(buf + len, sizeof(buf) - 1 - len,
+                 ", \"Devices\":%u, \"Samples\":%llu, \"Dropped\":%llu, \"RingHigh\":%u}",
+                 devices_count, (unsigned long long) stats.pushed, (unsigned long long) stats.dropped,
+                 stats.high_watermark);
         daemon_log(LOG_INFO, "%s %s", topic, buf);
 
         if ((res = mosquitto_publish(mosq, NULL, topic, (int) strlen(buf), buf, 0, false)) != 0) {
             daemon_log(LOG_ERR, "Can't publish to Mosquitto server %s", mosquitto_strerror(res));
         }
+        mosq_watch_update();
+    }
+
+    for (unsigned int i = 0; i < devices_count; i++) {
+        if (devices[i].total_count) {
+            mosq_publish_device(&devices[i], tm_buffer);
+        }
     }
     return true;
 }
 
+/**
+ * keep the latest latency snapshot of an opcode, the first MOSQ_LATENCY_MAX
+ * opcodes seen are kept
+ *
+ * @param dev	meter publisher state
+ * @param lat	snapshot
+ */
+static void mosq_device_latency(struct mosq_device * dev, const struct mosq_latency * lat) {
+    unsigned int i;
+
+    for (i = 0; i < dev->latency_count; i++) {
+        if (dev->latency[i].opcode == lat->opcode) {
+            break;
+        }
+    }
+    if (i == MOSQ_LATENCY_MAX) {
+        return;
+    }
+    if (i == dev->latency_count) {
+        dev->latency_count++;
+    }
+    dev->latency[i] = *lat;
+}
+
+/**
+ * publish the LWT of every device whose state changed since the last call
+ * a device that went offline loses its latency snapshots
+ */
+static void mosq_publish_device_states(void) {
+    for (unsigned int i = 0; i < devices_count; i++) {
+        struct mosq_device * dev = &devices[i];
+        unsigned int state = __atomic_load_n(&dev->state, __ATOMIC_ACQUIRE);
+
+        if (state == dev->published_state) {
+            continue;
+        }
+        mqtt_publish_device_lwt(dev, state & 1);
+        if (!(state & 1)) {
+            dev->latency_count = 0;
+        }
+        dev->published_state = state;
+    }
+}
+
+/**
+ * sort every queued sample into its device and publish the averages with
+ * the state, device state changes are published as they come
+ * runs on the publisher side only: mosq_thread_loop or the mainloop timer
+ */
+static void mosq_drain_samples(void) {
+    struct mosq_sample sample;
+
+    if (!sample_ring) {
+        return;
+    }
+    while (spsc_ring_pop(sample_ring, &sample)) {
+        struct mosq_device * dev;
+
+        if (sample.device >= devices_count) {
+            continue;
+        }
+        dev = &devices[sample.device];
+        switch (sample.kind) {
+        case MOSQ_SAMPLE_LATENCY:
+            mosq_device_latency(dev, &sample.latency);
+            break;
+        default:
+            dev->total_current += sample.current_ma;
+            dev->total_voltage += sample.voltage_mv;
+            dev->total_count++;
+            break;
+        }
+    }
+    mosq_publish_device_states();
+    mosq_publish_state();
+}
+
 static
 void on_connect(struct mosquitto * m, void * udata, int res) {
     t_client_info * info = (t_client_info *) udata;
     daemon_log(LOG_INFO, "%s", __FUNCTION__);
     switch (res) {
     case 0:
+        mosq_backoff = 0;
         mosquitto_subscribe(m, NULL, "stat/+/POWER", 0);
         mqtt_publish_lwt(true);
-        mosq_publish_state(NAN, NAN);
+        /* callbacks run on the publisher side, like mosq_drain_samples */
+        mosq_publish_state();
         break;
     case 1:
         DLOG_ERR("Connection refused (unacceptable protocol version).");
@@ -188,7 +380,8 @@ void on_connect(struct mosquitto * m, void * udata, int res) {
         DLOG_ERR("Unknown connection error. (%d)", res);
         break;
     }
-    if (res != 0) {
+    /* in mainloop mode the broker drops us and mosq_io_cb backs off */
+    if (res != 0 && !mosq_use_mainloop) {
         mosq_sleep(info, 10);
     }
 }
@@ -223,6 +416,7 @@ void * mosq_thread_loop(void * p) {
     daemon_log(LOG_INFO, "%s", __FUNCTION__);
     while (!info->do_exit) {
         int res = mosquitto_loop(info->m, 1000, 1);
+        mosq_drain_samples();
         switch (res) {
         case MOSQ_ERR_SUCCESS:
             break;
@@ -230,7 +424,7 @@ void * mosq_thread_loop(void * p) {
             int res = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
             if (res) {
                 daemon_log(LOG_ERR, "Can't connect to Mosquitto server %s", mosquitto_strerror(res));
-                sleep(30);
+                mosq_sleep(info, 30);
             }
             break;
         }
@@ -242,7 +436,7 @@ void * mosq_thread_loop(void * p) {
             daemon_log(LOG_ERR, "%s %s %s", __FUNCTION__, strerror(errno), mosquitto_strerror(res));
             mosquitto_disconnect(mosq);
             daemon_log(LOG_ERR, "%s disconnected", __FUNCTION__);
-            sleep(10);
+            mosq_sleep(info, 10);
             daemon_log(LOG_ERR, "%s Try to reconnect", __FUNCTION__);
             int res = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
             if (res) {
@@ -262,13 +456,155 @@ void * mosq_thread_loop(void * p) {
     pthread_exit(NULL);
 }
 
-void mosq_init(const char * progname) {
+/**
+ * re-arm EPOLLOUT only while mosquitto has unsent packets
+ */
+static void mosq_watch_update(void) {
+    uint32_t events = EPOLLIN;
+
+    if (mosq_fd < 0)
+        return;
+
+    if (mosquitto_want_write(mosq))
+        events |= EPOLLOUT;
+
+    mainloop_modify_fd(mosq_fd, events);
+}
+
+static void mosq_watch_destroy(void * UNUSED(user_data)) {
+    /* the socket belongs to libmosquitto, only forget it */
+    mosq_fd = -1;
+}
+
+static void mosq_schedule_reconnect(void) {
+    if (mosq_reconnect_timer < 0)
+        return;
+
+    if (!mosq_backoff)
+        mosq_backoff = MOSQ_BACKOFF_MIN;
+    else if (mosq_backoff < MOSQ_BACKOFF_MAX / 2)
+        mosq_backoff *= 2;
+    else
+        mosq_backoff = MOSQ_BACKOFF_MAX;
+
+    daemon_log(LOG_INFO, "%s reconnect in %u ms", __FUNCTION__, mosq_backoff);
+    mainloop_modify_timeout(mosq_reconnect_timer, mosq_backoff);
+}
+
+static void mosq_connection_lost(int res) {
+    daemon_log(LOG_ERR, "%s %s", __FUNCTION__, mosquitto_strerror(res));
+
+    if (mosq_fd >= 0)
+        mainloop_remove_fd(mosq_fd);
+
+    mosq_schedule_reconnect();
+}
+
+static void mosq_io_cb(int UNUSED(fd), uint32_t events, void * UNUSED(user_data)) {
+    int res = MOSQ_ERR_SUCCESS;
+
+    if (events & EPOLLIN)
+        res = mosquitto_loop_read(mosq, 1);
+
+    if (res == MOSQ_ERR_SUCCESS && (events & EPOLLOUT))
+        res = mosquitto_loop_write(mosq, 1);
+
+    if (res == MOSQ_ERR_SUCCESS && (events & (EPOLLERR | EPOLLHUP)))
+        res = MOSQ_ERR_CONN_LOST;
+
+    if (res != MOSQ_ERR_SUCCESS) {
+        mosq_connection_lost(res);
+        return;
+    }
+
+    mosq_watch_update();
+}
+
+static bool mosq_watch_add(void) {
+    int fd = mosquitto_socket(mosq);
+
+    if (fd < 0)
+        return false;
+
+    if (mainloop_add_fd(fd, EPOLLIN, mosq_io_cb, NULL, mosq_watch_destroy) < 0)
+        return false;
+
+    mosq_fd = fd;
+    mosq_watch_update();
+
+    return true;
+}
+
+static void mosq_misc_cb(int fd, void * UNUSED(user_data)) {
+    mosq_drain_samples();
+
+    if (mosq_fd >= 0) {
+        int res = mosquitto_loop_misc(mosq);
+
+        if (res != MOSQ_ERR_SUCCESS)
+            mosq_connection_lost(res);
+        else
+            mosq_watch_update();
+    }
+
+    mainloop_modify_timeout(fd, MOSQ_MISC_INTERVAL);
+}
+
+static void mosq_reconnect_cb(int UNUSED(fd), void * UNUSED(user_data)) {
+    int res;
+
+    if (mosq_fd >= 0)
+        return;
+
+    res = mosquitto_reconnect_async(mosq);
+    if (res != MOSQ_ERR_SUCCESS || !mosq_watch_add()) {
+        daemon_log(LOG_ERR, "%s Can't connect to Mosquitto server %s", __FUNCTION__,
+                   mosquitto_strerror(res));
+        mosq_schedule_reconnect();
+    }
+}
+
+/**
+ * the mainloop dropped a timer (mainloop_run teardown)
+ *
+ * @param user_data pointer to the timer id to reset
+ */
+static void mosq_timer_destroy(void * user_data) {
+    *(int *) user_data = -1;
+}
+
+/**
+ * register the mosquitto socket and timers with the current mainloop
+ * must follow every mainloop_init, it does nothing in thread mode
+ */
+void mosq_attach(void) {
+    if (!mosq || !mosq_use_mainloop)
+        return;
+
+    mosq_misc_timer = mainloop_add_timeout(MOSQ_MISC_INTERVAL, mosq_misc_cb,
+                                           &mosq_misc_timer, mosq_timer_destroy);
+
+    /* not armed until mosq_schedule_reconnect */
+    mosq_reconnect_timer = mainloop_add_timeout(0, mosq_reconnect_cb,
+                                                &mosq_reconnect_timer,
+                                                mosq_timer_destroy);
+
+    if (!mosq_watch_add())
+        mosq_schedule_reconnect();
+}
+
+void mosq_init(const char * progname, bool use_mainloop) {
 
 //    hostname = calloc(1, HOSTNAME_SIZE);
 //    gethostname(hostname, HOSTNAME_SIZE - 1);
 
     bool clean_session = true;
 
+    mosq_use_mainloop = use_mainloop;
+    sample_ring = spsc_ring_new(sizeof(struct mosq_sample), MOSQ_SAMPLE_RING_SIZE);
+    if (!sample_ring) {
+        daemon_log(LOG_ERR, "mosq Error: can't allocate sample ring.");
+    }
     mosquitto_lib_init();
     char * tmp = alloca(strlen(progname) + strlen(hostname) + 2);
     strcpy(tmp, progname);
@@ -290,6 +626,14 @@ void mosq_init(const char * progname) {
         mosquitto_username_pw_set(mosq, mqtt_username, mqtt_password);
         mosquitto_will_set(mosq, create_topic(MQTT_LWT_TOPIC), strlen(OFFLINE), OFFLINE, 0, true);
         daemon_log(LOG_INFO, "Try connect to Mosquitto server as %s", tmp);
+        if (mosq_use_mainloop) {
+            /* the socket is picked up by mosq_attach */
+            int res = mosquitto_connect_async(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
+            if (res) {
+                daemon_log(LOG_ERR, "Can't connect to Mosquitto server %s", mosquitto_strerror(res));
+            }
+            return;
+        }
         int res = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
         if (res) {
             daemon_log(LOG_ERR, "Can't connect to Mosquitto server %s", mosquitto_strerror(res));
@@ -299,27 +643,124 @@ void mosq_init(const char * progname) {
 
 }
 
+/**
+ * write out what is queued before the disconnect, mosquitto_loop waits for
+ * the socket in both modes, the mainloop does not run any more
+ */
+static void mosq_flush(void) {
+    uint64_t deadline = timeMillis() + MOSQ_FLUSH_TIMEOUT;
+
+    while (mosquitto_want_write(mosq) && timeMillis() < deadline) {
+        if (mosquitto_loop(mosq, 100, 1) != MOSQ_ERR_SUCCESS) {
+            break;
+        }
+    }
+}
+
+/**
+ * stop the publisher thread, then publish every LWT offline from the
+ * caller, flush them and disconnect
+ * in mainloop mode it is called once mainloop_run returned
+ */
 void mosq_destroy(void) {
-    mqtt_publish_lwt(false);
     client_info.do_exit = true;
-    pthread_join(mosq_th, NULL);
+    if (mosq_th) {
+        pthread_join(mosq_th, NULL);
+        mosq_th = 0;
+    }
     if (mosq) {
+        for (unsigned int i = 0; i < devices_count; i++) {
+            mqtt_publish_device_lwt(&devices[i], false);
+        }
+        mqtt_publish_lwt(false);
+        mosq_flush();
         mosquitto_disconnect(mosq);
         mosquitto_destroy(mosq);
+        mosq = NULL;
     }
     mosquitto_lib_cleanup();
+    spsc_ring_free(sample_ring);
+    sample_ring = NULL;
+    for (unsigned int i = 0; i < devices_count; i++) {
+        FREE(devices[i].name);
+    }
+    FREE(devices);
+    devices_count = 0;
+}
+
+/**
+ * register a meter, its readings go to tele/<hostname>/<name>/STATE
+ * must be called before mosq_init
+ *
+ * @param name	topic level of the meter
+ * @return device index for mosq_gather_data or -1 on error
+ */
+int mosq_add_device(const char * name) {
+    struct mosq_device * tmp;
+
+    if (sample_ring || devices_count >= UINT16_MAX) {
+        return -1;
+    }
+    tmp = realloc(devices, (devices_count + 1) * sizeof(*devices));
+    if (!tmp) {
+        return -1;
+    }
+    devices = tmp;
+    memset(&devices[devices_count], 0, sizeof(*devices));
+    devices[devices_count].name = strdup(name);
+    if (!devices[devices_count].name) {
+        return -1;
+    }
+    return (int) devices_count++;
 }
 
-void mosq_gather_data(double current, double voltage) {
-    static double total_current = 0.0f;
-    static double total_voltage = 0.0f;
-    static int total_count = 0.0f;
-    total_current += current;
-    total_voltage += voltage;
-    total_count++;
-    if (mosq_publish_state(total_current / total_count, total_voltage / total_count)) {
-        total_current = 0;
-        total_voltage = 0;
-        total_count = 0;
+/**
+ * queue a decoded sample for the publisher, never blocks
+ * called from the BLE notification path (single producer)
+ */
+void mosq_gather_data(unsigned int device, uint32_t current_ma, uint32_t voltage_mv) {
+    struct mosq_sample sample = {
+        .device = device,
+        .kind = MOSQ_SAMPLE_DATA,
+        .current_ma = current_ma,
+        .voltage_mv = voltage_mv,
+    };
+
+    if (sample_ring) {
+        spsc_ring_push(sample_ring, &sample);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * flag a device connected/disconnected for the publisher, unlike samples it
+ * cannot be dropped on a full ring
+ * called from the BLE side (single producer)
+ */
+void mosq_device_state(unsigned int device, bool online) {
+    struct mosq_device * dev;
+    unsigned int state;
+
+    if (device >= devices_count) {
+        return;
+    }
+    dev = &devices[device];
+    state = __atomic_load_n(&dev->state, __ATOMIC_RELAXED);
+    __atomic_store_n(&dev->state, (((state >> 1) + 1) << 1) | online, __ATOMIC_RELEASE);
+}
+
+/**
+ * queue an ATT latency snapshot of one opcode for the publisher, it goes
+ * out with the next device state
+ * called from the BLE side (single producer)
+ */
+void mosq_att_latency(unsigned int device, const struct mosq_latency * latency) {
+    struct mosq_sample sample = {
+        .device = device,
+        .kind = MOSQ_SAMPLE_LATENCY,
+        .latency = *latency,
+    };
+
+    if (sample_ring) {
+        spsc_ring_push(sample_ring, &sample);
+    }
+}
@@ -8,10 +8,54 @@
 #ifndef SRC_MQTT_H
 #define SRC_MQTT_H
 
-void mosq_init(const char * progname);
+#include <stdbool.h>
+#include <stdint.h>
+
+void mosq_init(const char * progname, bool use_mainloop);
+
+void mosq_attach(void);
 
 void mosq_destroy(void);
 
-void mosq_gather_data(double current, double voltage);
+int mosq_add_device(const char * name);
+
+enum mosq_sample_kind {
+    MOSQ_SAMPLE_DATA = 0,
+    MOSQ_SAMPLE_LATENCY,
+};
+
+/**
+ * ATT latency of one opcode of a device since it connected, microseconds
+ */
+struct mosq_latency {
+    uint8_t opcode;
+    uint32_t count;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t wait_p99_us;
+};
+
+/**
+ * decoded sample or ATT latency snapshot handed from the BLE side to the
+ * MQTT publisher
+ */
+struct mosq_sample {
+    uint16_t device;
+    uint16_t kind;
+    union {
+        struct {
+            uint32_t current_ma;
+            uint32_t voltage_mv;
+        };
+        struct mosq_latency latency;    /**< MOSQ_SAMPLE_LATENCY */
+    };
+};
+
+void mosq_gather_data(unsigned int device, uint32_t current_ma, uint32_t voltage_mv);
+
+void mosq_device_state(unsigned int device, bool online);
+
+void mosq_att_latency(unsigned int device, const struct mosq_latency * latency);
 
 #endif //SRC_MQTT_H
\ No newline at end of file
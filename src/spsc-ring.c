@@ -0,0 +1,157 @@
+/**
+ * @file spsc-ring.c
+ * @brief fixed capacity single producer / single consumer ring
+ *
+ * One thread pushes, one thread pops, no lock. The producer index and
+ * counters share one cache line, the consumer index and the high watermark
+ * another, so the two sides never write to the same line. Each side keeps
+ * a cached copy of the other index and only reloads it when the ring looks
+ * full (producer) or empty (consumer).
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "util.h"
+#include "spsc-ring.h"
+
+#define CACHE_LINE_SIZE 64
+
+struct spsc_ring {
+    /* read only after spsc_ring_new */
+    uint8_t * data;
+    size_t elem_size;
+    unsigned int mask;
+
+    /* producer side */
+    _Alignas(CACHE_LINE_SIZE) unsigned int head;
+    unsigned int tail_cache;
+    uint64_t pushed;
+    uint64_t dropped;
+
+    /* consumer side */
+    _Alignas(CACHE_LINE_SIZE) unsigned int tail;
+    unsigned int head_cache;
+    unsigned int high_watermark;
+};
+
+/**
+ * allocate a ring
+ *
+ * @param elem_size	size of one element
+ * @param capacity	number of elements, rounded up to a power of 2
+ * @return		ring or NULL
+ */
+struct spsc_ring * spsc_ring_new(size_t elem_size, unsigned int capacity) {
+    struct spsc_ring * ring;
+    unsigned int size = 1;
+
+    if (!elem_size || !capacity || capacity > (1U << 31))
+        return NULL;
+
+    while (size < capacity)
+        size <<= 1;
+
+    if (posix_memalign((void **) &ring, CACHE_LINE_SIZE, sizeof(*ring)))
+        return NULL;
+
+    memset(ring, 0, sizeof(*ring));
+
+    ring->data = calloc(size, elem_size);
+    if (!ring->data) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->elem_size = elem_size;
+    ring->mask = size - 1;
+
+    return ring;
+}
+
+void spsc_ring_free(struct spsc_ring * ring) {
+    if (!ring)
+        return;
+
+    free(ring->data);
+    free(ring);
+}
+
+/**
+ * copy elem into the ring, producer thread only
+ *
+ * @param ring	ring
+ * @param elem	element to copy
+ * @return	false if the ring is full (the element is counted as dropped)
+ */
+bool spsc_ring_push(struct spsc_ring * ring, const void * elem) {
+    unsigned int head = ring->head;
+
+    if (head - ring->tail_cache > ring->mask) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache > ring->mask) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1,
+                             __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+
+    memcpy(ring->data + (head & ring->mask) * ring->elem_size, elem,
+           ring->elem_size);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ring->pushed, ring->pushed + 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+/**
+ * copy the oldest element out of the ring, consumer thread only
+ *
+ * @param ring	ring
+ * @param elem	destination
+ * @return	false if the ring is empty
+ */
+bool spsc_ring_pop(struct spsc_ring * ring, void * elem) {
+    unsigned int tail = ring->tail;
+    unsigned int used;
+
+    if (tail == ring->head_cache) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->head_cache)
+            return false;
+
+        /* the backlog the consumer found when it came back */
+        used = ring->head_cache - tail;
+        if (used > ring->high_watermark)
+            __atomic_store_n(&ring->high_watermark, used, __ATOMIC_RELAXED);
+    }
+
+    memcpy(elem, ring->data + (tail & ring->mask) * ring->elem_size,
+           ring->elem_size);
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * number of elements waiting, exact only from one of the two sides
+ */
+unsigned int spsc_ring_count(struct spsc_ring * ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void spsc_ring_get_stats(struct spsc_ring * ring, struct spsc_ring_stats * stats) {
+    stats->pushed = __atomic_load_n(&ring->pushed, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    stats->high_watermark = __atomic_load_n(&ring->high_watermark,
+                                            __ATOMIC_RELAXED);
+    stats->capacity = ring->mask + 1;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file spsc-ring.h
+ * @brief fixed capacity single producer / single consumer ring
+ *
+ */
+#ifndef SRC_SPSC_RING_H
+#define SRC_SPSC_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct spsc_ring;
+
+/**
+ * @brief ring counters, readable from any thread
+ */
+struct spsc_ring_stats {
+    uint64_t pushed;            /**< elements accepted */
+    uint64_t dropped;           /**< elements refused because the ring was full */
+    unsigned int high_watermark;/**< largest backlog the consumer found */
+    unsigned int capacity;      /**< ring size in elements */
+};
+
+struct spsc_ring * spsc_ring_new(size_t elem_size, unsigned int capacity);
+void spsc_ring_free(struct spsc_ring * ring);
+
+bool spsc_ring_push(struct spsc_ring * ring, const void * elem);
+bool spsc_ring_pop(struct spsc_ring * ring, void * elem);
+
+unsigned int spsc_ring_count(struct spsc_ring * ring);
+void spsc_ring_get_stats(struct spsc_ring * ring, struct spsc_ring_stats * stats);
+
+#endif //SRC_SPSC_RING_H
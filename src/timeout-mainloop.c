@@ -0,0 +1,478 @@
+/**
+ * @file timeout-mainloop.c
+ * @brief timeout.h implementation on top of the epoll mainloop
+ * @see mainloop.c
+ *
+ * All timeouts share one timerfd registered with the mainloop. Pending
+ * timeouts are kept in a hierarchical timer wheel (4 levels of 64 slots,
+ * 1 ms tick) so that arming and cancelling a timeout is O(1) whatever the
+ * number of outstanding ATT or gatt-db requests. The timerfd is always armed
+ * for the next slot that holds something, so an idle wheel costs no wakeups.
+ *
+ */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "mainloop.h"
+#include "util.h"
+#include "timeout.h"
+
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS		4
+/* Longest delay a timer can be filed for; longer ones are re-filed */
+#define WHEEL_MAX_DELTA		((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+/* Timeout ids are <generation:12><index + 1:20> so stale ids never match */
+#define TIMER_INDEX_BITS	20
+#define TIMER_INDEX_MASK	((1U << TIMER_INDEX_BITS) - 1)
+#define TIMER_GEN_MASK		((1U << (32 - TIMER_INDEX_BITS)) - 1)
+
+#define TIMER_NONE		-1
+
+/**
+ * @brief one pending timeout, linked in a wheel slot by index
+ */
+struct timer_data {
+    unsigned int id;			/**< public id, 0 if the entry is free */
+    unsigned int gen;			/**< bumped each time the entry is freed */
+    unsigned int interval;		/**< timeout in ms, used to re-arm */
+    uint64_t expires;			/**< absolute expiry tick */
+    int bucket;				/**< wheel slot holding the timer or TIMER_NONE */
+    int prev;				/**< previous timer in the slot */
+    int next;				/**< next timer in the slot, or in the free list */
+    bool running;			/**< callback in progress */
+    bool removed;			/**< timeout_remove called from the callback */
+    timeout_func_t func;		/**< callback, return true to repeat */
+    timeout_destroy_func_t destroy;	/**< user_data house keeping */
+    void * user_data;			/**< user pointer */
+};
+
+/**
+ * @brief timer wheel state (process wide, like the mainloop itself)
+ */
+static struct {
+    int fd;					/**< timerfd, -1 if not registered */
+    uint64_t now;				/**< last processed tick */
+    uint64_t armed;				/**< tick the timerfd is armed for, 0 if idle */
+    int buckets[WHEEL_LEVELS * WHEEL_SIZE];	/**< slot list heads */
+    uint64_t occupied[WHEEL_LEVELS];	/**< non empty slots bitmap per level */
+    struct timer_data * timers;		/**< timer table, grows on demand */
+    unsigned int size;			/**< allocated entries in timers */
+    unsigned int count;			/**< pending timers */
+    int free_head;				/**< first free entry */
+} wheel = { .fd = -1, .free_head = TIMER_NONE };
+
+static uint64_t wheel_ticks(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t rotate_right(uint64_t bits, unsigned int n) {
+    if (!n)
+        return bits;
+
+    return (bits >> n) | (bits << (64 - n));
+}
+
+static void bucket_link(int bucket, int idx) {
+    struct timer_data * timer = &wheel.timers[idx];
+    int head = wheel.buckets[bucket];
+
+    timer->bucket = bucket;
+    timer->prev = TIMER_NONE;
+    timer->next = head;
+
+    if (head != TIMER_NONE)
+        wheel.timers[head].prev = idx;
+
+    wheel.buckets[bucket] = idx;
+    wheel.occupied[bucket / WHEEL_SIZE] |= 1ULL << (bucket & WHEEL_MASK);
+}
+
+static void bucket_unlink(int idx) {
+    struct timer_data * timer = &wheel.timers[idx];
+    int bucket = timer->bucket;
+
+    if (bucket == TIMER_NONE)
+        return;
+
+    if (timer->prev != TIMER_NONE)
+        wheel.timers[timer->prev].next = timer->next;
+    else
+        wheel.buckets[bucket] = timer->next;
+
+    if (timer->next != TIMER_NONE)
+        wheel.timers[timer->next].prev = timer->prev;
+
+    if (wheel.buckets[bucket] == TIMER_NONE)
+        wheel.occupied[bucket / WHEEL_SIZE] &=
+            ~(1ULL << (bucket & WHEEL_MASK));
+
+    timer->bucket = TIMER_NONE;
+    timer->prev = TIMER_NONE;
+    timer->next = TIMER_NONE;
+}
+
+/**
+ * file a timer in the slot matching its distance from the wheel position
+ *
+ * @param idx	timer index
+ */
+static void wheel_insert(int idx) {
+    struct timer_data * timer = &wheel.timers[idx];
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires < wheel.now)
+        expires = wheel.now;
+
+    delta = expires - wheel.now;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        expires = wheel.now + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+            break;
+    }
+
+    bucket_link(level * WHEEL_SIZE +
+                ((expires >> (WHEEL_BITS * level)) & WHEEL_MASK), idx);
+}
+
+/**
+ * tick at which the wheel has something to do: expire a level 0 slot or
+ * cascade a higher level slot
+ *
+ * @return	tick or 0 if the wheel is empty
+ */
+static uint64_t wheel_next_event(void) {
+    uint64_t next = 0;
+    int level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        unsigned int shift = WHEEL_BITS * level;
+        uint64_t base, bits, tick;
+
+        if (!wheel.occupied[level])
+            continue;
+
+        base = wheel.now >> shift;
+        bits = rotate_right(wheel.occupied[level], (base + 1) & WHEEL_MASK);
+        tick = (base + 1 + __builtin_ctzll(bits)) << shift;
+
+        if (!next || tick < next)
+            next = tick;
+    }
+
+    return next;
+}
+
+static void wheel_rearm(void) {
+    struct itimerspec itimer;
+    uint64_t next;
+
+    if (wheel.fd < 0)
+        return;
+
+    next = wheel_next_event();
+    if (next == wheel.armed)
+        return;
+
+    memset(&itimer, 0, sizeof(itimer));
+    itimer.it_value.tv_sec = next / 1000;
+    itimer.it_value.tv_nsec = (next % 1000) * 1000000;
+
+    if (timerfd_settime(wheel.fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+        return;
+
+    wheel.armed = next;
+}
+
+static void timer_free(int idx) {
+    struct timer_data * timer = &wheel.timers[idx];
+    timeout_destroy_func_t destroy = timer->destroy;
+    void * user_data = timer->user_data;
+
+    bucket_unlink(idx);
+
+    timer->id = 0;
+    timer->gen = (timer->gen + 1) & TIMER_GEN_MASK;
+    timer->func = NULL;
+    timer->destroy = NULL;
+    timer->user_data = NULL;
+    timer->next = wheel.free_head;
+    wheel.free_head = idx;
+    wheel.count--;
+
+    if (destroy)
+        destroy(user_data);
+}
+
+static void wheel_cascade(int level, unsigned int slot) {
+    int bucket = level * WHEEL_SIZE + slot;
+
+    while (wheel.buckets[bucket] != TIMER_NONE) {
+        int idx = wheel.buckets[bucket];
+
+        bucket_unlink(idx);
+        wheel_insert(idx);
+    }
+}
+
+static void wheel_expire(unsigned int slot) {
+    while (wheel.buckets[slot] != TIMER_NONE) {
+        int idx = wheel.buckets[slot];
+        struct timer_data * timer = &wheel.timers[idx];
+        bool repeat;
+
+        bucket_unlink(idx);
+
+        timer->running = true;
+        repeat = timer->func(timer->user_data);
+
+        /* the callback may have grown (moved) the timer table */
+        timer = &wheel.timers[idx];
+        timer->running = false;
+
+        if (!repeat || timer->removed) {
+            timer_free(idx);
+            continue;
+        }
+
+        /* repeating timers are re-filed relative to the current tick */
+        timer->expires = wheel.now + (timer->interval ? timer->interval : 1);
+        wheel_insert(idx);
+    }
+}
+
+/**
+ * move the wheel up to target, running expired timers on the way
+ *
+ * @param target	current tick
+ */
+static void wheel_advance(uint64_t target) {
+    while (wheel.now < target && wheel.count) {
+        uint64_t next = wheel_next_event();
+        int level;
+
+        /* nothing to do before next: jump there directly */
+        if (!next || next > target) {
+            wheel.now = target;
+            break;
+        }
+
+        wheel.now = next;
+
+        if (!(wheel.now & WHEEL_MASK)) {
+            for (level = 1; level < WHEEL_LEVELS; level++) {
+                unsigned int slot = (wheel.now >> (WHEEL_BITS * level)) &
+                                    WHEEL_MASK;
+
+                wheel_cascade(level, slot);
+                if (slot)
+                    break;
+            }
+        }
+
+        wheel_expire(wheel.now & WHEEL_MASK);
+    }
+
+    if (wheel.now < target)
+        wheel.now = target;
+}
+
+static void wheel_callback(int fd, uint32_t events,
+                           __attribute__((unused)) void * user_data) {
+    uint64_t expired;
+
+    if (events & (EPOLLERR | EPOLLHUP))
+        return;
+
+    if (read(fd, &expired, sizeof(expired)) != sizeof(expired))
+        return;
+
+    wheel.armed = 0;
+    wheel_advance(wheel_ticks());
+    wheel_rearm();
+}
+
+/**
+ * the mainloop dropped the timerfd (mainloop_run teardown)
+ * pending timers are kept and the fd is registered again on next use
+ *
+ * @param user_data	unused
+ */
+static void wheel_fd_destroy(__attribute__((unused)) void * user_data) {
+    close(wheel.fd);
+    wheel.fd = -1;
+    wheel.armed = 0;
+}
+
+static bool wheel_setup(void) {
+    unsigned int i;
+
+    if (!wheel.timers) {
+        for (i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++)
+            wheel.buckets[i] = TIMER_NONE;
+
+        wheel.now = wheel_ticks();
+    }
+
+    if (wheel.fd >= 0)
+        return true;
+
+    wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wheel.fd < 0)
+        return false;
+
+    if (mainloop_add_fd(wheel.fd, EPOLLIN, wheel_callback, NULL,
+                        wheel_fd_destroy) < 0) {
+        close(wheel.fd);
+        wheel.fd = -1;
+        return false;
+    }
+
+    wheel.armed = 0;
+
+    return true;
+}
+
+static int timer_alloc(void) {
+    struct timer_data * timers;
+    unsigned int size, i;
+    int idx;
+
+    if (wheel.free_head == TIMER_NONE) {
+        size = wheel.size ? wheel.size * 2 : 64;
+        if (size > TIMER_INDEX_MASK)
+            return TIMER_NONE;
+
+        timers = realloc(wheel.timers, size * sizeof(*timers));
+        if (!timers)
+            return TIMER_NONE;
+
+        memset(timers + wheel.size, 0,
+               (size - wheel.size) * sizeof(*timers));
+
+        for (i = size; i > wheel.size; i--) {
+            timers[i - 1].bucket = TIMER_NONE;
+            timers[i - 1].next = wheel.free_head;
+            wheel.free_head = i - 1;
+        }
+
+        wheel.timers = timers;
+        wheel.size = size;
+    }
+
+    idx = wheel.free_head;
+    wheel.free_head = wheel.timers[idx].next;
+    wheel.count++;
+
+    return idx;
+}
+
+static struct timer_data * timer_lookup(unsigned int id) {
+    unsigned int idx = (id & TIMER_INDEX_MASK) - 1;
+
+    if (!id || idx >= wheel.size || wheel.timers[idx].id != id)
+        return NULL;
+
+    return &wheel.timers[idx];
+}
+
+/**
+ * call func(user_data) after timeout ms, again every timeout ms while func
+ * returns true
+ *
+ * @param timeout	delay in ms
+ * @param func		callback
+ * @param user_data	callback argument
+ * @param destroy	user_data house keeping, called when the timeout goes away
+ * @return		timeout id or 0 if error
+ */
+unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
+                         void * user_data, timeout_destroy_func_t destroy) {
+    struct timer_data * timer;
+    int idx;
+
+    if (!func || !wheel_setup())
+        return 0;
+
+    /* an empty wheel may lag behind, do not file timers in the past */
+    if (!wheel.count)
+        wheel.now = wheel_ticks();
+
+    idx = timer_alloc();
+    if (idx == TIMER_NONE)
+        return 0;
+
+    timer = &wheel.timers[idx];
+    timer->id = (timer->gen << TIMER_INDEX_BITS) | (idx + 1);
+    timer->interval = timeout;
+    timer->expires = wheel_ticks() + (timeout ? timeout : 1);
+    timer->running = false;
+    timer->removed = false;
+    timer->func = func;
+    timer->destroy = destroy;
+    timer->user_data = user_data;
+
+    wheel_insert(idx);
+    wheel_rearm();
+
+    return timer->id;
+}
+
+/**
+ * cancel a timeout, its destroy function is called
+ *
+ * @param id	timeout id returned by timeout_add
+ */
+void timeout_remove(unsigned int id) {
+    struct timer_data * timer = timer_lookup(id);
+
+    if (!timer)
+        return;
+
+    /* freed by wheel_expire once the callback returns */
+    if (timer->running) {
+        timer->removed = true;
+        return;
+    }
+
+    timer_free(timer - wheel.timers);
+    wheel_rearm();
+}